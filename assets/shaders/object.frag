@@ -4,7 +4,7 @@ out vec4 color;
 in vec3 inNormals;
 in vec4 inPosition;
 
-uniform vec4 in_color;
+in vec4 in_color;
 
 uniform vec3 eye_position;
 
@@ -17,7 +17,23 @@ float offset_lookup(sampler2DShadow map, vec4 loc, vec2 offset) {
 }
 
 const mat4 depthScaleMatrix = mat4(0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
-uniform mat4 shadow_matrix;
+
+uniform mat4 shadow_matrices[4];
+
+// Cascades live in the quarters of the shadow atlas, the first one the
+// position falls into wins. The margin keeps the filter taps inside it.
+vec4 get_shadow_coord(vec4 position) {
+  for (int i=0; i<4; i++) {
+    vec4 sc = depthScaleMatrix * shadow_matrices[i] * position;
+
+    if (sc.x > 0.01 && sc.y > 0.01 && sc.x < 0.99 && sc.y < 0.99) {
+      sc.xy = (sc.xy + vec2(i % 2, i / 2) * sc.w) * 0.5;
+      return sc;
+    }
+  }
+
+  return vec4(0.0);
+}
 
 vec2 get_shadow_offsets(vec3 N, vec3 L) {
   float cos_alpha = clamp(dot(N, L), 0.0, 1.0);
@@ -41,7 +57,7 @@ void main() {
 
   vec2 shadow_offset = get_shadow_offsets(normals, direction_to_light);
 
-  vec4 sc = depthScaleMatrix * shadow_matrix * (inPosition + vec4(normals * 2, 0.0));
+  vec4 sc = get_shadow_coord(inPosition + vec4(normals * 2, 0.0));
 
   float shadow = 1.0;
 
@@ -3,17 +3,22 @@
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normals;
 
+// Per instance, see RenderInstance
+layout (location = 4) in mat4 instance_model_view;
+layout (location = 8) in vec4 instance_color;
+layout (location = 9) in mat3 instance_normal;
+
 uniform mat4 uPMatrix;
-uniform mat4 uMVMatrix;
-uniform mat3 uNMatrix;
 
 out vec3 inNormals;
 out vec4 inPosition;
+out vec4 in_color;
 
 void main() {
-  inNormals = uNMatrix * normals;
+  inNormals = instance_normal * normals;
+  in_color = instance_color;
 
-  inPosition = uMVMatrix * vec4(position, 1.0);
+  inPosition = instance_model_view * vec4(position, 1.0);
 
   gl_Position = uPMatrix * inPosition;
 }
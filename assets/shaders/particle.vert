@@ -12,7 +12,10 @@ uniform vec3 camera_right;
 out vec4 inColor;
 
 void main() {
-  vec3 final_position = position.xyz + normalize(camera_right) * data.x * position.w + normalize(camera_up) * data.y * position.w;
+  // NOTE: GPU simulated particles are never removed, faded out ones collapse
+  float size = color.a < 1.0 / 255.0 ? 0.0 : position.w;
+
+  vec3 final_position = position.xyz + normalize(camera_right) * data.x * size + normalize(camera_up) * data.y * size;
 
   inColor = color;
 
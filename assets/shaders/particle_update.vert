@@ -0,0 +1,68 @@
+#version 330 core
+
+// Keep in sync with MAX_GPU_PARTICLE_EMITTERS.
+#define MAX_EMITTERS 64
+
+layout (location = 0) in vec4 position;
+layout (location = 1) in vec4 velocity;
+layout (location = 2) in vec4 color;
+
+uniform float delta_time;
+uniform int seed;
+
+// Slots emit_start .. emit_start + emit_count, wrapping at capacity, are
+// replaced by new particles, one per emitter.
+uniform int capacity;
+uniform int emit_start;
+uniform int emit_count;
+
+// Size in w.
+uniform vec4 emitter_positions[MAX_EMITTERS];
+uniform vec4 emitter_colors[MAX_EMITTERS];
+uniform float emitter_gravity[MAX_EMITTERS];
+
+out vec4 out_position;
+out vec4 out_velocity;
+out vec4 out_color;
+
+uint hash(uint x) {
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+float random_between(inout uint state, float low, float high) {
+  state = hash(state);
+  return mix(low, high, float(state & 0xFFFFFFU) / 16777215.0);
+}
+
+void main() {
+  int emitter = (gl_VertexID - emit_start + capacity) % capacity;
+
+  if (emitter < emit_count) {
+    uint state = uint(gl_VertexID) ^ hash(uint(seed));
+
+    vec3 initial_velocity;
+    initial_velocity.x = random_between(state, -5.0, 5.0);
+    initial_velocity.y = random_between(state, 0.0, 10.0);
+    initial_velocity.z = random_between(state, -5.0, 5.0);
+
+    out_position = emitter_positions[emitter];
+    out_velocity = vec4(initial_velocity, emitter_gravity[emitter]);
+    out_color = emitter_colors[emitter];
+    return;
+  }
+
+  // NOTE: same integration as update_particles
+  vec3 v = velocity.xyz;
+  v.y += velocity.w * delta_time;
+
+  out_position.xyz = position.xyz + v * delta_time;
+  out_position.w = max(position.w - 0.6 * delta_time, 0.0);
+
+  out_velocity = vec4(v * (1.0 - delta_time), velocity.w);
+  out_color = vec4(color.rgb, color.a * (1.0 - delta_time * 4.0));
+}
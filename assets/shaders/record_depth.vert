@@ -3,12 +3,17 @@
 layout (location = 0) in vec3 position;
 layout (location = 2) in vec2 uv;
 
+// Per instance, see RenderInstance
+layout (location = 4) in mat4 instance_model_view;
+layout (location = 8) in vec4 instance_color;
+
 uniform mat4 uPMatrix;
-uniform mat4 uMVMatrix;
 
 out vec2 TexCoords;
+out vec4 in_color;
 
 void main() {
   TexCoords = uv * vec2(1.0, -1.0);
-  gl_Position = uPMatrix * uMVMatrix * vec4(position, 1.0);
+  in_color = instance_color;
+  gl_Position = uPMatrix * instance_model_view * vec4(position, 1.0);
 }
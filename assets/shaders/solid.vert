@@ -2,9 +2,15 @@
 
 layout (location = 0) in vec3 position;
 
+// Per instance, see RenderInstance
+layout (location = 4) in mat4 instance_model_view;
+layout (location = 8) in vec4 instance_color;
+
 uniform mat4 uPMatrix;
-uniform mat4 uMVMatrix;
+
+out vec4 in_color;
 
 void main() {
-  gl_Position = uPMatrix * uMVMatrix * vec4(position, 1.0);
+  in_color = instance_color;
+  gl_Position = uPMatrix * instance_model_view * vec4(position, 1.0);
 }
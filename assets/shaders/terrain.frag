@@ -18,7 +18,23 @@ float offset_lookup(sampler2DShadow map, vec4 loc, vec2 offset) {
 }
 
 const mat4 depthScaleMatrix = mat4(0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
-uniform mat4 shadow_matrix;
+
+uniform mat4 shadow_matrices[4];
+
+// Cascades live in the quarters of the shadow atlas, the first one the
+// position falls into wins. The margin keeps the filter taps inside it.
+vec4 get_shadow_coord(vec4 position) {
+  for (int i=0; i<4; i++) {
+    vec4 sc = depthScaleMatrix * shadow_matrices[i] * position;
+
+    if (sc.x > 0.01 && sc.y > 0.01 && sc.x < 0.99 && sc.y < 0.99) {
+      sc.xy = (sc.xy + vec2(i % 2, i / 2) * sc.w) * 0.5;
+      return sc;
+    }
+  }
+
+  return vec4(0.0);
+}
 
 void main() {
   vec3 normals = normalize(inNormals);
@@ -34,7 +50,7 @@ void main() {
   vec3 rim = vec3(smoothstep(0.5, 1.0, 1.0 - max(dot(V, normals), 0.0)));
   vec3 light = final_directional_light;
 
-  vec4 sc = depthScaleMatrix * shadow_matrix * (inPosition + vec4(normals * 4.0, 0.0));
+  vec4 sc = get_shadow_coord(inPosition + vec4(normals * 4.0, 0.0));
   float shadow = 1.0;
 
   if (sc.w > 0.0 && (sc.x > 0 && sc.y > 0) && (sc.x < 1 && sc.y < 1)) {
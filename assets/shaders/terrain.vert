@@ -1,20 +1,34 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normals;
-layout (location = 2) in vec3 colors;
+layout (location = 0) in float height;
+layout (location = 1) in vec2 normal;
 
 uniform mat4 uPMatrix;
 uniform mat4 uMVMatrix;
 uniform mat3 uNMatrix;
 
+uniform int grid_size;
+uniform float grid_detail;
+
 out vec3 inNormals;
 out vec4 inPosition;
 out vec3 inColors;
 
+vec3 octahedral_decode(vec2 value) {
+  vec3 result = vec3(value.x, 1.0 - abs(value.x) - abs(value.y), value.y);
+
+  if (result.y < 0.0) {
+    result.xz = (1.0 - abs(result.zx)) * vec2(result.x >= 0.0 ? 1.0 : -1.0, result.z >= 0.0 ? 1.0 : -1.0);
+  }
+
+  return normalize(result);
+}
+
 void main() {
-  inNormals = uNMatrix * normals;
-  inColors = colors;
+  vec3 position = vec3(float(gl_VertexID / grid_size) / grid_detail, height, float(gl_VertexID % grid_size) / grid_detail);
+
+  inNormals = uNMatrix * octahedral_decode(normal);
+  inColors = height < 7.0 ? vec3(0.8118, 0.5686, 0.3804) : vec3(0.4392, 0.4588, 0.3412);
 
   inPosition = uMVMatrix * vec4(position, 1.0);
 
@@ -0,0 +1,15 @@
+#version 330 core
+
+layout (location = 0) in float height;
+
+uniform mat4 uPMatrix;
+uniform mat4 uMVMatrix;
+
+uniform int grid_size;
+uniform float grid_detail;
+
+void main() {
+  vec3 position = vec3(float(gl_VertexID / grid_size) / grid_detail, height, float(gl_VertexID % grid_size) / grid_detail);
+
+  gl_Position = uPMatrix * uMVMatrix * vec4(position, 1.0);
+}
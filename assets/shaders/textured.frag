@@ -11,7 +11,6 @@ uniform vec3 shadow_light_position;
 uniform vec3 tint;
 
 uniform sampler2D textureImage;
-uniform mat4 shadow_matrix;
 
 float offset_lookup(sampler2DShadow map, vec4 loc, vec2 offset) {
   return textureProj(map, vec4(loc.xy + offset * texmapscale * loc.w, loc.z, loc.w));
@@ -19,6 +18,23 @@ float offset_lookup(sampler2DShadow map, vec4 loc, vec2 offset) {
 
 const mat4 depthScaleMatrix = mat4(0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.0, 0.0, 0.0, 0.5, 0.0, 0.5, 0.5, 0.5, 1.0);
 
+uniform mat4 shadow_matrices[4];
+
+// Cascades live in the quarters of the shadow atlas, the first one the
+// position falls into wins. The margin keeps the filter taps inside it.
+vec4 get_shadow_coord(vec4 position) {
+  for (int i=0; i<4; i++) {
+    vec4 sc = depthScaleMatrix * shadow_matrices[i] * position;
+
+    if (sc.x > 0.01 && sc.y > 0.01 && sc.x < 0.99 && sc.y < 0.99) {
+      sc.xy = (sc.xy + vec2(i % 2, i / 2) * sc.w) * 0.5;
+      return sc;
+    }
+  }
+
+  return vec4(0.0);
+}
+
 vec2 get_shadow_offsets(vec3 N, vec3 L) {
   float cos_alpha = clamp(dot(N, L), 0.0, 1.0);
   float offset_scale_N = sqrt(1 - cos_alpha*cos_alpha); // sin(acos(L·N))
@@ -44,7 +60,7 @@ void main() {
 
   vec2 shadow_offset = get_shadow_offsets(normals, direction_to_light);
 
-  vec4 sc = depthScaleMatrix * shadow_matrix * (inPosition + vec4(normals * 2, 0.0));
+  vec4 sc = get_shadow_coord(inPosition + vec4(normals * 2, 0.0));
 
   float shadow = 1.0;
 
@@ -6,7 +6,6 @@ in vec4 inPosition;
 in vec2 uvs;
 in vec4 clip_space;
 
-uniform vec4 in_color;
 uniform float znear;
 uniform float zfar;
 
@@ -4,9 +4,11 @@ layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normals;
 layout (location = 2) in vec2 uv;
 
+// Per instance, see RenderInstance
+layout (location = 4) in mat4 instance_model_view;
+layout (location = 9) in mat3 instance_normal;
+
 uniform mat4 uPMatrix;
-uniform mat4 uMVMatrix;
-uniform mat3 uNMatrix;
 
 out vec3 inNormals;
 out vec4 inPosition;
@@ -15,9 +17,9 @@ out vec2 uvs;
 out vec4 clip_space;
 
 void main() {
-  inNormals = uNMatrix * normals;
+  inNormals = instance_normal * normals;
 
-  inPosition = uMVMatrix * vec4(position, 1.0);
+  inPosition = instance_model_view * vec4(position, 1.0);
   uvs = uv;
 
   clip_space = uPMatrix * inPosition;
@@ -105,7 +105,7 @@ build_libraries() {
   build_glew &
   # build_jemalloc &
   # build_stb &
-  # build_perlin &
+  build_perlin &
 
   popd > /dev/null
 
@@ -123,6 +123,13 @@ build_game() {
   echo 'Building game'
   echo '=================='
 
+  # NOTE: the game links perlin.a, rebuild it when it's missing or stale
+  if [ ! -f libs/perlin/perlin.a ] || [ libs/perlin/perlin.cpp -nt libs/perlin/perlin.a ]; then
+    pushd libs > /dev/null
+    build_perlin
+    popd > /dev/null
+  fi
+
   clang++ -dynamiclib $game_main -o build/$app_name/Contents/Resources/app.dylib $shared_flags $game_flags $optimalization $internal
 }
 
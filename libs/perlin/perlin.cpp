@@ -20,6 +20,11 @@
 
 #include "perlin.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#define PERLIN_SSE2 1
+#include <emmintrin.h>
+#endif
+
 
 /* 2D, 3D and 4D Simplex Noise functions return 'random' values in (-1, 1).
 
@@ -468,6 +473,233 @@ float raw_noise_4d( const float x, const float y, const float z, const float w )
 }
 
 
+// Batched 2D Scaled Multi-octave Simplex noise.
+//
+// Same result as calling scaled_octave_noise_2d for every (x[n], y[n]) pair.
+// Octaves whose amplitude has underflowed to zero are skipped, they can't
+// change the sum.
+void scaled_octave_noise_2d_batch( const float octaves, const float persistence, const float scale, const float loBound, const float hiBound, const float* x, const float* y, float* out, const int count ) {
+    float xs[64];
+    float ys[64];
+    float noise[64];
+    float total[64];
+
+    for( int start=0; start < count; start += 64 ) {
+        int size = count - start < 64 ? count - start : 64;
+
+        float frequency = scale;
+        float amplitude = 1;
+        float maxAmplitude = 0;
+
+        for( int n=0; n < size; n++ ) {
+            total[n] = 0;
+        }
+
+        for( int i=0; i < octaves; i++ ) {
+            if( amplitude == 0 ) {
+                break;
+            }
+
+            for( int n=0; n < size; n++ ) {
+                xs[n] = x[start + n] * frequency;
+                ys[n] = y[start + n] * frequency;
+            }
+
+            raw_noise_2d_batch( xs, ys, noise, size );
+
+            for( int n=0; n < size; n++ ) {
+                total[n] += noise[n] * amplitude;
+            }
+
+            frequency *= 2;
+            maxAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        for( int n=0; n < size; n++ ) {
+            out[start + n] = (total[n] / maxAmplitude) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+        }
+    }
+}
+
+
+#if PERLIN_SSE2
+// Evaluates (float)((0.5 - a*a) - b*b) with the subtraction done in double,
+// exactly like the scalar code does.
+static inline __m128 falloff_4( const __m128 a, const __m128 b ) {
+    __m128 aa = _mm_mul_ps( a, a );
+    __m128 bb = _mm_mul_ps( b, b );
+    __m128d half = _mm_set1_pd( 0.5 );
+
+    __m128d lo = _mm_sub_pd( _mm_sub_pd( half, _mm_cvtps_pd( aa ) ), _mm_cvtps_pd( bb ) );
+    __m128d hi = _mm_sub_pd( _mm_sub_pd( half, _mm_cvtps_pd( _mm_movehl_ps( aa, aa ) ) ), _mm_cvtps_pd( _mm_movehl_ps( bb, bb ) ) );
+
+    return _mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) );
+}
+
+// Evaluates (float)((a - 1.0) + b) with the arithmetic done in double.
+static inline __m128 last_corner_offset_4( const __m128 a, const double b ) {
+    __m128d one = _mm_set1_pd( 1.0 );
+    __m128d offset = _mm_set1_pd( b );
+
+    __m128d lo = _mm_add_pd( _mm_sub_pd( _mm_cvtps_pd( a ), one ), offset );
+    __m128d hi = _mm_add_pd( _mm_sub_pd( _mm_cvtps_pd( _mm_movehl_ps( a, a ) ), one ), offset );
+
+    return _mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) );
+}
+
+// Evaluates (float)(a * b) with the multiplication done in double.
+static inline __m128 mul_double_4( const __m128 a, const double b ) {
+    __m128d factor = _mm_set1_pd( b );
+
+    __m128d lo = _mm_mul_pd( _mm_cvtps_pd( a ), factor );
+    __m128d hi = _mm_mul_pd( _mm_cvtps_pd( _mm_movehl_ps( a, a ) ), factor );
+
+    return _mm_movelh_ps( _mm_cvtpd_ps( lo ), _mm_cvtpd_ps( hi ) );
+}
+
+static inline __m128i fastfloor_4( const __m128 x ) {
+    __m128i truncated = _mm_cvttps_epi32( x );
+    __m128i positive = _mm_castps_si128( _mm_cmpgt_ps( x, _mm_setzero_ps() ) );
+
+    // positive is -1 for x > 0, so this is (int)x there and (int)x - 1 elsewhere
+    return _mm_sub_epi32( _mm_sub_epi32( truncated, _mm_set1_epi32( 1 ) ), positive );
+}
+
+// Dot product with the (x,y) part of grad3[g]. The first eight gradients
+// have x = +-1 picked by bit 0, the last four have x = 0. y is +-1 picked by
+// bit 1 for 0..3, 0 for 4..7 and +-1 picked by bit 0 for 8..11.
+static inline __m128 gradient_dot_4( const __m128i g, const __m128 x, const __m128 y ) {
+    __m128i one = _mm_set1_epi32( 1 );
+    __m128i bit0 = _mm_cmpeq_epi32( _mm_and_si128( g, one ), one );
+    __m128i bit1 = _mm_cmpeq_epi32( _mm_and_si128( g, _mm_set1_epi32( 2 ) ), _mm_set1_epi32( 2 ) );
+    __m128i below4 = _mm_cmplt_epi32( g, _mm_set1_epi32( 4 ) );
+    __m128i below8 = _mm_cmplt_epi32( g, _mm_set1_epi32( 8 ) );
+
+    __m128 sign_bit = _mm_set1_ps( -0.0f );
+    __m128 gx = _mm_or_ps( _mm_set1_ps( 1.0f ), _mm_and_ps( _mm_castsi128_ps( bit0 ), sign_bit ) );
+    gx = _mm_and_ps( gx, _mm_castsi128_ps( below8 ) );
+
+    __m128i y_sign = _mm_or_si128( _mm_and_si128( below4, bit1 ), _mm_andnot_si128( below8, bit0 ) );
+    __m128 gy = _mm_or_ps( _mm_set1_ps( 1.0f ), _mm_and_ps( _mm_castsi128_ps( y_sign ), sign_bit ) );
+    gy = _mm_andnot_ps( _mm_castsi128_ps( _mm_andnot_si128( below4, below8 ) ), gy );
+
+    return _mm_add_ps( _mm_mul_ps( gx, x ), _mm_mul_ps( gy, y ) );
+}
+
+static inline __m128 corner_4( const __m128 t, const __m128i g, const __m128 x, const __m128 y ) {
+    __m128 t2 = _mm_mul_ps( t, t );
+    __m128 n = _mm_mul_ps( _mm_mul_ps( t2, t2 ), gradient_dot_4( g, x, y ) );
+
+    return _mm_andnot_ps( _mm_cmplt_ps( t, _mm_setzero_ps() ), n );
+}
+
+// Permutation table modulo 12, used by the batched noise to index grad3 directly.
+static const unsigned char permMod12[512] = {
+    7,4,5,7,6,3,11,1,9,11,0,5,2,5,7,9,8,0,7,6,9,10,
+    8,3,1,0,9,10,11,10,6,4,7,0,6,3,0,2,5,2,10,0,3,11,
+    9,11,11,8,9,9,9,4,9,5,8,3,6,8,5,4,3,0,8,7,2,9,
+    11,2,7,0,3,10,5,2,2,3,11,3,1,2,0,7,1,2,4,9,8,5,
+    7,10,5,4,4,6,11,6,5,1,3,5,1,0,8,1,5,4,0,7,4,5,
+    6,1,8,4,3,10,8,8,3,2,8,4,1,6,5,6,3,4,4,1,10,10,
+    4,3,5,10,2,3,10,6,3,10,1,8,3,2,11,11,11,4,10,5,2,9,
+    4,6,7,3,2,9,11,8,8,2,8,10,7,10,5,9,5,11,11,7,4,9,
+    9,10,3,1,7,2,0,2,7,5,8,4,10,5,4,8,2,6,1,0,11,10,
+    2,1,10,6,0,0,11,11,6,1,9,3,1,7,9,2,11,11,1,0,10,7,
+    1,7,10,1,4,0,0,8,7,1,2,9,7,4,6,2,6,8,1,9,6,6,
+    7,5,0,0,3,9,8,3,6,6,11,1,0,0,
+
+    7,4,5,7,6,3,11,1,9,11,0,5,2,5,7,9,8,0,7,6,9,10,
+    8,3,1,0,9,10,11,10,6,4,7,0,6,3,0,2,5,2,10,0,3,11,
+    9,11,11,8,9,9,9,4,9,5,8,3,6,8,5,4,3,0,8,7,2,9,
+    11,2,7,0,3,10,5,2,2,3,11,3,1,2,0,7,1,2,4,9,8,5,
+    7,10,5,4,4,6,11,6,5,1,3,5,1,0,8,1,5,4,0,7,4,5,
+    6,1,8,4,3,10,8,8,3,2,8,4,1,6,5,6,3,4,4,1,10,10,
+    4,3,5,10,2,3,10,6,3,10,1,8,3,2,11,11,11,4,10,5,2,9,
+    4,6,7,3,2,9,11,8,8,2,8,10,7,10,5,9,5,11,11,7,4,9,
+    9,10,3,1,7,2,0,2,7,5,8,4,10,5,4,8,2,6,1,0,11,10,
+    2,1,10,6,0,0,11,11,6,1,9,3,1,7,9,2,11,11,1,0,10,7,
+    1,7,10,1,4,0,0,8,7,1,2,9,7,4,6,2,6,8,1,9,6,6,
+    7,5,0,0,3,9,8,3,6,6,11,1,0,0
+};
+
+static void raw_noise_2d_4( const float* x, const float* y, float* out ) {
+    float F2 = 0.5 * (sqrtf(3.0) - 1.0);
+    float G2 = (3.0 - sqrtf(3.0)) / 6.0;
+
+    __m128 vx = _mm_loadu_ps( x );
+    __m128 vy = _mm_loadu_ps( y );
+    __m128 vG2 = _mm_set1_ps( G2 );
+
+    __m128 s = _mm_mul_ps( _mm_add_ps( vx, vy ), _mm_set1_ps( F2 ) );
+    __m128i i = fastfloor_4( _mm_add_ps( vx, s ) );
+    __m128i j = fastfloor_4( _mm_add_ps( vy, s ) );
+
+    __m128 t = _mm_mul_ps( _mm_cvtepi32_ps( _mm_add_epi32( i, j ) ), vG2 );
+    __m128 x0 = _mm_sub_ps( vx, _mm_sub_ps( _mm_cvtepi32_ps( i ), t ) );
+    __m128 y0 = _mm_sub_ps( vy, _mm_sub_ps( _mm_cvtepi32_ps( j ), t ) );
+
+    __m128 lower = _mm_cmpgt_ps( x0, y0 );
+    __m128 i1 = _mm_and_ps( lower, _mm_set1_ps( 1.0f ) );
+    __m128 j1 = _mm_andnot_ps( lower, _mm_set1_ps( 1.0f ) );
+
+    __m128 x1 = _mm_add_ps( _mm_sub_ps( x0, i1 ), vG2 );
+    __m128 y1 = _mm_add_ps( _mm_sub_ps( y0, j1 ), vG2 );
+    __m128 x2 = last_corner_offset_4( x0, 2.0 * G2 );
+    __m128 y2 = last_corner_offset_4( y0, 2.0 * G2 );
+
+    int lane_i[4];
+    int lane_j[4];
+    int lane_lower[4];
+    _mm_storeu_si128( (__m128i*)lane_i, i );
+    _mm_storeu_si128( (__m128i*)lane_j, j );
+    _mm_storeu_si128( (__m128i*)lane_lower, _mm_castps_si128( lower ) );
+
+    int gi0[4], gi1[4], gi2[4];
+    for( int n=0; n < 4; n++ ) {
+        int ii = lane_i[n] & 255;
+        int jj = lane_j[n] & 255;
+        int i1 = lane_lower[n] & 1;
+
+        gi0[n] = permMod12[ii+perm[jj]];
+        gi1[n] = permMod12[ii+i1+perm[jj+1-i1]];
+        gi2[n] = permMod12[ii+1+perm[jj+1]];
+    }
+
+    // Built with set instead of a load so the four scalar stores above don't
+    // stall on store forwarding.
+    __m128i g0 = _mm_set_epi32( gi0[3], gi0[2], gi0[1], gi0[0] );
+    __m128i g1 = _mm_set_epi32( gi1[3], gi1[2], gi1[1], gi1[0] );
+    __m128i g2 = _mm_set_epi32( gi2[3], gi2[2], gi2[1], gi2[0] );
+
+    __m128 n0 = corner_4( falloff_4( x0, y0 ), g0, x0, y0 );
+    __m128 n1 = corner_4( falloff_4( x1, y1 ), g1, x1, y1 );
+    __m128 n2 = corner_4( falloff_4( x2, y2 ), g2, x2, y2 );
+
+    _mm_storeu_ps( out, mul_double_4( _mm_add_ps( _mm_add_ps( n0, n1 ), n2 ), 70.0 ) );
+}
+#endif
+
+
+// Batched 2D raw Simplex noise.
+//
+// Same result as calling raw_noise_2d for every (x[n], y[n]) pair, four
+// points at a time when SSE2 is available.
+void raw_noise_2d_batch( const float* x, const float* y, float* out, const int count ) {
+    int n = 0;
+
+#if PERLIN_SSE2
+    for( ; n + 4 <= count; n += 4 ) {
+        raw_noise_2d_4( x + n, y + n, out + n );
+    }
+#endif
+
+    for( ; n < count; n++ ) {
+        out[n] = raw_noise_2d( x[n], y[n] );
+    }
+}
+
+
 int fastfloor( const float x ) { return x > 0 ? (int) x : (int) x - 1; }
 
 float dot( const int* g, const float x, const float y ) { return g[0]*x + g[1]*y; }
@@ -114,6 +114,21 @@ float scaled_raw_noise_4d( const float loBound,
                         const float w);
 
 
+// Batched Simplex noise
+// Fills out[0..count) with exactly the values the scalar functions return for
+// each (x[n], y[n]) pair. Evaluates four points at a time with SSE2.
+void raw_noise_2d_batch(const float* x, const float* y, float* out, const int count);
+void scaled_octave_noise_2d_batch(  const float octaves,
+                            const float persistence,
+                            const float scale,
+                            const float loBound,
+                            const float hiBound,
+                            const float* x,
+                            const float* y,
+                            float* out,
+                            const int count);
+
+
 // Raw Simplex noise - a single noise value.
 float raw_noise_2d(const float x, const float y);
 float raw_noise_3d(const float x, const float y, const float z);
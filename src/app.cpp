@@ -79,8 +79,8 @@ inline mat4 get_model_view(Entity *entity, Camera *camera) {
 }
 
 
+#include "gl_state.cpp"
 #include "assets.cpp"
-#include "raytrace.cpp"
 #include "plane.cpp"
 #include "camera.cpp"
 
@@ -88,12 +88,18 @@ inline mat4 get_model_view(Entity *entity, Camera *camera) {
 #include "shader.cpp"
 #include "model.cpp"
 #include "chunk.cpp"
+#include "upload.cpp"
+#include "occlusion.cpp"
+#include "raytrace.cpp"
 #include "primitives.cpp"
+#include "bvh.cpp"
+#include "particles.cpp"
+#include "grass.cpp"
 
 template<typename T>
-void mount_entity_to_terrain(T *entity) {
+void mount_entity_to_terrain(App *app, T *entity) {
   vec3 position = get_world_position(entity->header.position);
-  entity->header.position.offset_.y = get_terrain_height_at(position.x, position.z);
+  entity->header.position.offset_.y = get_terrain_height(app, position.x, position.z);
 }
 
 Model *get_model_by_name(App *app, char *name) {
@@ -102,11 +108,20 @@ Model *get_model_by_name(App *app, char *name) {
 
 #include "level.cpp"
 
+// NOTE: the remembered index is only a hint, it's checked and refreshed by
+// a scan when the entity moved in the array
 inline Entity *get_entity_by_id(App *app, Pid id) {
   PROFILE_BLOCK("Finding entity");
-  for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
-    if (it->header.id == id) {
-      return it;
+
+  auto found = app->entity_indices.find(id);
+  if (found != app->entity_indices.end() && found->second < app->entities.size && app->entities[found->second].header.id == id) {
+    return &app->entities[found->second];
+  }
+
+  for (u32 i=0; i<app->entities.size; i++) {
+    if (app->entities[i].header.id == id) {
+      app->entity_indices[id] = i;
+      return &app->entities[i];
     }
   }
 
@@ -120,7 +135,7 @@ Pid next_entity_id(App *app) {
 void generate_random_grass_positions(vec2 start, vec4 *positions, u32 position_count, float min_radius, float radius, float min_grass_scale, float max_grass_scale, u32 *count) {
   *count = 0;
 
-  positions[0] = vec4(start.x, get_terrain_height_at(start.x, start.y), start.y, get_random_float_between(min_grass_scale, max_grass_scale));
+  positions[0] = vec4(start.x, 0.0f, start.y, get_random_float_between(min_grass_scale, max_grass_scale));
   *count += 1;
 
   bool full = false;
@@ -158,11 +173,28 @@ void generate_random_grass_positions(vec2 start, vec4 *positions, u32 position_c
           full = true;
           break;
         }
-        positions[(*count)] = vec4(new_position.x, get_terrain_height_at(new_position.x, new_position.y), new_position.y, get_random_float_between(min_grass_scale, max_grass_scale));
+        positions[(*count)] = vec4(new_position.x, 0.0f, new_position.y, get_random_float_between(min_grass_scale, max_grass_scale));
         *count += 1;
       }
     }
   }
+
+  float *x = (float *)malloc(sizeof(float) * (*count) * 3);
+  float *z = x + (*count);
+  float *heights = z + (*count);
+
+  for (u32 i=0; i<(*count); i++) {
+    x[i] = positions[i].x;
+    z[i] = positions[i].z;
+  }
+
+  get_terrain_heights(x, z, heights, *count);
+
+  for (u32 i=0; i<(*count); i++) {
+    positions[i].y = heights[i];
+  }
+
+  free(x);
 }
 
 void quit(Memory *) {
@@ -175,6 +207,7 @@ void setup_all_shaders(App *app) {
   create_shader(&app->record_depth_program, "assets/shaders/record_depth.vert", "assets/shaders/record_depth.frag");
   create_shader(&app->phong_program, "assets/shaders/phong.vert", "assets/shaders/phong.frag");
   create_shader(&app->terrain_program, "assets/shaders/terrain.vert", "assets/shaders/terrain.frag");
+  create_shader(&app->terrain_depth_program, "assets/shaders/terrain_depth.vert", "assets/shaders/terrain_depth.frag");
   create_shader(&app->textured_program, "assets/shaders/textured.vert", "assets/shaders/textured.frag");
   create_shader(&app->grass_program, "assets/shaders/grass.vert", "assets/shaders/grass.frag");
   create_shader(&app->controls_program, "assets/shaders/controls.vert", "assets/shaders/controls.frag");
@@ -182,6 +215,10 @@ void setup_all_shaders(App *app) {
   create_shader(&app->debug_program, "assets/shaders/debug.vert", "assets/shaders/debug.frag");
   create_shader(&app->particle_program, "assets/shaders/particle.vert", "assets/shaders/particle.frag");
 
+  if (app->gpu_particles.supported) {
+    create_shader(&app->particle_update_program, "assets/shaders/particle_update.vert", "assets/shaders/particle_update.frag", gpu_particle_varyings, array_count(gpu_particle_varyings));
+  }
+
   create_shader(&app->skybox_program, "assets/shaders/skybox.vert", "assets/shaders/skybox.frag");
 
   create_shader(&app->ui_program, "assets/shaders/ui.vert", "assets/shaders/ui.frag");
@@ -226,6 +263,9 @@ void init(Memory *memory) {
 
   platform = memory->platform;
 
+  gl_state = &app->gl_state;
+  reset_gl_state(gl_state);
+
   app->last_id = 0;
 
   app->camera.ortho = false;
@@ -233,19 +273,26 @@ void init(Memory *memory) {
   app->camera.far = 1000.0f;
   app->camera.size = vec2((float)memory->width, (float)memory->height);
 
-  app->shadow_camera.ortho = true;
-  app->shadow_camera.near = 0.1f;
-  app->shadow_camera.far = 1000.0f;
-  app->shadow_camera.size = vec2(40.0f, 40.0f);
   app->shadow_camera.orientation = quat(0.82f, 0.55f, 0.0f, 0.0f);
 
+  app->shadow_distance = 200.0f;
+  app->shadow_frame = 0;
+
+  // NOTE: the far cascades change the least as the camera moves
+  for (u32 i=0; i<SHADOW_CASCADES; i++) {
+    app->shadow_cascades[i].update_interval = i < 2 ? 1 : 1 << (i - 1);
+    app->shadow_cascades[i].update = false;
+  }
+
   glGenVertexArrays(1, &app->vao);
-  glBindVertexArray(app->vao);
+  gl_bind_vertex_array(app->vao);
+
+  glGenBuffers(1, &app->instance_buffer);
 
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
 
-  glCullFace(GL_BACK);
+  gl_cull_face(GL_BACK);
 
   {
     {
@@ -445,18 +492,16 @@ void init(Memory *memory) {
     app->models[model->id_name] = model;
   }
 
-  setup_all_shaders(app);
+  initialize_gpu_particles(&app->gpu_particles, MAX_GPU_PARTICLES);
 
-  app->chunk_cache_count = 4096;
-  app->chunk_cache = (TerrainChunk *)malloc(sizeof(TerrainChunk) * app->chunk_cache_count);
+  setup_all_shaders(app);
 
-  for (u32 i=0; i<app->chunk_cache_count; i++) {
-    TerrainChunk *chunk = app->chunk_cache + i;
-    chunk->models[0].state = AssetState::EMPTY;
-    chunk->models[1].state = AssetState::EMPTY;
-    chunk->models[2].state = AssetState::EMPTY;
-    chunk->initialized = false;
-  }
+  initialize_chunk_cache(&app->chunk_cache, 1024, 256.0f);
+  initialize_terrain_stream(&app->terrain_stream);
+  initialize_upload_queue(&app->uploads, 4.0f, 2.0f);
+  initialize_occlusion_buffer(&app->occlusion);
+  clear_bvh(&app->entity_tree);
+  initialize_terrain_indices(app);
 
   app->color_correction_texture.path = allocate_string("assets/textures/color_correction.png");
   app->gradient_texture.path = allocate_string("assets/textures/gradient.png");
@@ -514,9 +559,9 @@ void init(Memory *memory) {
     };
 
     glGenBuffers(1, &app->fullscreen_quad);
-    glBindBuffer(GL_ARRAY_BUFFER, app->fullscreen_quad);
+    gl_bind_buffer(GL_ARRAY_BUFFER, app->fullscreen_quad);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    gl_bind_buffer(GL_ARRAY_BUFFER, 0);
   }
 
   // NOTE(sedivy): frame buffer
@@ -529,7 +574,7 @@ void init(Memory *memory) {
     // NOTE(sedivy): texture
     {
       glGenTextures(1, &frame->texture);
-      glBindTexture(GL_TEXTURE_2D, frame->texture);
+      gl_bind_texture(GL_TEXTURE_2D, frame->texture);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame->width, frame->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -541,7 +586,7 @@ void init(Memory *memory) {
     // NOTE(sedivy): depth
     {
       glGenTextures(1, &frame->depth);
-      glBindTexture(GL_TEXTURE_2D, frame->depth);
+      gl_bind_texture(GL_TEXTURE_2D, frame->depth);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, frame->width, frame->height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
 
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -567,7 +612,7 @@ void init(Memory *memory) {
     // NOTE(sedivy): depth
     {
       glGenTextures(1, &app->shadow_depth_texture);
-      glBindTexture(GL_TEXTURE_2D, app->shadow_depth_texture);
+      gl_bind_texture(GL_TEXTURE_2D, app->shadow_depth_texture);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, app->shadow_width, app->shadow_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
@@ -621,7 +666,7 @@ void init(Memory *memory) {
       entity->type = EntityBlock;
       entity->position.x = rock_noise[i].x;
       entity->position.z = rock_noise[i].y;
-      mount_entity_to_terrain(entity);
+      mount_entity_to_terrain(app, entity);
       entity->flags = EntityFlags::PERMANENT_FLAG;
       entity->scale = 100.0f * vec3(0.8f + get_next_float(&random) / 2.0f, 0.8f + get_next_float(&random) / 2.0f, 0.8f + get_next_float(&random) / 2.0f);
       entity->model = &app->rock_model;
@@ -646,18 +691,20 @@ void init(Memory *memory) {
   };
 
   glGenBuffers(1, &app->particle_model);
-  glBindBuffer(GL_ARRAY_BUFFER, app->particle_model);
+  gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_model);
   glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-  app->next_particle = 0;
+  initialize_particle_system(&app->particles, MAX_PARTICLES);
 
   glGenBuffers(1, &app->particle_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, app->particle_buffer);
-  glBufferData(GL_ARRAY_BUFFER, array_count(app->particles) * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+  gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_buffer);
+  glBufferData(GL_ARRAY_BUFFER, app->particles.capacity * sizeof(vec4), NULL, GL_STREAM_DRAW);
 
   glGenBuffers(1, &app->particle_color_buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, app->particle_color_buffer);
-  glBufferData(GL_ARRAY_BUFFER, array_count(app->particles) * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+  gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_color_buffer);
+  glBufferData(GL_ARRAY_BUFFER, app->particles.capacity * sizeof(vec4), NULL, GL_STREAM_DRAW);
+  // NOTE: create_font binds its texture without going through gl_state
+  reset_gl_state(gl_state);
 }
 
 vec4 shade_color(vec4 color, float percent) {
@@ -671,10 +718,6 @@ bool sort_by_distance(const EditorHandleRenderCommand &a, const EditorHandleRend
   return a.distance_from_camera > b.distance_from_camera;
 }
 
-bool sort_particles_by_distance(const Particle &a, const Particle &b) {
-  return a.distance_from_camera > b.distance_from_camera;
-}
-
 void push_debug_circle(Array<EditorHandleRenderCommand> *commands, Camera *camera, WorldPosition &position, float size, vec4 color) {
   vec3 world_position = get_world_position(position);
 
@@ -693,6 +736,42 @@ void push_debug_circle(Array<EditorHandleRenderCommand> *commands, Camera *camer
   array::push_back(*commands, command);
 }
 
+// Refits the leaves of all entities. The tree is rebuilt when entities were
+// added or removed since the last refit, indices may have shifted.
+void update_entity_tree(App *app) {
+  PROFILE_BLOCK("Update Entity Tree");
+
+  if (app->entity_tree_count != app->entities.size) {
+    clear_bvh(&app->entity_tree);
+    app->entity_tree_count = app->entities.size;
+  }
+
+  for (u32 i=0; i<app->entities.size; i++) {
+    Entity *it = &app->entities[i];
+
+    vec3 center = get_world_position(it->header.position);
+    float radius = app->editor.handle_size;
+
+    if (it->header.model && it->header.model->state == AssetState::INITIALIZED) {
+      radius = it->header.model->radius * glm::compMax(it->header.scale);
+    }
+
+    Box box;
+    box.min = center - vec3(radius);
+    box.max = center + vec3(radius);
+
+    set_bvh_item(&app->entity_tree, i, box);
+  }
+}
+
+// Called before querying the tree outside of rendering, only catches up
+// with added or removed entities. Moved entities are refit once a frame.
+inline void sync_entity_tree(App *app) {
+  if (app->entity_tree_count != app->entities.size) {
+    update_entity_tree(app);
+  }
+}
+
 void draw_3d_debug_info(Input &input, App *app) {
   Texture *texture = get_texture(app, (char *)"circle.png");
   if (!texture && texture->state == AssetState::INITIALIZED) { return; }
@@ -702,18 +781,33 @@ void draw_3d_debug_info(Input &input, App *app) {
 
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glDepthFunc(GL_ALWAYS);
+  gl_depth_func(GL_ALWAYS);
 
-  set_uniform(app->current_program, "uPMatrix", app->camera.view_matrix);
+  set_uniform(app->current_program, Uniform::P_MATRIX, app->camera.view_matrix);
 
-  glActiveTexture(GL_TEXTURE0 + 0);
-  glBindTexture(GL_TEXTURE_2D, texture->id);
-  set_uniformi(app->current_program, "textureImage", 0);
+  gl_active_texture(GL_TEXTURE0 + 0);
+  gl_bind_texture(GL_TEXTURE_2D, texture->id);
+  set_uniformi(app->current_program, Uniform::TEXTURE_IMAGE, 0);
 
-  use_model_mesh(app, &app->quad_model.mesh);
+  use_model_mesh(&app->quad_model.mesh);
 
   if (app->editor.show_handles && !app->editor.holding_entity) {
-    for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
+    Entity *inspected = app->editor.inspect_entity ? get_entity_by_id(app, app->editor.entity_id) : NULL;
+
+    if (inspected && inspected->header.type == EntityType::EntityGrass && !(inspected->header.flags & EntityFlags::HIDE_IN_EDITOR)) {
+      EntityGrass *grass = (EntityGrass *)inspected;
+      for (u32 grass_index=0; grass_index<grass->grass_count; grass_index++) {
+        vec4 data = grass->positions[grass_index];
+        WorldPosition position = make_position(vec3(data));
+        push_debug_circle(&app->debug_circle_commands, &app->camera, position, data.w / 7.0f, vec4(0.4, 1.0, 0.4, 0.4));
+      }
+    }
+
+    sync_entity_tree(app);
+    query_bvh_frustum(&app->entity_tree, &app->camera.frustum, &app->entity_query);
+
+    for (auto index = array::begin(app->entity_query); index != array::end(app->entity_query); index++) {
+      Entity *it = &app->entities[*index];
       if (it->header.flags & EntityFlags::HIDE_IN_EDITOR) { continue; }
 
       if (it->header.model && it->header.model->state == AssetState::INITIALIZED) {
@@ -729,17 +823,6 @@ void draw_3d_debug_info(Input &input, App *app) {
         color *= vec4(0.6, 0.6, 0.6, 1.0);
       }
 
-      if (it->header.type == EntityType::EntityGrass) {
-        EntityGrass *grass = (EntityGrass *)it;
-        if (app->editor.inspect_entity && app->editor.entity_id == grass->header.id) {
-          for (u32 grass_index=0; grass_index<grass->grass_count; grass_index++) {
-            vec4 data = grass->positions[grass_index];
-            WorldPosition position = make_position(vec3(data));
-            push_debug_circle(&app->debug_circle_commands, &app->camera, position, data.w / 7.0f, vec4(0.4, 1.0, 0.4, 0.4));
-          }
-        }
-      }
-
       push_debug_circle(&app->debug_circle_commands, &app->camera, it->header.position, app->editor.handle_size, color);
     }
   }
@@ -749,15 +832,15 @@ void draw_3d_debug_info(Input &input, App *app) {
   std::sort(array::begin(app->debug_circle_commands), array::end(app->debug_circle_commands), sort_by_distance);
 
   for (auto it = array::begin(app->debug_circle_commands); it != array::end(app->debug_circle_commands); it++) {
-    set_uniform(app->current_program, "uMVMatrix", it->model_view);
-    set_uniform(app->current_program, "in_color", it->color);
+    set_uniform(app->current_program, Uniform::MV_MATRIX, it->model_view);
+    set_uniform(app->current_program, Uniform::IN_COLOR, it->color);
     glDrawElements(GL_TRIANGLES, app->cube_model.mesh.data.indices_count, GL_UNSIGNED_INT, 0);
   }
 
   array::clear(app->debug_circle_commands);
 
   glDisable(GL_BLEND);
-  glDepthFunc(GL_LESS);
+  gl_depth_func(GL_LESS);
 }
 
 void flush_2d_render(App *app, Memory *memory) {
@@ -768,29 +851,29 @@ void flush_2d_render(App *app, Memory *memory) {
   glDisable(GL_DEPTH_TEST);
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glActiveTexture(GL_TEXTURE0);
+  gl_active_texture(GL_TEXTURE0);
 
   use_program(app, &app->ui_program);
 
-  set_uniform(app->current_program, "uPMatrix", projection);
-  set_uniformi(app->current_program, "textureImage", 0);
+  set_uniform(app->current_program, Uniform::P_MATRIX, projection);
+  set_uniformi(app->current_program, Uniform::TEXTURE_IMAGE, 0);
 
   u32 vertices_index = 0;
 
   UICommandBuffer *command_buffer = &app->editor.command_buffer;
 
-  glBindBuffer(GL_ARRAY_BUFFER, app->debug_buffer);
+  gl_bind_buffer(GL_ARRAY_BUFFER, app->debug_buffer);
   glBufferData(GL_ARRAY_BUFFER, command_buffer->vertices.size * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
   glBufferSubData(GL_ARRAY_BUFFER, 0, command_buffer->vertices.size * sizeof(GLfloat), &command_buffer->vertices[0]);
 
-  glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-  glVertexAttribPointer(shader_get_attribute_location(app->current_program, "uv"), 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *)(2 * sizeof(GLfloat)));
+  gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+  gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::UV), 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *)(2 * sizeof(GLfloat)));
 
   for (auto it = array::begin(command_buffer->commands); it != array::end(command_buffer->commands); it++) {
     if (it->has_texture) {
-      glBindTexture(GL_TEXTURE_2D, it->texture_id);
+      gl_bind_texture(GL_TEXTURE_2D, it->texture_id);
     } else {
-      glBindTexture(GL_TEXTURE_2D, 0);
+      gl_bind_texture(GL_TEXTURE_2D, 0);
     }
     set_uniform(app->current_program, "background_color", it->color);
     set_uniform(app->current_program, "image_color", it->image_color);
@@ -863,6 +946,59 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
           draw_state.width = original_width;
         }
       }
+
+      ChunkCacheStats *stats = &app->chunk_cache.stats;
+      float original_width = draw_state.width;
+
+      sprintf(text, "chunks: %u/%u hits: %u misses: %u evictions: %u\n", stats->resident, app->chunk_cache.count, stats->hits, stats->misses, stats->evictions);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      sprintf(text, "chunk memory: cpu %.1fMB gpu %.1fMB budget %.0fMB\n", (float)stats->cpu_bytes / Megabytes(1), (float)stats->gpu_bytes / Megabytes(1), app->chunk_cache.memory_budget);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      sprintf(text, "gl calls: %u elided: %u\n", app->gl_state.last_stats.issued, app->gl_state.last_stats.elided);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      sprintf(text, "entity draws: %u instances: %u\n", app->gl_state.last_stats.draws, app->gl_state.last_stats.instances);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      OcclusionStats *occlusion_stats = &app->occlusion.stats;
+
+      sprintf(text, "occlusion: %.3fms chunks: %u meshes: %u triangles: %u\n", occlusion_stats->time, occlusion_stats->chunks, occlusion_stats->meshes, occlusion_stats->triangles);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      sprintf(text, "occluded entities: %u chunks: %u\n", occlusion_stats->culled_entities, occlusion_stats->culled_chunks);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      GrassStats *grass_stats = &app->grass.stats;
+
+      sprintf(text, "grass cells: %u/%u draws: %u instances: %u\n", grass_stats->visible_cells, app->grass.cells.size, grass_stats->draws, grass_stats->instances);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      UploadStats *upload_stats = &app->uploads.stats;
+
+      sprintf(text, "uploads: %u %.2fMB %.3fms queued: %u\n", upload_stats->uploads, (float)upload_stats->bytes / Megabytes(1), upload_stats->time, upload_stats->queued);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      TerrainStreamStats *stream_stats = &app->terrain_stream.stats;
+
+      sprintf(text, "terrain builds: %u requests: %u issued: %u cancelled: %u\n", stream_stats->in_flight, stream_stats->requests, stream_stats->issued, stream_stats->cancelled);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      sprintf(text, "terrain pending visible: %u settled in %.0fms\n", stream_stats->pending_visible, stream_stats->settle_time * 1000.0f);
+      draw_state.width = font_get_string_size_in_px(&app->mono_font, text) + 5.0f;
+      push_debug_text(&app->mono_font, &draw_state, command_buffer, 10.0f, text, vec3(1.0f, 1.0f, 1.0f), vec4(0.0f, 0.1f, 0.6f, 0.9f));
+
+      draw_state.width = original_width;
     }
 
     sprintf(text, "fps: %d\n", (u32)app->fps);
@@ -965,8 +1101,7 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
             entity.header.orientation = quat();
             entity.header.model = NULL;
             entity.header.flags = EntityFlags::RENDER_HIDDEN | EntityFlags::PERMANENT_FLAG;
-            ((EntityParticleEmitter *)&entity)->particle_size = 0.4f;
-            ((EntityParticleEmitter *)&entity)->initial_color = vec4(1.0f);
+            set_default_particle_emitter((EntityParticleEmitter *)&entity);
 
             app->editor.entity_id = entity.header.id;
             app->editor.inspect_entity = true;
@@ -987,7 +1122,7 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
             entity->header.flags = EntityFlags::MOUNT_TO_TERRAIN | EntityFlags::RENDER_HIDDEN | EntityFlags::PERMANENT_FLAG;
 
             if (entity->header.flags & EntityFlags::MOUNT_TO_TERRAIN) {
-              mount_entity_to_terrain(&new_entity);
+              mount_entity_to_terrain(app, &new_entity);
             }
 
             entity->grass_count = 0;
@@ -1002,7 +1137,6 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
             entity->rotations = (vec3 *)(entity->positions + MAX_GRASS_GROUP_COUNT);
             entity->tints = (vec3 *)(entity->rotations + MAX_GRASS_GROUP_COUNT);
 
-            entity->initialized = false;
             entity->reload_data = true;
             entity->render = false;
             entity->grass_model = get_model_by_name(app, (char *)"plant");
@@ -1057,13 +1191,16 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
           if (push_debug_button(input, app, &draw_state, command_buffer, 10.0f, 25.0f, (char *)"rebuild chunks", vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
             rebuild_chunks(app);
           }
+
+          push_debug_range((char *)"chunk budget MB", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->chunk_cache.memory_budget, 16.0f, 2048.0f);
+          push_debug_range((char *)"upload budget MB", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->uploads.budget_megabytes, 0.25f, 64.0f);
+          push_debug_range((char *)"upload budget ms", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->uploads.budget_milliseconds, 0.1f, 16.0f);
           break;
       }
       {
         case EditorLeftState::LIGHT:
           push_debug_editable_quat(input, &draw_state, &app->font, command_buffer, 10.0f, "Sun orientation", &app->shadow_camera.orientation, default_background_color);
-          push_debug_range((char *)"near", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->shadow_camera.near, 0.0f, 100.0f);
-          push_debug_range((char *)"far", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->shadow_camera.far, 0.0f, 100000.0f);
+          push_debug_range((char *)"shadow distance", input, &app->font, command_buffer, &draw_state, 10.0f, default_background_color, &app->shadow_distance, 10.0f, 1000.0f);
           break;
       }
       {
@@ -1094,6 +1231,27 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
           if (push_debug_button(input, app, &draw_state, command_buffer, 10.0f, 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
             app->editor.show_camera_frustum = !app->editor.show_camera_frustum;
           }
+
+          sprintf(text, "Occlusion culling: %d\n", app->occlusion.enabled);
+          if (push_debug_button(input, app, &draw_state, command_buffer, 10.0f, 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
+            app->occlusion.enabled = !app->occlusion.enabled;
+          }
+
+          sprintf(text, "Show occlusion buffer: %d\n", app->editor.show_occlusion_buffer);
+          if (push_debug_button(input, app, &draw_state, command_buffer, 10.0f, 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
+            app->editor.show_occlusion_buffer = !app->editor.show_occlusion_buffer;
+          }
+
+          if (app->gpu_particles.supported) {
+            sprintf(text, "GPU particles: %d\n", app->gpu_particles.enabled);
+            if (push_debug_button(input, app, &draw_state, command_buffer, 10.0f, 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
+              app->gpu_particles.enabled = !app->gpu_particles.enabled;
+
+              // NOTE: the other system's particles are dropped on a switch
+              clear_particles(&app->particles);
+              reset_gpu_particles(&app->gpu_particles);
+            }
+          }
           break;
       }
       {
@@ -1127,6 +1285,11 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
     }
   }
 
+  if (app->editor.show_occlusion_buffer) {
+    float scale = 2.0f;
+    debug_render_rect(command_buffer, 10.0f, memory->height - (OCCLUSION_HEIGHT * scale + 10.0f), OCCLUSION_WIDTH * scale, OCCLUSION_HEIGHT * scale, vec4(0.0f, 0.0f, 0.0f, 1.0f), vec4(1.0f), &app->occlusion_texture);
+  }
+
   if (app->editor.inspect_entity) {
     draw_state.offset_top = 25.0f;
     draw_state.width = 275.0f;
@@ -1187,7 +1350,7 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
               entity->header.flags = entity->header.flags ^ EntityFlags::MOUNT_TO_TERRAIN;
 
               if (entity->header.flags & EntityFlags::MOUNT_TO_TERRAIN) {
-                mount_entity_to_terrain(entity);
+                mount_entity_to_terrain(app, entity);
               }
             }
 
@@ -1201,6 +1364,11 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
               entity->header.flags = entity->header.flags ^ EntityFlags::LOOK_AT_CAMERA;
             }
 
+            sprintf(text, "occluder: %d\n", (entity->header.flags & EntityFlags::OCCLUDER) != 0);
+            if (push_debug_button(input, app, &draw_state, command_buffer, memory->width - (draw_state.width + 25.0f), 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
+              entity->header.flags = entity->header.flags ^ EntityFlags::OCCLUDER;
+            }
+
             sprintf(text, "save to file: %d\n", (entity->header.flags & EntityFlags::PERMANENT_FLAG) != 0);
             if (push_debug_button(input, app, &draw_state, command_buffer, memory->width - (draw_state.width + 25.0f), 25.0f, text, vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
               entity->header.flags = entity->header.flags ^ EntityFlags::PERMANENT_FLAG;
@@ -1224,6 +1392,13 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
               push_debug_range(NULL, input, &app->font, command_buffer, &draw_state, x, default_background_color, &emitter->particle_size, 0.0f, 100.0f);
               push_debug_text(&app->font, &draw_state, command_buffer, memory->width - (draw_state.width + 25.0f), (char *)"gravity", vec3(1.0f, 1.0f, 1.0f), default_background_color);
               push_debug_range(NULL, input, &app->font, command_buffer, &draw_state, x, default_background_color, &emitter->gravity, -1000.0f, 1000.0f);
+
+              push_debug_range((char *)"spawn rate", input, &app->font, command_buffer, &draw_state, x, default_background_color, &emitter->spawn_rate, 0.0f, 1000.0f);
+              push_debug_range((char *)"lifetime", input, &app->font, command_buffer, &draw_state, x, default_background_color, &emitter->lifetime, 0.1f, 30.0f);
+
+              float max_particles = (float)emitter->max_particles;
+              push_debug_range((char *)"max particles", input, &app->font, command_buffer, &draw_state, x, default_background_color, &max_particles, 4.0f, 4096.0f);
+              emitter->max_particles = (u32)max_particles;
             } else if (entity->header.type == EntityType::EntityGrass) {
               EntityGrass *grass = (EntityGrass *)entity;
 
@@ -1235,7 +1410,7 @@ void draw_2d_debug_info(App *app, Memory *memory, Input &input) {
               push_debug_range((char *)"max_scale", input, &app->font, command_buffer, &draw_state, memory->width - (draw_state.width + 25.0f), default_background_color, &grass->max_scale, 0.05f, 2.0f);
 
               if (push_debug_button(input, app, &draw_state, command_buffer, memory->width - (draw_state.width + 25.0f), 35.0f, (char *)"Rebuild grass", vec3(1.0f, 1.0f, 1.0f), button_background_color)) {
-                platform.add_work(memory->low_queue, generate_grass_work, grass);
+                platform.add_work(memory->jobs, JobPriority::LOW, generate_grass_work, grass, NULL);
               }
             }
 
@@ -1259,11 +1434,11 @@ void render_skybox(App *app) {
 
   set_uniform(app->current_program, "projection", projection);
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemap.id);
-  set_uniformi(app->current_program, "uSampler", 0);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, app->cubemap.id);
+  set_uniformi(app->current_program, Uniform::SAMPLER, 0);
 
-  use_model_mesh(app, &app->cube_model.mesh);
+  use_model_mesh(&app->cube_model.mesh);
   glDrawElements(GL_TRIANGLES, app->cube_model.mesh.data.indices_count, GL_UNSIGNED_INT, 0);
 
   glDepthMask(GL_TRUE);
@@ -1271,148 +1446,249 @@ void render_skybox(App *app) {
   glEnable(GL_CULL_FACE);
 }
 
-void render_scene(Memory *memory, App *app, Camera *camera, Shader *forced_shader=NULL, bool shadow_pass=false) {
-  PROFILE_BLOCK("Draw Scene");
-  start_render_group(&app->render_group);
-  app->render_group.camera = camera;
-  app->render_group.force_shader = forced_shader;
-  app->render_group.shadow_pass = shadow_pass;
+inline u32 get_scene_job_count(Memory *memory, u32 count) {
+  u32 max_jobs = glm::min(platform.get_worker_count(memory->jobs) + 1, (u32)MAX_SCENE_JOBS);
+  return glm::clamp(count / SCENE_JOB_MIN_ENTITIES, 1u, max_jobs);
+}
 
-  RenderGroup second_render_group;
-  start_render_group(&second_render_group);
-  second_render_group.camera = camera;
-  second_render_group.force_shader = NULL;
-  second_render_group.shadow_pass = false;
+// Runs on the job system, only reads the entities and doesn't touch GL.
+void update_visibility_work(void *data) {
+  VisibilityJob *job = (VisibilityJob *)data;
+  App *app = job->app;
 
-  for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
-    if (it->header.type == EntityType::EntityGrass && !shadow_pass) {
-      if ((shadow_pass && (it->header.flags & EntityFlags::CASTS_SHADOW)) || !shadow_pass) {
-        EntityGrass *grass = (EntityGrass *)it;
-        if (grass->render) {
-          bool texture_wait = process_texture(memory, grass->texture);
-          bool wait_model = process_model(memory, grass->grass_model);
+  PROFILE_BLOCK("Update Visibility", job->count);
 
-          if (!texture_wait && !wait_model) {
-            PROFILE_BLOCK("Render Grass");
+  for (u32 i=job->first; i<job->first + job->count; i++) {
+    Entity *it = &app->entities[i];
+    EntityVisibility *visibility = &app->visibility[i];
 
-            glDisable(GL_CULL_FACE);
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            glDepthFunc(GL_LESS);
+    Model *model = it->header.model;
+    Texture *texture = it->header.texture;
+    u32 flags = it->header.flags;
 
-            use_program(app, &app->grass_program);
+    bool renderable = model != NULL && !(flags & EntityFlags::RENDER_HIDDEN);
+    bool ready = renderable && model->state == AssetState::INITIALIZED && (!texture || texture->state == AssetState::INITIALIZED);
 
-            set_uniform(app->current_program, "uPMatrix", camera->view_matrix);
-            set_uniformi(app->current_program, "uShadow", 0);
-            set_uniform(app->current_program, "texmapscale", vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
-            set_uniform(app->current_program, "shadow_light_position", get_world_position(app->shadow_camera.position));
+    if (renderable && !ready) {
+      array::push_back(job->pending, i);
+    }
+
+    if (visibility->model != model || visibility->texture != texture || visibility->flags != flags || visibility->ready != ready) {
+      visibility->model = model;
+      visibility->texture = texture;
+      visibility->flags = flags;
+      visibility->ready = ready;
+      visibility->valid = false;
+    }
 
-            glActiveTexture(GL_TEXTURE0 + 1);
-            glBindTexture(GL_TEXTURE_2D, grass->texture->id);
-            set_uniformi(app->current_program, "textureImage", 1);
-            set_uniform(app->current_program, "shadow_matrix", app->shadow_camera.view_matrix);
-            set_uniformf(app->current_program, "time", app->time);
+    if (!ready) { continue; }
 
-            Mesh *mesh = &grass->grass_model->mesh;
+    // NOTE: billboards face the camera so they change every frame
+    bool moved = !visibility->valid ||
+                 (flags & EntityFlags::LOOK_AT_CAMERA) ||
+                 memcmp(&visibility->position, &it->header.position, sizeof(WorldPosition)) != 0 ||
+                 visibility->orientation != it->header.orientation ||
+                 visibility->scale != it->header.scale;
 
-            use_model_mesh(app, mesh);
+    if (moved) {
+      visibility->position = it->header.position;
+      visibility->orientation = it->header.orientation;
+      visibility->scale = it->header.scale;
 
-            if (!grass->initialized) {
-              grass->initialized = true;
+      visibility->model_view = get_model_view(it, &app->camera);
+      visibility->normal = glm::inverseTranspose(mat3(visibility->model_view));
 
-              glGenBuffers(1, &grass->position_data_id);
-            }
+      visibility->center = get_world_position(it->header.position);
+      visibility->radius = model->radius * glm::compMax(it->header.scale);
 
-            if (grass->reload_data) {
-              grass->reload_data = false;
+      visibility->valid = true;
+    }
+  }
+}
 
-              glBindBuffer(GL_ARRAY_BUFFER, grass->position_data_id);
-              glBufferData(GL_ARRAY_BUFFER, grass->grass_count * (sizeof(vec4) + sizeof(vec3) + sizeof(vec4)), NULL, GL_STATIC_DRAW);
+// Entities are bounded by the sphere ray_match_entity tests, or by the
+// editor handle when the model isn't loaded. Only entities that left the
+// inflated box of their leaf are reinserted.
+// Runs once a frame before any pass is rendered.
+void update_scene_visibility(Memory *memory, App *app) {
+  PROFILE_BLOCK("Scene Visibility");
 
-              glBufferSubData(GL_ARRAY_BUFFER, 0, grass->grass_count * sizeof(vec4), grass->positions);
-              glBufferSubData(GL_ARRAY_BUFFER, grass->grass_count * sizeof(vec4), grass->grass_count * sizeof(vec3), grass->rotations);
-              glBufferSubData(GL_ARRAY_BUFFER, grass->grass_count * (sizeof(vec4) + sizeof(vec3)), grass->grass_count * sizeof(vec4), grass->tints);
+  u32 entity_count = app->entities.size;
 
-              glBindBuffer(GL_ARRAY_BUFFER, 0);
-            }
+  // NOTE: indices shift when entities are added or removed
+  if (app->visibility.size != entity_count) {
+    array::resize(app->visibility, entity_count);
+    for (u32 i=0; i<entity_count; i++) {
+      app->visibility[i] = {};
+    }
+  }
 
-            GLuint position_id = shader_get_attribute_location(app->current_program, "position_data");
-            GLuint rotation_id = shader_get_attribute_location(app->current_program, "rotation");
-            GLuint tint_id = shader_get_attribute_location(app->current_program, "tint");
+  u32 job_count = get_scene_job_count(memory, entity_count);
+  u32 job_size = (entity_count + job_count - 1) / job_count;
 
-            glBindBuffer(GL_ARRAY_BUFFER, grass->position_data_id);
+  JobCounter counter = {};
 
-            glVertexAttribPointer(position_id, 4, GL_FLOAT, GL_FALSE, 0, 0);
-            glVertexAttribPointer(rotation_id, 3, GL_FLOAT, GL_FALSE, 0, (void *)(grass->grass_count * sizeof(vec4)));
-            glVertexAttribPointer(tint_id, 3, GL_FLOAT, GL_FALSE, 0, (void *)(grass->grass_count * (sizeof(vec4) + sizeof(vec3))));
+  for (u32 i=0; i<job_count; i++) {
+    VisibilityJob *job = app->visibility_jobs + i;
+    job->app = app;
+    job->first = glm::min(i * job_size, entity_count);
+    job->count = glm::min(job_size, entity_count - job->first);
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_id);
+    array::clear(job->pending);
 
-            glVertexAttribDivisor(0, 0);
-            glVertexAttribDivisor(1, 0);
-            glVertexAttribDivisor(2, 0);
-            glVertexAttribDivisor(3, 1);
-            glVertexAttribDivisor(4, 1);
-            glVertexAttribDivisor(5, 1);
+    if (i > 0) {
+      platform.add_work(memory->jobs, JobPriority::FRAME, update_visibility_work, job, &counter);
+    }
+  }
 
-            glDrawElementsInstanced(GL_TRIANGLES, mesh->data.indices_count, GL_UNSIGNED_INT, 0, grass->grass_count);
+  update_visibility_work(app->visibility_jobs);
+  platform.wait_for_counter(memory->jobs, &counter);
 
-            glVertexAttribDivisor(0, 0);
-            glVertexAttribDivisor(1, 0);
-            glVertexAttribDivisor(2, 0);
-            glVertexAttribDivisor(3, 0);
-            glVertexAttribDivisor(4, 0);
-            glVertexAttribDivisor(5, 0);
-          }
-        }
+  for (u32 i=0; i<job_count; i++) {
+    VisibilityJob *job = app->visibility_jobs + i;
+
+    for (auto it = array::begin(job->pending); it != array::end(job->pending); it++) {
+      Entity *entity = &app->entities[*it];
+
+      process_model(memory, entity->header.model);
+
+      if (entity->header.texture) {
+        process_texture(memory, entity->header.texture);
       }
     }
+  }
 
-    if (it->header.model == NULL || it->header.flags & EntityFlags::RENDER_HIDDEN) { continue; }
+  update_entity_tree(app);
+}
 
-    if (shadow_pass && !(it->header.flags & EntityFlags::CASTS_SHADOW)) {
-      continue;
-    }
+// Ready entities in the frustum with all of flags set, see render_scene.
+void collect_scene_entities(App *app, Frustum *frustum, u32 flags, Array<u32> *result) {
+  query_bvh_frustum(&app->entity_tree, frustum, result);
 
-    bool model_wait = process_model(memory, it->header.model);
-    bool texture_wait = false;
+  u32 count = 0;
+  for (u32 i=0; i<result->size; i++) {
+    EntityVisibility *visibility = &app->visibility[(*result)[i]];
 
-    if (it->header.texture) {
-      texture_wait = process_texture(memory, it->header.texture);
+    if (visibility->ready && (visibility->flags & flags) == flags) {
+      (*result)[count++] = (*result)[i];
     }
+  }
+
+  array::resize(*result, count);
+}
+
+// Runs on the job system, only reads the entities and doesn't touch GL.
+void build_scene_commands(void *data) {
+  SceneJob *job = (SceneJob *)data;
+  App *app = job->app;
+  Camera *camera = job->group->camera;
 
-    if (model_wait || texture_wait) { continue; }
+  PROFILE_BLOCK("Build Scene Commands", job->count);
 
-    if (!is_sphere_in_frustum(&camera->frustum, get_world_position(it->header.position), it->header.model->radius * glm::compMax(it->header.scale))) {
+  for (u32 i=job->first; i<job->first + job->count; i++) {
+    u32 index = (*job->entities)[i];
+
+    Entity *it = &app->entities[index];
+    EntityVisibility *visibility = &app->visibility[index];
+
+    if (!is_sphere_in_frustum(&camera->frustum, visibility->center, visibility->radius)) {
       continue;
     }
 
-    mat4 model_view = get_model_view(it, &app->camera);
-
-    mat3 normal = glm::inverseTranspose(mat3(model_view));
+    if (job->occlusion && is_sphere_occluded(job->occlusion, visibility->center, visibility->radius)) {
+      job->occluded += 1;
+      continue;
+    }
 
     RenderCommand command;
     command.shader = &app->main_object_program;
-    command.model_view = model_view;
+    command.model_view = visibility->model_view;
     command.flags = it->header.flags;
-    command.normal = normal;
+    command.normal = visibility->normal;
     command.color = it->header.color;
     command.cull_type = GL_BACK;
     command.model_mesh = &it->header.model->mesh;
+    command.distance_from_camera = glm::sqrt(position_distance2(camera->position, it->header.position));
 
     if (app->editing_mode && app->editor.inspect_entity && app->editor.entity_id == it->header.id)  {
       RenderCommand wireframe_command = command;
       wireframe_command.shader = &app->solid_program;
       wireframe_command.color = vec4(1.0, 0.0, 1.0, 1.0);
       wireframe_command.flags |= EntityFlags::RENDER_WIREFRAME;
-      add_command_to_render_group(&second_render_group, wireframe_command);
+      wireframe_command.sort_key = make_sort_key(job->second_group, &wireframe_command);
+      array::push_back(job->second_commands, wireframe_command);
     }
 
     if (it->header.type == EntityType::EntityWater) {
       command.shader = &app->water_program;
     }
 
-    add_command_to_render_group(&app->render_group, command);
+    command.sort_key = make_sort_key(job->group, &command);
+    array::push_back(job->commands, command);
+  }
+}
+
+// Draws the listed entities, see update_scene_visibility.
+void render_scene(Memory *memory, App *app, Camera *camera, Array<u32> *entities, Shader *forced_shader=NULL, bool shadow_pass=false) {
+  PROFILE_BLOCK("Draw Scene");
+  start_render_group(&app->render_group);
+  app->render_group.camera = camera;
+  app->render_group.force_shader = forced_shader;
+  app->render_group.shadow_pass = shadow_pass;
+
+  RenderGroup second_render_group;
+  start_render_group(&second_render_group);
+  second_render_group.camera = camera;
+  second_render_group.force_shader = NULL;
+  second_render_group.shadow_pass = false;
+
+  u32 entity_count = entities->size;
+  u32 job_count = get_scene_job_count(memory, entity_count);
+  u32 job_size = (entity_count + job_count - 1) / job_count;
+
+  JobCounter counter = {};
+
+  for (u32 i=0; i<job_count; i++) {
+    SceneJob *job = app->scene_jobs + i;
+    job->app = app;
+    job->group = &app->render_group;
+    job->second_group = &second_render_group;
+    job->entities = entities;
+    job->first = glm::min(i * job_size, entity_count);
+    job->count = glm::min(job_size, entity_count - job->first);
+
+    // NOTE: the occlusion buffer is only valid for the main camera
+    job->occlusion = camera == &app->camera ? &app->occlusion : NULL;
+    job->occluded = 0;
+
+    array::clear(job->commands);
+    array::clear(job->second_commands);
+
+    // NOTE: the first range is built on this thread after the grass
+    if (i > 0) {
+      platform.add_work(memory->jobs, JobPriority::FRAME, build_scene_commands, job, &counter);
+    }
+  }
+
+  if (!shadow_pass) {
+    render_grass(memory, app, &app->grass, camera);
+  }
+
+  build_scene_commands(app->scene_jobs);
+  platform.wait_for_counter(memory->jobs, &counter);
+
+  for (u32 i=0; i<job_count; i++) {
+    SceneJob *job = app->scene_jobs + i;
+
+    for (auto it = array::begin(job->commands); it != array::end(job->commands); it++) {
+      array::push_back(app->render_group.commands, *it);
+    }
+
+    for (auto it = array::begin(job->second_commands); it != array::end(job->second_commands); it++) {
+      array::push_back(second_render_group.commands, *it);
+    }
+
+    app->occlusion.stats.culled_entities += job->occluded;
   }
 
   end_render_group(app, &app->render_group);
@@ -1423,26 +1699,42 @@ void render_terrain(Memory *memory, App *app) {
   PROFILE_BLOCK("Draw Terrain");
   use_program(app, &app->terrain_program);
 
-  glCullFace(GL_BACK);
+  gl_cull_face(GL_BACK);
 
-  set_uniform(app->current_program, "uPMatrix", app->camera.view_matrix);
+  set_uniform(app->current_program, Uniform::P_MATRIX, app->camera.view_matrix);
 
-  glActiveTexture(GL_TEXTURE0 + 0);
-  glBindTexture(GL_TEXTURE_2D, app->shadow_depth_texture);
-  set_uniformi(app->current_program, "uShadow", 0);
-  set_uniform(app->current_program, "shadow_matrix", app->shadow_camera.view_matrix);
-  set_uniform(app->current_program, "texmapscale", vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
+  gl_active_texture(GL_TEXTURE0 + 0);
+  gl_bind_texture(GL_TEXTURE_2D, app->shadow_depth_texture);
+  set_uniformi(app->current_program, Uniform::SHADOW, 0);
+  set_uniform_array(app->current_program, Uniform::SHADOW_MATRICES, app->shadow_matrices, SHADOW_CASCADES);
+  set_uniform(app->current_program, Uniform::TEXMAPSCALE, vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
 
   int x_coord = app->camera.position.chunk_x;
   int y_coord = app->camera.position.chunk_y;
 
+  const int radius = 4;
+  const int window = radius * 2 + 1;
+
+  TerrainChunk *chunks[window][window] = {};
+  Model *models[window][window] = {};
+  int levels[window][window];
+
+  TerrainStream *stream = &app->terrain_stream;
+  begin_terrain_stream(stream, app->camera.position, get_forward(app->camera.orientation));
+
+  u32 pending_visible = 0;
+
   {
-    PROFILE_BLOCK("Terrain render", 9*9);
-    for (int y=-4 + y_coord; y<=4 + y_coord; y++) {
-      for (int x=-4 + x_coord; x<=4 + x_coord; x++) {
-        if (x < 0 || y < 0 ) { continue; }
+    PROFILE_BLOCK("Terrain select", window*window);
+    for (int y=0; y<window; y++) {
+      for (int x=0; x<window; x++) {
+        int chunk_x = x - radius + x_coord;
+        int chunk_y = y - radius + y_coord;
+
+        if (chunk_x < 0 || chunk_y < 0 ) { continue; }
 
-        TerrainChunk *chunk = get_chunk_at(app->chunk_cache, app->chunk_cache_count, x, y);
+        TerrainChunk *chunk = get_chunk_at(&app->chunk_cache, chunk_x, chunk_y);
+        if (!chunk) { continue; }
 
         int dx = chunk->x - x_coord;
         int dy = chunk->y - y_coord;
@@ -1453,18 +1745,193 @@ void render_terrain(Memory *memory, App *app) {
         if (distance < 16.0f) { detail_level = 1; }
         if (distance < 4.0f) { detail_level = 0; }
 
-        Model *model = chunk_get_model(memory, chunk, detail_level);
+        Model *model = chunk_get_model(app, chunk, detail_level);
+
+        chunks[y][x] = chunk;
+        models[y][x] = model;
+        levels[y][x] = model ? (int)(model - chunk->models) : 0;
+
+        if (!model || levels[y][x] != detail_level) {
+          vec3 center = vec3((chunk->x + 0.5f) * CHUNK_SIZE_X, 0.0f, (chunk->y + 0.5f) * CHUNK_SIZE_Y);
+          if (is_sphere_in_frustum(&app->camera.frustum, center, (float)CHUNK_SIZE_X)) {
+            pending_visible += 1;
+          }
+        }
+      }
+    }
+  }
+
+  // Prefetch full detail around where the follow entity is headed.
+  Entity *follow_entity = get_entity_by_id(app, app->camera_follow);
+  if (follow_entity) {
+    WorldPosition predicted = add_offset(app->camera.position, follow_entity->header.velocity * TERRAIN_PREFETCH_SECONDS);
+
+    if (predicted.chunk_x != (u32)x_coord || predicted.chunk_y != (u32)y_coord) {
+      for (int y=-1; y<=1; y++) {
+        for (int x=-1; x<=1; x++) {
+          int chunk_x = (int)predicted.chunk_x + x;
+          int chunk_y = (int)predicted.chunk_y + y;
 
-        if (model) {
-          if (!is_sphere_in_frustum(&app->camera.frustum, vec3(chunk->x * CHUNK_SIZE_X, 0.0f, chunk->y * CHUNK_SIZE_Y), model->radius)) {
-            continue;
+          if (chunk_x < 0 || chunk_y < 0 ) { continue; }
+
+          TerrainChunk *chunk = get_chunk_at(&app->chunk_cache, chunk_x, chunk_y);
+          if (chunk && chunk->models[0].state == AssetState::EMPTY) {
+            request_terrain_model(stream, chunk, 0, 1.5f);
           }
+        }
+      }
+    }
+  }
+
+  update_terrain_stream(memory, stream, pending_visible, app->time);
+
+  {
+    PROFILE_BLOCK("Terrain render", window*window);
+    for (int y=0; y<window; y++) {
+      for (int x=0; x<window; x++) {
+        TerrainChunk *chunk = chunks[y][x];
+        Model *model = models[y][x];
+
+        if (!model) { continue; }
+
+        vec3 center = vec3(chunk->x * CHUNK_SIZE_X, 0.0f, chunk->y * CHUNK_SIZE_Y);
+        if (!is_sphere_in_frustum(&app->camera.frustum, center, model->radius)) {
+          continue;
+        }
+
+        if (is_sphere_occluded(&app->occlusion, center, model->radius)) {
+          app->occlusion.stats.culled_chunks += 1;
+          continue;
+        }
+
+        // Stitch to whatever LOD the neighbour actually draws, which isn't
+        // always the one it asked for.
+        int neighbour_levels[4];
+        neighbour_levels[0] = (x > 0 && models[y][x - 1]) ? levels[y][x - 1] : levels[y][x];
+        neighbour_levels[1] = (x < window - 1 && models[y][x + 1]) ? levels[y][x + 1] : levels[y][x];
+        neighbour_levels[2] = (y > 0 && models[y - 1][x]) ? levels[y - 1][x] : levels[y][x];
+        neighbour_levels[3] = (y < window - 1 && models[y + 1][x]) ? levels[y + 1][x] : levels[y][x];
+
+        render_terrain_chunk(app, chunk, model, levels[y][x], neighbour_levels);
+      }
+    }
+  }
+
+  update_chunk_cache(&app->chunk_cache, x_coord, y_coord, 9*9);
+}
+
+// Depth-only terrain for one shadow cascade. Chunks draw the coarsest LOD
+// they have resident and never request builds, streaming follows the main
+// camera.
+void render_terrain_shadows(App *app, Camera *camera) {
+  PROFILE_BLOCK("Draw Terrain Shadows");
+  use_program(app, &app->terrain_depth_program);
+
+  set_uniform(app->current_program, Uniform::P_MATRIX, camera->view_matrix);
+
+  // NOTE: the heightfield is open so culling either side would drop it for
+  // some light directions. The offset keeps the coarse surface from shadowing
+  // the finer LODs drawn in the main pass.
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0f, 4.0f);
+
+  int x_coord = app->camera.position.chunk_x;
+  int y_coord = app->camera.position.chunk_y;
+
+  const int radius = 4;
+  const int window = radius * 2 + 1;
 
-          render_terrain_chunk(app, chunk, model);
+  TerrainChunk *chunks[window][window] = {};
+  Model *models[window][window] = {};
+  int levels[window][window];
+
+  for (int y=0; y<window; y++) {
+    for (int x=0; x<window; x++) {
+      int chunk_x = x - radius + x_coord;
+      int chunk_y = y - radius + y_coord;
+
+      if (chunk_x < 0 || chunk_y < 0 ) { continue; }
+
+      // NOTE: only resident chunks, the lookup neither allocates nor counts
+      // towards the cache stats
+      TerrainChunk *chunk = find_chunk_at(&app->chunk_cache, chunk_x, chunk_y);
+      if (!chunk) { continue; }
+
+      for (int level=TERRAIN_LOD_COUNT - 1; level>=0; level--) {
+        if (chunk->models[level].state == AssetState::INITIALIZED) {
+          chunks[y][x] = chunk;
+          models[y][x] = chunk->models + level;
+          levels[y][x] = level;
+          break;
         }
       }
     }
   }
+
+  for (int y=0; y<window; y++) {
+    for (int x=0; x<window; x++) {
+      TerrainChunk *chunk = chunks[y][x];
+      Model *model = models[y][x];
+
+      if (!model) { continue; }
+
+      if (!is_sphere_in_frustum(&camera->frustum, vec3(chunk->x * CHUNK_SIZE_X, 0.0f, chunk->y * CHUNK_SIZE_Y), model->radius)) {
+        continue;
+      }
+
+      int neighbour_levels[4];
+      neighbour_levels[0] = (x > 0 && models[y][x - 1]) ? levels[y][x - 1] : levels[y][x];
+      neighbour_levels[1] = (x < window - 1 && models[y][x + 1]) ? levels[y][x + 1] : levels[y][x];
+      neighbour_levels[2] = (y > 0 && models[y - 1][x]) ? levels[y - 1][x] : levels[y][x];
+      neighbour_levels[3] = (y < window - 1 && models[y + 1][x]) ? levels[y + 1][x] : levels[y][x];
+
+      render_terrain_chunk(app, chunk, model, levels[y][x], neighbour_levels);
+    }
+  }
+
+  glPolygonOffset(0.0f, 0.0f);
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glEnable(GL_CULL_FACE);
+}
+
+// Copies the occlusion buffer into a texture for the editor overlay,
+// brighter is closer.
+void update_occlusion_texture(App *app) {
+  Texture *texture = &app->occlusion_texture;
+  float *depth = app->occlusion.levels[0];
+
+  u8 *pixels = (u8 *)malloc(OCCLUSION_WIDTH * OCCLUSION_HEIGHT * 4);
+
+  for (u32 y=0; y<OCCLUSION_HEIGHT; y++) {
+    // NOTE: the buffer starts at the bottom of the screen, the overlay at the top
+    float *row = depth + (OCCLUSION_HEIGHT - 1 - y) * OCCLUSION_WIDTH;
+    u8 *pixel = pixels + y * OCCLUSION_WIDTH * 4;
+
+    for (u32 x=0; x<OCCLUSION_WIDTH; x++) {
+      float value = row[x] > 0.0f ? 1.0f - glm::clamp(1.0f / (row[x] * app->camera.far), 0.0f, 1.0f) : 0.0f;
+      u8 shade = (u8)(value * 255.0f);
+
+      pixel[0] = shade;
+      pixel[1] = shade;
+      pixel[2] = shade;
+      pixel[3] = 255;
+      pixel += 4;
+    }
+  }
+
+  if (texture->state == AssetState::EMPTY) {
+    texture->width = OCCLUSION_WIDTH;
+    texture->height = OCCLUSION_HEIGHT;
+    create_texture(texture, GL_RGBA, GL_RGBA, false, GL_CLAMP_TO_EDGE, pixels);
+    texture->state = AssetState::INITIALIZED;
+  } else {
+    gl_bind_texture(GL_TEXTURE_2D, texture->id);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    gl_bind_texture(GL_TEXTURE_2D, 0);
+  }
+
+  free(pixels);
 }
 
 void tick(Memory *memory, Input input) {
@@ -1472,6 +1939,9 @@ void tick(Memory *memory, Input input) {
   platform = memory->platform;
   App *app = memory->app;
 
+  gl_state = &app->gl_state;
+  begin_gl_state_frame(gl_state);
+
   app->time += input.delta_time;
 
   {
@@ -1482,6 +1952,8 @@ void tick(Memory *memory, Input input) {
 
       glewExperimental = GL_TRUE;
       glewInit();
+
+      reset_gl_state(gl_state);
     }
 
     if (app->editing_mode) {
@@ -1585,21 +2057,17 @@ void tick(Memory *memory, Input input) {
           movement = glm::normalize(movement);
         }
 
+        begin_particle_emitters(&app->particles);
+
         for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
           if (it->header.type == EntityType::EntityParticleEmitter) {
             EntityParticleEmitter *emitter = (EntityParticleEmitter *)it;
 
-            Particle *particle = app->particles + app->next_particle++;
-            if (app->next_particle >= array_count(app->particles)) {
-              app->next_particle = 0;
+            if (app->gpu_particles.enabled) {
+              queue_gpu_particle_emitter(&app->gpu_particles, get_world_position(emitter->header.position), emitter->initial_color, emitter->particle_size, emitter->gravity);
+            } else {
+              update_particle_emitter(&app->particles, emitter, &app->camera.frustum, input.delta_time);
             }
-
-            particle->position = get_world_position(emitter->header.position);
-            particle->color = emitter->initial_color;
-            particle->size = emitter->particle_size;
-            particle->velocity = vec3(get_random_float_between(-5.0f, 5.0f), get_random_float_between(0.0f, 10.0f), get_random_float_between(-5.0f, 5.0f));
-            particle->gravity = emitter->gravity;
-
           } else if (it->header.type == EntityType::EntityPlayer) {
             it->header.velocity += movement * speed * input.delta_time;
             it->header.velocity = glm::mix(it->header.velocity, vec3(0.0f), input.delta_time * 10.0f);
@@ -1610,33 +2078,19 @@ void tick(Memory *memory, Input input) {
           update_world_position(&it->header.position);
         }
 
-        {
-          PROFILE_BLOCK("Update particles");
-          for (u32 i=0; i<array_count(app->particles); i++) {
-            Particle *particle = app->particles + i;
-
-            particle->velocity.y += particle->gravity * input.delta_time;
-            particle->position += particle->velocity * input.delta_time;
-            particle->size = std::max(particle->size - 0.6f * input.delta_time, 0.0f);
-            particle->velocity = glm::mix(particle->velocity, vec3(0.0f), input.delta_time);
-            particle->color.a = glm::mix(particle->color.a, 0.0f, input.delta_time * 4.0f);
-          }
-
-          std::sort(app->particles, app->particles + array_count(app->particles), sort_particles_by_distance);
-
-          for (u32 i=0; i<array_count(app->particles); i++) {
-            Particle *particle = app->particles + i;
+        end_particle_emitters(&app->particles);
 
-            app->particle_positions[i] = vec4(vec3(particle->position), particle->size);
-            app->particle_colors[i] = particle->color;
-          }
+        if (app->gpu_particles.enabled) {
+          simulate_gpu_particles(app, input.delta_time);
+        } else {
+          update_particles(&app->particles, input.delta_time);
         }
 
         vec3 player_position = get_world_position(follow_entity->header.position);
         if (!app->editing_mode) {
-          follow_entity->header.position.offset_.y = get_terrain_height_at(player_position.x, player_position.z);
+          follow_entity->header.position.offset_.y = get_terrain_height(app, player_position.x, player_position.z);
         } else {
-          float terrain = get_terrain_height_at(player_position.x, player_position.z);
+          float terrain = get_terrain_height(app, player_position.x, player_position.z);
           if (player_position.y < terrain) {
             follow_entity->header.position.offset_.y = terrain;
           }
@@ -1657,7 +2111,12 @@ void tick(Memory *memory, Input input) {
         float closest_distance = FLT_MAX;
         vec3 hit_position;
 
-        for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
+        sync_entity_tree(app);
+        query_bvh_ray(&app->entity_tree, ray, &app->entity_query);
+
+        for (auto index = array::begin(app->entity_query); index != array::end(app->entity_query); index++) {
+          Entity *it = &app->entities[*index];
+
           if (!(it->header.flags & EntityFlags::HIDE_IN_EDITOR)) {
             RayMatchResult hit;
             hit.hit = false;
@@ -1699,7 +2158,6 @@ void tick(Memory *memory, Input input) {
                 grass->rotations = (vec3 *)malloc(sizeof(vec3) * MAX_GRASS_GROUP_COUNT);
                 grass->tints = (vec3 *)malloc(sizeof(vec3) * MAX_GRASS_GROUP_COUNT);
                 grass->grass_count = 0;
-                grass->initialized = false;
                 grass->reload_data = true;
               }
 
@@ -1722,15 +2180,25 @@ void tick(Memory *memory, Input input) {
           vec3 forward = get_forward(app->shadow_camera.orientation);
 
           app->shadow_camera.position = add_offset(app->camera.position, glm::normalize(forward) * -100.0f);
-          app->shadow_camera.view_matrix = get_camera_projection(&app->shadow_camera);
-          app->shadow_camera.view_matrix *= glm::toMat4(app->shadow_camera.orientation);
-          app->shadow_camera.view_matrix = glm::translate(app->shadow_camera.view_matrix, (get_world_position(app->shadow_camera.position) * -1.0f));
 
-          fill_frustum_with_matrix(&app->shadow_camera.frustum, app->shadow_camera.view_matrix);
+          update_shadow_splits(app->shadow_cascades, &app->camera, app->shadow_distance);
+
+          for (u32 i=0; i<SHADOW_CASCADES; i++) {
+            ShadowCascade *cascade = app->shadow_cascades + i;
+
+            // NOTE: offset by the index so the slow cascades take turns
+            cascade->update = app->shadow_frame == 0 || (app->shadow_frame + i) % cascade->update_interval == 0;
+            if (!cascade->update) { continue; }
+
+            fit_shadow_cascade(cascade, &app->camera, app->shadow_camera.orientation, app->shadow_width / 2);
+            app->shadow_matrices[i] = cascade->camera.view_matrix;
 
-          if (app->editing_mode && app->editor.show_camera_frustum) {
-            debug_render_frustum(app, &app->shadow_camera);
+            if (app->editing_mode && app->editor.show_camera_frustum) {
+              debug_render_frustum(app, &cascade->camera);
+            }
           }
+
+          app->shadow_frame += 1;
         }
 
         /* debug_render_frustum(app, &app->camera); */
@@ -1764,7 +2232,7 @@ void tick(Memory *memory, Input input) {
               } else {
                 entity->header.position = make_position((ray.start + ray.direction * app->editor.distance_from_entity_offset) - app->editor.hold_offset);
               }
-              mount_entity_to_terrain(entity);
+              mount_entity_to_terrain(app, entity);
             } else {
               entity->header.position = add_offset(add_offset(app->camera.position, ray.direction * app->editor.distance_from_entity_offset), -app->editor.hold_offset);
             }
@@ -1781,20 +2249,48 @@ void tick(Memory *memory, Input input) {
       }
     }
 
+    process_uploads(&app->uploads);
+
     // NOTE(sedivy): render
     {
       {
         PROFILE_BLOCK("Draw");
 
+        update_scene_visibility(memory, app);
+        update_grass_field(app, &app->grass, get_world_position(app->camera.position));
+
+        collect_scene_entities(app, &app->camera.frustum, EntityFlags::OCCLUDER, &app->scene_entities);
+        begin_occlusion(memory, app, &app->scene_entities);
+
         {
           PROFILE_BLOCK("Draw Shadows");
           glBindFramebuffer(GL_FRAMEBUFFER, app->shadow_buffer);
-          glViewport(0, 0, app->shadow_width, app->shadow_height);
-          glClear(GL_DEPTH_BUFFER_BIT);
 
           glEnable(GL_DEPTH_TEST);
+          glEnable(GL_SCISSOR_TEST);
+
+          u32 tile_width = app->shadow_width / 2;
+          u32 tile_height = app->shadow_height / 2;
+
+          // Every cascade has its own quarter of the atlas, see get_shadow_coord
+          // in the shaders.
+          for (u32 i=0; i<SHADOW_CASCADES; i++) {
+            ShadowCascade *cascade = app->shadow_cascades + i;
+            if (!cascade->update) { continue; }
+
+            u32 x = (i % 2) * tile_width;
+            u32 y = (i / 2) * tile_height;
 
-          render_scene(memory, app, &app->shadow_camera, &app->record_depth_program, true);
+            glViewport(x, y, tile_width, tile_height);
+            glScissor(x, y, tile_width, tile_height);
+            glClear(GL_DEPTH_BUFFER_BIT);
+
+            collect_scene_entities(app, &cascade->camera.frustum, EntityFlags::CASTS_SHADOW, &app->scene_entities);
+            render_scene(memory, app, &cascade->camera, &app->scene_entities, &app->record_depth_program, true);
+            render_terrain_shadows(app, &cascade->camera);
+          }
+
+          glDisable(GL_SCISSOR_TEST);
 
           glBindFramebuffer(GL_FRAMEBUFFER, 0);
         }
@@ -1809,13 +2305,24 @@ void tick(Memory *memory, Input input) {
         {
           PROFILE_BLOCK("Draw Main");
 
+          end_occlusion(memory, app);
+
+          if (app->editing_mode && app->editor.show_occlusion_buffer) {
+            update_occlusion_texture(app);
+          }
+
           render_terrain(memory, app);
-          render_scene(memory, app, &app->camera);
+          collect_scene_entities(app, &app->camera.frustum, 0, &app->scene_entities);
+          render_scene(memory, app, &app->camera, &app->scene_entities);
           glBindFramebuffer(GL_FRAMEBUFFER, app->frames[0].id);
 
           // NOTE(sedivy): particles
-          {
+          if (app->particles.count || app->gpu_particles.enabled) {
             PROFILE_BLOCK("Draw Particles");
+
+            ParticleSystem *particles = &app->particles;
+            GpuParticleSystem *gpu_particles = &app->gpu_particles;
+
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
@@ -1823,36 +2330,50 @@ void tick(Memory *memory, Input input) {
 
             glEnable(GL_DEPTH_TEST);
             glEnable(GL_CULL_FACE);
-            glCullFace(GL_BACK);
+            gl_cull_face(GL_BACK);
 
             use_program(app, &app->particle_program);
 
-            set_uniform(app->current_program, "uPMatrix", app->camera.view_matrix);
+            set_uniform(app->current_program, Uniform::P_MATRIX, app->camera.view_matrix);
             set_uniform(app->current_program, "camera_up", vec3(app->camera.view_matrix[0][1], app->camera.view_matrix[1][1], app->camera.view_matrix[2][1]));
             set_uniform(app->current_program, "camera_right", vec3(app->camera.view_matrix[0][0], app->camera.view_matrix[1][0], app->camera.view_matrix[2][0]));
 
-            glBindBuffer(GL_ARRAY_BUFFER, app->particle_buffer);
-            glBufferData(GL_ARRAY_BUFFER, array_count(app->particles) * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, array_count(app->particles) * 4 * sizeof(GLfloat), &app->particle_positions);
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+            u32 instance_count;
+
+            if (gpu_particles->enabled) {
+              instance_count = gpu_particles->capacity;
 
-            glBindBuffer(GL_ARRAY_BUFFER, app->particle_color_buffer);
-            glBufferData(GL_ARRAY_BUFFER, array_count(app->particles) * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, array_count(app->particles) * 4 * sizeof(GLfloat), &app->particle_colors);
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "color"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+              gl_bind_buffer(GL_ARRAY_BUFFER, gpu_particles->buffers[gpu_particles->current]);
+              gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void *)offsetof(GpuParticle, position));
+              gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, "color"), 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void *)offsetof(GpuParticle, color));
+            } else {
+              instance_count = particles->count;
+              sort_particles(particles, get_world_position(app->camera.position));
+
+              // NOTE: only the live prefix is uploaded
+              gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_buffer);
+              glBufferData(GL_ARRAY_BUFFER, particles->capacity * sizeof(vec4), NULL, GL_STREAM_DRAW);
+              glBufferSubData(GL_ARRAY_BUFFER, 0, particles->count * sizeof(vec4), particles->draw_positions);
+              gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 4, GL_FLOAT, GL_FALSE, 0, 0);
+
+              gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_color_buffer);
+              glBufferData(GL_ARRAY_BUFFER, particles->capacity * sizeof(vec4), NULL, GL_STREAM_DRAW);
+              glBufferSubData(GL_ARRAY_BUFFER, 0, particles->count * sizeof(vec4), particles->draw_colors);
+              gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, "color"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+            }
 
-            glBindBuffer(GL_ARRAY_BUFFER, app->particle_model);
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "data"), 3, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_bind_buffer(GL_ARRAY_BUFFER, app->particle_model);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, "data"), 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-            glVertexAttribDivisor(0, 0);
-            glVertexAttribDivisor(1, 1);
-            glVertexAttribDivisor(2, 1);
+            gl_vertex_attrib_divisor(0, 0);
+            gl_vertex_attrib_divisor(1, 1);
+            gl_vertex_attrib_divisor(2, 1);
 
-            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, array_count(app->particles));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 6, instance_count);
 
-            glVertexAttribDivisor(0, 0);
-            glVertexAttribDivisor(1, 0);
-            glVertexAttribDivisor(2, 0);
+            gl_vertex_attrib_divisor(0, 0);
+            gl_vertex_attrib_divisor(1, 0);
+            gl_vertex_attrib_divisor(2, 0);
 
             glDisable(GL_BLEND);
             glDisable(GL_CULL_FACE);
@@ -1863,11 +2384,11 @@ void tick(Memory *memory, Input input) {
             if (app->debug_lines.size > 0) {
               PROFILE_BLOCK("Draw Debug Lines");
               use_program(app, &app->debug_program);
-              glBindBuffer(GL_ARRAY_BUFFER, app->debug_buffer);
+              gl_bind_buffer(GL_ARRAY_BUFFER, app->debug_buffer);
               glBufferData(GL_ARRAY_BUFFER, app->debug_lines.size * sizeof(vec3)*2, NULL, GL_STREAM_DRAW);
               glBufferSubData(GL_ARRAY_BUFFER, 0, app->debug_lines.size * sizeof(vec3)*2, &app->debug_lines[0]);
-              set_uniform(app->current_program, "uPMatrix", app->camera.view_matrix);
-              glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+              set_uniform(app->current_program, Uniform::P_MATRIX, app->camera.view_matrix);
+              gl_vertex_attrib_pointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
               glDrawArrays(GL_LINES, 0, app->debug_lines.size);
               array::clear(app->debug_lines);
             }
@@ -1887,24 +2408,24 @@ void tick(Memory *memory, Input input) {
           app->read_frame = 0;
           app->write_frame = 1;
 
-          glActiveTexture(GL_TEXTURE0 + 0);
-          glBindTexture(GL_TEXTURE_2D, app->frames[app->read_frame].texture);
+          gl_active_texture(GL_TEXTURE0 + 0);
+          gl_bind_texture(GL_TEXTURE_2D, app->frames[app->read_frame].texture);
 
-          glActiveTexture(GL_TEXTURE0 + 1);
-          glBindTexture(GL_TEXTURE_2D, app->frames[app->write_frame].texture);
+          gl_active_texture(GL_TEXTURE0 + 1);
+          gl_bind_texture(GL_TEXTURE_2D, app->frames[app->write_frame].texture);
 
-          glBindBuffer(GL_ARRAY_BUFFER, app->fullscreen_quad);
+          gl_bind_buffer(GL_ARRAY_BUFFER, app->fullscreen_quad);
 
           {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_program);
 
-            glActiveTexture(GL_TEXTURE0 + 2);
-            glBindTexture(GL_TEXTURE_2D, app->color_correction_texture.id);
+            gl_active_texture(GL_TEXTURE0 + 2);
+            gl_bind_texture(GL_TEXTURE_2D, app->color_correction_texture.id);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1914,14 +2435,14 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_color_program);
 
-            glActiveTexture(GL_TEXTURE0 + 2);
-            glBindTexture(GL_TEXTURE_2D, app->color_correction_texture.id);
+            gl_active_texture(GL_TEXTURE0 + 2);
+            gl_bind_texture(GL_TEXTURE_2D, app->color_correction_texture.id);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
             set_uniformi(app->current_program, "color_correction_texture", 2);
             set_uniformf(app->current_program, "lut_size", 16.0f);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1931,10 +2452,10 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_fxaa_program);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
             set_uniform(app->current_program, "texture_size", vec2(app->frames[0].width, app->frames[0].height));
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1944,9 +2465,9 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_bloom_program);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1956,9 +2477,9 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_hdr_program);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1968,9 +2489,9 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, app->frames[app->write_frame].id);
             use_program(app, &app->fullscreen_lens_program);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
 
             std::swap(app->write_frame, app->read_frame);
@@ -1982,9 +2503,9 @@ void tick(Memory *memory, Input input) {
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
             use_program(app, &app->fullscreen_program);
 
-            set_uniformi(app->current_program, "uSampler", app->read_frame);
+            set_uniformi(app->current_program, Uniform::SAMPLER, app->read_frame);
 
-            glVertexAttribPointer(shader_get_attribute_location(app->current_program, "position"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+            gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::POSITION), 2, GL_FLOAT, GL_FALSE, 0, 0);
             glDrawArrays(GL_TRIANGLES, 0, 6);
           }
         }
@@ -37,6 +37,13 @@ using glm::quat;
 
 #include <unordered_map>
 
+// NOTE: the occlusion rasterizer and the particle update have scalar
+// fallbacks for everything else
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
 #include "perlin.h"
 
 #include "stb_truetype.cpp"
@@ -49,6 +56,7 @@ using glm::quat;
 
 struct Memory *debug_global_memory;
 PlatformAPI platform;
+struct GLState *gl_state;
 
 #include "scope_exit.h"
 
@@ -61,6 +69,7 @@ PlatformAPI platform;
 static float tau = glm::pi<float>() * 2.0f;
 static float pi = glm::pi<float>();
 
+#include "gl_state.h"
 #include "shader.h"
 
 struct Box {
@@ -77,8 +86,12 @@ struct Box {
 #include "entity.h"
 #include "plane.h"
 #include "camera.h"
+#include "bvh.h"
 
 #include "render_group.h"
+#include "occlusion.h"
+#include "particles.h"
+#include "grass.h"
 #include "level.h"
 
 #include "ui.h"
@@ -92,17 +105,6 @@ struct FrameBuffer {
   u32 height;
 };
 
-struct Particle {
-  vec3 position;
-  vec4 color;
-  vec3 velocity;
-
-  float size;
-  float gravity;
-
-  float distance_from_camera;
-};
-
 struct App {
   Shader main_object_program;
   Shader transparent_program;
@@ -123,7 +125,9 @@ struct App {
   Shader fullscreen_depth_program;
   Shader fullscreen_lens_program;
   Shader terrain_program;
+  Shader terrain_depth_program;
   Shader particle_program;
+  Shader particle_update_program;
   Shader skybox_program;
   Shader textured_program;
   Shader grass_program;
@@ -134,6 +138,7 @@ struct App {
   GLuint fullscreen_quad;
 
   GLuint vao;
+  GLuint instance_buffer;
 
   GLuint debug_buffer;
   GLuint debug_index_buffer;
@@ -167,17 +172,46 @@ struct App {
   Array<Entity> entities;
   Pid last_id;
 
+  std::unordered_map<Pid, u32> entity_indices;
+
+  // Only the sun orientation and light position, the shadow map is drawn
+  // through the cascades.
   Camera shadow_camera;
 
+  ShadowCascade shadow_cascades[SHADOW_CASCADES];
+  mat4 shadow_matrices[SHADOW_CASCADES];
+  float shadow_distance;
+  u32 shadow_frame;
+
   Camera camera;
   Pid camera_follow;
 
   GLuint *last_shader;
 
-  TerrainChunk *chunk_cache;
-  u32 chunk_cache_count;
+  GLState gl_state;
+
+  ChunkCache chunk_cache;
+  TerrainStream terrain_stream;
+  UploadQueue uploads;
+  TerrainLodIndices terrain_indices[TERRAIN_LOD_COUNT];
 
   RenderGroup render_group;
+  SceneJob scene_jobs[MAX_SCENE_JOBS];
+
+  Array<EntityVisibility> visibility;
+  VisibilityJob visibility_jobs[MAX_SCENE_JOBS];
+
+  // Leaves are entity indices, see update_entity_tree.
+  Bvh entity_tree;
+  u32 entity_tree_count;
+  Array<u32> entity_query;
+
+  // Entities the current pass draws, see collect_scene_entities.
+  Array<u32> scene_entities;
+
+  OcclusionBuffer occlusion;
+  Texture occlusion_texture;
+
   RenderGroup transparent_render_group;
 
   bool editing_mode = false;
@@ -196,11 +230,10 @@ struct App {
   bool hdr;
   bool lens_flare;
 
-  Particle particles[4096];
-  u32 next_particle;
+  ParticleSystem particles;
+  GpuParticleSystem gpu_particles;
 
-  vec4 particle_positions[4096];
-  vec4 particle_colors[4096];
+  GrassField grass;
 
   GLuint particle_buffer;
   GLuint particle_color_buffer;
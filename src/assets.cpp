@@ -21,3 +21,23 @@ void acquire_asset_file(char *path) {
 #endif
 }
 
+
+// Moves the asset from HAS_DATA to UPLOADING, process_uploads creates its
+// GL objects later.
+bool queue_upload(UploadQueue *queue, u32 type, void *asset, u32 volatile *state) {
+  if (queue->count == MAX_UPLOADS) {
+    return false;
+  }
+
+  if (!platform.atomic_exchange(state, AssetState::HAS_DATA, AssetState::UPLOADING)) {
+    return false;
+  }
+
+  Upload *upload = queue->items + (queue->head + queue->count) % MAX_UPLOADS;
+  upload->type = type;
+  upload->asset = asset;
+
+  queue->count += 1;
+
+  return true;
+}
@@ -5,6 +5,49 @@ namespace AssetState {
     EMPTY,
     INITIALIZED,
     HAS_DATA,
-    PROCESSING
+    PROCESSING,
+    QUEUED,
+    UPLOADING
   };
 }
+
+namespace UploadType {
+  enum UploadType {
+    MODEL,
+    TERRAIN,
+    TEXTURE
+  };
+}
+
+struct Upload {
+  u32 type;
+  void *asset;
+};
+
+#define MAX_UPLOADS 1024
+
+struct UploadStats {
+  u32 uploads;
+  u64 bytes;
+  float time;
+  u32 queued;
+};
+
+// Assets whose data is ready wait here for their GL objects. Every frame
+// uploads run oldest first until the byte or time budget is spent, with at
+// least one per frame. Data is copied into a staging buffer that gets
+// orphaned whenever it fills up and copied to the final objects on the GPU.
+struct UploadQueue {
+  Upload items[MAX_UPLOADS];
+  u32 head;
+  u32 count;
+
+  float budget_megabytes;
+  float budget_milliseconds;
+
+  GLuint staging;
+  u32 staging_size;
+  u32 staging_offset;
+
+  UploadStats stats;
+};
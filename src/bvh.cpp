@@ -0,0 +1,355 @@
+inline Box box_union(Box a, Box b) {
+  Box result;
+  result.min = glm::min(a.min, b.min);
+  result.max = glm::max(a.max, b.max);
+  return result;
+}
+
+inline bool box_contains(Box outer, Box inner) {
+  return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+}
+
+inline float box_area(Box box) {
+  vec3 size = box.max - box.min;
+  return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+void clear_bvh(Bvh *tree) {
+  array::clear(tree->nodes);
+  array::clear(tree->leaves);
+
+  tree->root = BVH_NULL;
+  tree->free_list = BVH_NULL;
+}
+
+u32 allocate_bvh_node(Bvh *tree) {
+  u32 index = tree->free_list;
+
+  if (index != BVH_NULL) {
+    tree->free_list = tree->nodes[index].parent;
+  } else {
+    index = tree->nodes.size;
+    array::push_back(tree->nodes, BvhNode());
+  }
+
+  BvhNode *node = &tree->nodes[index];
+  node->parent = BVH_NULL;
+  node->left = BVH_NULL;
+  node->right = BVH_NULL;
+  node->height = 0;
+  node->item = BVH_NULL;
+
+  return index;
+}
+
+void free_bvh_node(Bvh *tree, u32 index) {
+  BvhNode *node = &tree->nodes[index];
+  node->parent = tree->free_list;
+  node->height = -1;
+
+  tree->free_list = index;
+}
+
+inline void replace_bvh_child(Bvh *tree, u32 parent, u32 old_child, u32 new_child) {
+  if (parent == BVH_NULL) {
+    tree->root = new_child;
+  } else if (tree->nodes[parent].left == old_child) {
+    tree->nodes[parent].left = new_child;
+  } else {
+    tree->nodes[parent].right = new_child;
+  }
+}
+
+// Rotates the taller grandchild up when the children of a differ in height
+// by more than one. Returns the node now in a's place.
+u32 balance_bvh_node(Bvh *tree, u32 ia) {
+  BvhNode *a = &tree->nodes[ia];
+  if (a->height < 2) { return ia; }
+
+  u32 ib = a->left;
+  u32 ic = a->right;
+  BvhNode *b = &tree->nodes[ib];
+  BvhNode *c = &tree->nodes[ic];
+
+  int balance = c->height - b->height;
+
+  if (balance > 1) {
+    u32 i_f = c->left;
+    u32 i_g = c->right;
+    BvhNode *f = &tree->nodes[i_f];
+    BvhNode *g = &tree->nodes[i_g];
+
+    c->left = ia;
+    c->parent = a->parent;
+    a->parent = ic;
+    replace_bvh_child(tree, c->parent, ia, ic);
+
+    if (f->height > g->height) {
+      c->right = i_f;
+      a->right = i_g;
+      g->parent = ia;
+
+      a->box = box_union(b->box, g->box);
+      c->box = box_union(a->box, f->box);
+      a->height = 1 + glm::max(b->height, g->height);
+      c->height = 1 + glm::max(a->height, f->height);
+    } else {
+      c->right = i_g;
+      a->right = i_f;
+      f->parent = ia;
+
+      a->box = box_union(b->box, f->box);
+      c->box = box_union(a->box, g->box);
+      a->height = 1 + glm::max(b->height, f->height);
+      c->height = 1 + glm::max(a->height, g->height);
+    }
+
+    return ic;
+  }
+
+  if (balance < -1) {
+    u32 i_d = b->left;
+    u32 i_e = b->right;
+    BvhNode *d = &tree->nodes[i_d];
+    BvhNode *e = &tree->nodes[i_e];
+
+    b->left = ia;
+    b->parent = a->parent;
+    a->parent = ib;
+    replace_bvh_child(tree, b->parent, ia, ib);
+
+    if (d->height > e->height) {
+      b->right = i_d;
+      a->left = i_e;
+      e->parent = ia;
+
+      a->box = box_union(c->box, e->box);
+      b->box = box_union(a->box, d->box);
+      a->height = 1 + glm::max(c->height, e->height);
+      b->height = 1 + glm::max(a->height, d->height);
+    } else {
+      b->right = i_e;
+      a->left = i_d;
+      d->parent = ia;
+
+      a->box = box_union(c->box, d->box);
+      b->box = box_union(a->box, e->box);
+      a->height = 1 + glm::max(c->height, d->height);
+      b->height = 1 + glm::max(a->height, e->height);
+    }
+
+    return ib;
+  }
+
+  return ia;
+}
+
+// Refits boxes and heights from index up to the root.
+void refit_bvh_ancestors(Bvh *tree, u32 index) {
+  while (index != BVH_NULL) {
+    index = balance_bvh_node(tree, index);
+
+    BvhNode *node = &tree->nodes[index];
+    BvhNode *left = &tree->nodes[node->left];
+    BvhNode *right = &tree->nodes[node->right];
+
+    node->height = 1 + glm::max(left->height, right->height);
+    node->box = box_union(left->box, right->box);
+
+    index = node->parent;
+  }
+}
+
+// Walks down to the sibling that grows the total surface area the least.
+void insert_bvh_leaf(Bvh *tree, u32 leaf) {
+  if (tree->root == BVH_NULL) {
+    tree->root = leaf;
+    tree->nodes[leaf].parent = BVH_NULL;
+    return;
+  }
+
+  Box leaf_box = tree->nodes[leaf].box;
+  u32 index = tree->root;
+
+  while (tree->nodes[index].height > 0) {
+    BvhNode *node = &tree->nodes[index];
+
+    float area = box_area(node->box);
+    float combined_area = box_area(box_union(node->box, leaf_box));
+
+    // Pairing with this node, or pushing the leaf further down which
+    // grows this node anyway.
+    float cost = 2.0f * combined_area;
+    float inheritance_cost = 2.0f * (combined_area - area);
+
+    float child_costs[2];
+    u32 children[2] = { node->left, node->right };
+
+    for (u32 i=0; i<2; i++) {
+      BvhNode *child = &tree->nodes[children[i]];
+      float child_area = box_area(box_union(leaf_box, child->box));
+
+      if (child->height > 0) {
+        child_area -= box_area(child->box);
+      }
+
+      child_costs[i] = child_area + inheritance_cost;
+    }
+
+    if (cost < child_costs[0] && cost < child_costs[1]) {
+      break;
+    }
+
+    index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+  }
+
+  u32 sibling = index;
+  u32 old_parent = tree->nodes[sibling].parent;
+  u32 new_parent = allocate_bvh_node(tree);
+
+  BvhNode *parent = &tree->nodes[new_parent];
+  parent->parent = old_parent;
+  parent->left = sibling;
+  parent->right = leaf;
+  parent->box = box_union(leaf_box, tree->nodes[sibling].box);
+  parent->height = tree->nodes[sibling].height + 1;
+
+  replace_bvh_child(tree, old_parent, sibling, new_parent);
+
+  tree->nodes[sibling].parent = new_parent;
+  tree->nodes[leaf].parent = new_parent;
+
+  refit_bvh_ancestors(tree, new_parent);
+}
+
+void remove_bvh_leaf(Bvh *tree, u32 leaf) {
+  if (leaf == tree->root) {
+    tree->root = BVH_NULL;
+    return;
+  }
+
+  u32 parent = tree->nodes[leaf].parent;
+  u32 grandparent = tree->nodes[parent].parent;
+  u32 sibling = tree->nodes[parent].left == leaf ? tree->nodes[parent].right : tree->nodes[parent].left;
+
+  replace_bvh_child(tree, grandparent, parent, sibling);
+  tree->nodes[sibling].parent = grandparent;
+
+  free_bvh_node(tree, parent);
+
+  refit_bvh_ancestors(tree, grandparent);
+}
+
+// Inserts the item or moves it when box left the inflated box of its leaf.
+void set_bvh_item(Bvh *tree, u32 item, Box box) {
+  if (item >= tree->leaves.size) {
+    u32 count = tree->leaves.size;
+    array::resize(tree->leaves, item + 1);
+
+    for (u32 i=count; i<tree->leaves.size; i++) {
+      tree->leaves[i] = BVH_NULL;
+    }
+  }
+
+  u32 leaf = tree->leaves[item];
+
+  if (leaf != BVH_NULL) {
+    if (box_contains(tree->nodes[leaf].box, box)) {
+      return;
+    }
+
+    remove_bvh_leaf(tree, leaf);
+  } else {
+    leaf = allocate_bvh_node(tree);
+    tree->nodes[leaf].item = item;
+    tree->leaves[item] = leaf;
+  }
+
+  tree->nodes[leaf].box.min = box.min - vec3(BVH_MARGIN);
+  tree->nodes[leaf].box.max = box.max + vec3(BVH_MARGIN);
+
+  insert_bvh_leaf(tree, leaf);
+}
+
+// Replaces result with the items whose boxes intersect the frustum.
+void query_bvh_frustum(Bvh *tree, Frustum *frustum, Array<u32> *result) {
+  PROFILE_BLOCK("BVH Frustum");
+  array::clear(*result);
+
+  if (tree->root == BVH_NULL) { return; }
+
+  // NOTE: subtrees entirely inside are pushed with inside set and skip the
+  // tests
+  u32 stack[BVH_STACK_SIZE];
+  bool stack_inside[BVH_STACK_SIZE];
+  u32 count = 0;
+
+  stack[count] = tree->root;
+  stack_inside[count++] = false;
+
+  while (count) {
+    count -= 1;
+    BvhNode *node = &tree->nodes[stack[count]];
+    bool inside = stack_inside[count];
+
+    if (!inside) {
+      FrustumTest::FrustumTest test = test_box_in_frustum(frustum, node->box);
+      if (test == FrustumTest::OUTSIDE) { continue; }
+
+      inside = test == FrustumTest::INSIDE;
+    }
+
+    if (node->height == 0) {
+      array::push_back(*result, node->item);
+      continue;
+    }
+
+    assert(count + 2 <= BVH_STACK_SIZE);
+
+    stack[count] = node->left;
+    stack_inside[count++] = inside;
+    stack[count] = node->right;
+    stack_inside[count++] = inside;
+  }
+}
+
+inline bool ray_hits_box(vec3 start, vec3 inverse_direction, Box box) {
+  vec3 t0 = (box.min - start) * inverse_direction;
+  vec3 t1 = (box.max - start) * inverse_direction;
+
+  float enter = glm::compMax(glm::min(t0, t1));
+  float exit = glm::compMin(glm::max(t0, t1));
+
+  return exit >= glm::max(enter, 0.0f);
+}
+
+// Replaces result with the items whose boxes the ray hits.
+void query_bvh_ray(Bvh *tree, Ray ray, Array<u32> *result) {
+  PROFILE_BLOCK("BVH Ray");
+  array::clear(*result);
+
+  if (tree->root == BVH_NULL) { return; }
+
+  // NOTE: zero components turn into infinities which the slab test handles
+  vec3 inverse_direction = 1.0f / ray.direction;
+
+  u32 stack[BVH_STACK_SIZE];
+  u32 count = 0;
+  stack[count++] = tree->root;
+
+  while (count) {
+    BvhNode *node = &tree->nodes[stack[--count]];
+
+    if (!ray_hits_box(ray.start, inverse_direction, node->box)) { continue; }
+
+    if (node->height == 0) {
+      array::push_back(*result, node->item);
+      continue;
+    }
+
+    assert(count + 2 <= BVH_STACK_SIZE);
+
+    stack[count++] = node->left;
+    stack[count++] = node->right;
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#define BVH_NULL 0xFFFFFFFF
+
+// Leaves are inflated by this much so small moves don't touch the tree.
+#define BVH_MARGIN 1.0f
+
+#define BVH_STACK_SIZE 256
+
+struct BvhNode {
+  Box box;
+
+  // Next free node while the node is on the free list.
+  u32 parent;
+
+  u32 left;
+  u32 right;
+
+  // 0 for leaves, -1 for free nodes.
+  int height;
+
+  u32 item;
+};
+
+// Dynamic AABB tree over items identified by index. Inner nodes are kept
+// balanced by rotations the way Box2D's dynamic tree does it.
+struct Bvh {
+  Array<BvhNode> nodes;
+  u32 root;
+  u32 free_list;
+
+  // Leaf node of every item, BVH_NULL when the item isn't in the tree.
+  Array<u32> leaves;
+};
@@ -9,6 +9,34 @@ bool is_sphere_in_frustum(Frustum *frustum, vec3 position, float radius) {
   return true;
 }
 
+// Checks the corner farthest along every plane normal and, to tell when the
+// box is entirely inside, the nearest one.
+FrustumTest::FrustumTest test_box_in_frustum(Frustum *frustum, Box box) {
+  FrustumTest::FrustumTest result = FrustumTest::INSIDE;
+
+  for (int i=0; i<6; i++) {
+    Plane plane = frustum->planes[i];
+
+    vec3 farthest = vec3(plane.normal.x >= 0.0f ? box.max.x : box.min.x,
+                         plane.normal.y >= 0.0f ? box.max.y : box.min.y,
+                         plane.normal.z >= 0.0f ? box.max.z : box.min.z);
+
+    if (distance_from_plane(plane, farthest) < 0) {
+      return FrustumTest::OUTSIDE;
+    }
+
+    vec3 nearest = vec3(plane.normal.x >= 0.0f ? box.min.x : box.max.x,
+                        plane.normal.y >= 0.0f ? box.min.y : box.max.y,
+                        plane.normal.z >= 0.0f ? box.min.z : box.max.z);
+
+    if (distance_from_plane(plane, nearest) < 0) {
+      result = FrustumTest::INTERSECTS;
+    }
+  }
+
+  return result;
+}
+
 void debug_render_frustum(App *app, Camera *camera) {
   vec4 hcorners[8];
   hcorners[0] = glm::vec4(-1, 1, 1, 1);
@@ -73,6 +101,84 @@ mat4 get_camera_projection(Camera *camera) {
   return projection;
 }
 
+// Splits the first distance units of the camera frustum between the
+// cascades, blending logarithmic and uniform splits.
+void update_shadow_splits(ShadowCascade *cascades, Camera *camera, float distance) {
+  float start = camera->near;
+  float end = glm::min(distance, camera->far);
+
+  for (u32 i=0; i<SHADOW_CASCADES; i++) {
+    float p = (float)(i + 1) / (float)SHADOW_CASCADES;
+
+    float logarithmic = start * glm::pow(end / start, p);
+    float uniform = start + (end - start) * p;
+
+    cascades[i].split_near = i == 0 ? start : cascades[i - 1].split_far;
+    cascades[i].split_far = glm::mix(uniform, logarithmic, SHADOW_SPLIT_LAMBDA);
+  }
+}
+
+// Fits the cascade around a bounding sphere of its slice. The sphere keeps
+// its size as the camera turns and its center is snapped to whole texels in
+// light space, so shadow edges don't shimmer as the camera moves.
+void fit_shadow_cascade(ShadowCascade *cascade, Camera *camera, quat light_orientation, u32 resolution) {
+  mat4 inverse_view = glm::inverse(camera->view_matrix);
+
+  float t_near = (cascade->split_near - camera->near) / (camera->far - camera->near);
+  float t_far = (cascade->split_far - camera->near) / (camera->far - camera->near);
+
+  // NOTE: depth is linear along the lines between near and far corners
+  vec3 corners[8];
+  for (u32 i=0; i<4; i++) {
+    vec2 xy = vec2(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f);
+
+    vec4 near_corner = inverse_view * vec4(xy, -1.0f, 1.0f);
+    vec4 far_corner = inverse_view * vec4(xy, 1.0f, 1.0f);
+
+    vec3 a = vec3(near_corner) / near_corner.w;
+    vec3 b = vec3(far_corner) / far_corner.w;
+
+    corners[i] = glm::mix(a, b, t_near);
+    corners[i + 4] = glm::mix(a, b, t_far);
+  }
+
+  vec3 center = vec3(0.0f);
+  for (u32 i=0; i<8; i++) {
+    center += corners[i] / 8.0f;
+  }
+
+  float radius = 0.0f;
+  for (u32 i=0; i<8; i++) {
+    radius = glm::max(radius, glm::length(corners[i] - center));
+  }
+  radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+  float texel = radius * 2.0f / (float)resolution;
+
+  mat3 rotation = mat3(glm::toMat4(light_orientation));
+  vec3 light_center = rotation * center;
+  light_center.x = glm::floor(light_center.x / texel) * texel;
+  light_center.y = glm::floor(light_center.y / texel) * texel;
+  center = glm::transpose(rotation) * light_center;
+
+  float back = radius + SHADOW_CASTER_DISTANCE;
+  vec3 eye = center - get_forward(light_orientation) * back;
+
+  Camera *result = &cascade->camera;
+  result->ortho = true;
+  result->orientation = light_orientation;
+  result->position = make_position(eye);
+  result->size = vec2(radius * 2.0f);
+  result->near = 0.0f;
+  result->far = back + radius;
+
+  result->view_matrix = get_camera_projection(result);
+  result->view_matrix *= glm::toMat4(light_orientation);
+  result->view_matrix = glm::translate(result->view_matrix, eye * -1.0f);
+
+  fill_frustum_with_matrix(&result->frustum, result->view_matrix);
+}
+
 Ray get_mouse_ray(App *app, Input input, Memory *memory) {
   PROFILE_BLOCK("Mouse Ray");
   vec3 to = glm::unProject(
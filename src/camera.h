@@ -13,3 +13,23 @@ struct Camera {
   float far;
   float near;
 };
+
+#define SHADOW_CASCADES 4
+#define SHADOW_SPLIT_LAMBDA 0.8f
+
+// How far behind a cascade casters are still drawn into it.
+#define SHADOW_CASTER_DISTANCE 100.0f
+
+// One quarter of the shadow atlas, fit to a slice of the camera frustum.
+struct ShadowCascade {
+  Camera camera;
+
+  // View depth range of the slice.
+  float split_near;
+  float split_far;
+
+  // Refit and drawn every update_interval frames, until then the shaders
+  // keep sampling with the matrix it was last drawn with.
+  u32 update_interval;
+  bool update;
+};
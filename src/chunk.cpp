@@ -8,201 +8,629 @@ float get_terrain_height_at(float x, float y) {
   );
 }
 
+// Same result as calling get_terrain_height_at for every (x[i], y[i]) pair,
+// but each noise layer is sampled in one batch.
+void get_terrain_heights(const float *x, const float *y, float *out, u32 count) {
+  const u32 block_size = 64;
+
+  float layer_x[block_size];
+  float layer_y[block_size];
+  float layer[3][block_size];
+
+  for (u32 start=0; start<count; start += block_size) {
+    u32 size = glm::min(block_size, count - start);
+
+    for (u32 i=0; i<size; i++) {
+      layer_x[i] = x[start + i] / 400.0f;
+      layer_y[i] = y[start + i] / 400.0f;
+    }
+    scaled_octave_noise_2d_batch(1.0f, 1.0f, 10.0f, -1.0f, 5.0f, layer_x, layer_y, layer[0], size);
+
+    for (u32 i=0; i<size; i++) {
+      layer_x[i] = x[start + i] / 4000.0f;
+      layer_y[i] = y[start + i] / 4000.0f;
+    }
+    scaled_octave_noise_2d_batch(1.0f, 1.0f, 10.0f, 0.0f, 10.0f, layer_x, layer_y, layer[1], size);
+
+    for (u32 i=0; i<size; i++) {
+      layer_x[i] = x[start + i] / 8000.0f;
+      layer_y[i] = y[start + i] / 8000.0f;
+    }
+    scaled_octave_noise_2d_batch(1.0f, 1.0f, 100.0f, 0.0f, 10.0f, layer_x, layer_y, layer[2], size);
+
+    for (u32 i=0; i<size; i++) {
+      out[start + i] = layer[0][i] + layer[1][i] + layer[2][i] + 0.0f;
+    }
+  }
+}
+
 void unload_chunk(TerrainChunk *chunk) {
   for (u32 i=0; i<array_count(chunk->models); i++) {
     Model *model = chunk->models + i;
-    unload_model(model);
+
+    if (platform.atomic_exchange(&model->state, AssetState::HAS_DATA, AssetState::PROCESSING)) {
+      free(model->mesh.data.data);
+      model->state = AssetState::EMPTY;
+      chunk->queued_jobs &= ~(1 << i);
+    } else {
+      unload_model(model);
+    }
+  }
+
+  if (chunk->heights) {
+    free(chunk->heights);
+    chunk->heights = NULL;
   }
+  chunk->heights_stride = 0;
+  chunk->occluder_stride = 0;
 }
 
-TerrainChunk *get_chunk_at(TerrainChunk *chunks, u32 count, u32 x, u32 y) {
-  u32 hash = 6269 * x + 8059 * y;
-  u32 slot = hash % (count - 1);
-  assert(slot < count);
+void initialize_chunk_cache(ChunkCache *cache, u32 count, float memory_budget) {
+  cache->count = count;
+  cache->chunks = (TerrainChunk *)malloc(sizeof(TerrainChunk) * count);
+  cache->free_indices = (u32 *)malloc(sizeof(u32) * count);
+  cache->eviction_candidates = (u32 *)malloc(sizeof(u32) * count);
+  cache->free_count = count;
+
+  for (u32 i=0; i<count; i++) {
+    TerrainChunk *chunk = cache->chunks + i;
+    chunk->models[0].state = AssetState::EMPTY;
+    chunk->models[1].state = AssetState::EMPTY;
+    chunk->models[2].state = AssetState::EMPTY;
+    chunk->heights = NULL;
+    chunk->heights_stride = 0;
+    chunk->occluder_stride = 0;
+    chunk->initialized = false;
+    chunk->queued_jobs = 0;
+
+    cache->free_indices[i] = count - i - 1;
+  }
 
-  TerrainChunk *chunk = chunks + slot;
+  // NOTE: twice the pool size rounded to a power of two keeps the table at
+  // most half full.
+  cache->slots_count = 1;
+  while (cache->slots_count < count * 2) {
+    cache->slots_count *= 2;
+  }
 
-  do {
-    if (chunk->initialized) {
-      if (chunk->x == x && chunk->y == y) {
-        break;
-      }
+  cache->slots = (ChunkSlot *)malloc(sizeof(ChunkSlot) * cache->slots_count);
+  for (u32 i=0; i<cache->slots_count; i++) {
+    cache->slots[i].index = CHUNK_SLOT_EMPTY;
+  }
+  cache->tombstones = 0;
+
+  cache->memory_budget = memory_budget;
+  cache->frame = 0;
+  cache->stats = {};
+}
 
-      if (!chunk->next) {
-        chunk->next = (TerrainChunk *)(malloc(sizeof(TerrainChunk)));
-        chunk->next->initialized = false;
-        chunk->next->prev = chunk;
+inline u32 chunk_slot_hash(u32 x, u32 y) {
+  return 6269 * x + 8059 * y;
+}
+
+TerrainChunk *find_chunk_at(ChunkCache *cache, u32 x, u32 y) {
+  u32 mask = cache->slots_count - 1;
+
+  for (u32 slot = chunk_slot_hash(x, y) & mask;; slot = (slot + 1) & mask) {
+    ChunkSlot *item = cache->slots + slot;
+
+    if (item->index == CHUNK_SLOT_EMPTY) {
+      return NULL;
+    }
+
+    if (item->index != CHUNK_SLOT_TOMBSTONE && item->x == x && item->y == y) {
+      return cache->chunks + item->index;
+    }
+  }
+}
+
+void insert_chunk_slot(ChunkCache *cache, u32 x, u32 y, u32 index) {
+  u32 mask = cache->slots_count - 1;
+
+  for (u32 slot = chunk_slot_hash(x, y) & mask;; slot = (slot + 1) & mask) {
+    ChunkSlot *item = cache->slots + slot;
+
+    if (item->index == CHUNK_SLOT_EMPTY || item->index == CHUNK_SLOT_TOMBSTONE) {
+      if (item->index == CHUNK_SLOT_TOMBSTONE) {
+        cache->tombstones -= 1;
       }
-    } else {
-      chunk->x = x;
-      chunk->y = y;
-      chunk->initialized = true;
-      chunk->next = 0;
-      chunk->models[0].state = AssetState::EMPTY;
-      chunk->models[1].state = AssetState::EMPTY;
-      chunk->models[2].state = AssetState::EMPTY;
-      break;
+
+      item->x = x;
+      item->y = y;
+      item->index = index;
+      return;
     }
+  }
+}
 
-    chunk = chunk->next;
-  } while (chunk);
+void remove_chunk_slot(ChunkCache *cache, u32 x, u32 y) {
+  u32 mask = cache->slots_count - 1;
 
-  return chunk;
+  for (u32 slot = chunk_slot_hash(x, y) & mask;; slot = (slot + 1) & mask) {
+    ChunkSlot *item = cache->slots + slot;
+
+    if (item->index == CHUNK_SLOT_EMPTY) {
+      return;
+    }
+
+    if (item->index != CHUNK_SLOT_TOMBSTONE && item->x == x && item->y == y) {
+      item->index = CHUNK_SLOT_TOMBSTONE;
+      cache->tombstones += 1;
+      return;
+    }
+  }
 }
 
-void generate_ground(Model *model, int chunk_x, int chunk_y, float detail) {
- PROFILE_BLOCK("Generate Ground");
-  int size_x = CHUNK_SIZE_X;
-  int size_y = CHUNK_SIZE_Y;
+// Clears the tombstones by reinserting every resident chunk.
+void rehash_chunk_slots(ChunkCache *cache) {
+  PROFILE_BLOCK("Rehash Chunks");
 
-  int offset_x = chunk_x * size_x;
-  int offset_y = chunk_y * size_y;
+  for (u32 i=0; i<cache->slots_count; i++) {
+    cache->slots[i].index = CHUNK_SLOT_EMPTY;
+  }
+  cache->tombstones = 0;
 
-  int width = size_x * detail + 1;
-  int height = size_y * detail + 1;
+  for (u32 i=0; i<cache->count; i++) {
+    TerrainChunk *chunk = cache->chunks + i;
+    if (chunk->initialized) {
+      insert_chunk_slot(cache, chunk->x, chunk->y, i);
+    }
+  }
+}
 
-  u32 vertices_count = width * height * 3;
-  u32 normals_count = vertices_count;
-  u32 colors_count = vertices_count;
-  u32 indices_count = (width - 1) * (height - 1) * 6;
+// Returns NULL when every chunk in the pool is in use.
+TerrainChunk *get_chunk_at(ChunkCache *cache, u32 x, u32 y) {
+  TerrainChunk *chunk = find_chunk_at(cache, x, y);
 
-  Mesh mesh = {};
-  allocate_mesh(&mesh, vertices_count, normals_count, indices_count, 0, colors_count);
+  if (chunk) {
+    cache->stats.hits += 1;
+  } else {
+    cache->stats.misses += 1;
 
-  u32 vertices_index = 0;
-  u32 colors_index = 0;
-  u32 normals_index = 0;
-  u32 indices_index = 0;
+    if (!cache->free_count) {
+      return NULL;
+    }
 
-  float radius = 0.0f;
+    if (cache->tombstones > cache->slots_count / 4) {
+      rehash_chunk_slots(cache);
+    }
 
-  for (int x=0; x<width; x++) {
-    for (int y=0; y<height; y++) {
-      float x_coord = (float)(x) / detail;
-      float y_coord = (float)(y) / detail;
+    u32 index = cache->free_indices[--cache->free_count];
+    insert_chunk_slot(cache, x, y, index);
 
-      float value = get_terrain_height_at(x_coord + offset_x, y_coord + offset_y);
+    chunk = cache->chunks + index;
+    chunk->x = x;
+    chunk->y = y;
+    chunk->initialized = true;
+    chunk->queued_jobs = 0;
+    chunk->models[0].state = AssetState::EMPTY;
+    chunk->models[1].state = AssetState::EMPTY;
+    chunk->models[2].state = AssetState::EMPTY;
 
-      mesh.data.vertices[vertices_index++] = x_coord;
-      mesh.data.vertices[vertices_index++] = value;
-      mesh.data.vertices[vertices_index++] = y_coord;
+    for (u32 i=0; i<TERRAIN_LOD_COUNT; i++) {
+      chunk->requested_frame[i] = 0;
+    }
+  }
 
-      vec3 color = vec3(0.4392f, 0.4588f, 0.3412f);
+  chunk->last_used_frame = cache->frame;
 
-      if (value < 7.0f) {
-        color = vec3(0.8118f, 0.5686f, 0.3804f);
-      }
+  return chunk;
+}
 
-      mesh.data.colors[colors_index++] = color.r;
-      mesh.data.colors[colors_index++] = color.g;
-      mesh.data.colors[colors_index++] = color.b;
+// Bilinear lookup into the height tile of a resident chunk. Falls back to
+// sampling the noise when the chunk's tile isn't fully filled yet.
+float get_terrain_height(App *app, float x, float y) {
+  int chunk_x = glm::floor(x / (float)CHUNK_SIZE_X);
+  int chunk_y = glm::floor(y / (float)CHUNK_SIZE_Y);
 
-      // TODO(sedivy): calculate center
-      float distance = glm::length(vec3(x_coord, value, y_coord));
-      if (distance > radius) {
-        radius = distance;
-      }
+  if (chunk_x >= 0 && chunk_y >= 0) {
+    TerrainChunk *chunk = find_chunk_at(&app->chunk_cache, chunk_x, chunk_y);
+
+    if (chunk && chunk->heights_stride == 1) {
+      float local_x = (x - chunk_x * CHUNK_SIZE_X) * TERRAIN_TILE_DETAIL;
+      float local_y = (y - chunk_y * CHUNK_SIZE_Y) * TERRAIN_TILE_DETAIL;
+
+      int ix = glm::clamp((int)local_x, 0, TERRAIN_TILE_WIDTH - 2);
+      int iy = glm::clamp((int)local_y, 0, TERRAIN_TILE_HEIGHT - 2);
 
-      mesh.data.normals[normals_index++] = 0.0f;
-      mesh.data.normals[normals_index++] = 0.0f;
-      mesh.data.normals[normals_index++] = 0.0f;
+      float fx = glm::clamp(local_x - ix, 0.0f, 1.0f);
+      float fy = glm::clamp(local_y - iy, 0.0f, 1.0f);
+
+      float *column = chunk->heights + ix * TERRAIN_TILE_HEIGHT + iy;
+      float *next_column = column + TERRAIN_TILE_HEIGHT;
+
+      float a = glm::mix(column[0], column[1], fy);
+      float b = glm::mix(next_column[0], next_column[1], fy);
+
+      return glm::mix(a, b, fx);
     }
   }
 
-  for (int i=0; i<height - 1; i++) {
-    for (int l=0; l<width - 1; l++) {
-      mesh.data.indices[indices_index++] = (height * l + i + 0);
-      mesh.data.indices[indices_index++] = (height * l + i + 1);
-      mesh.data.indices[indices_index++] = (height * l + i + height);
+  return get_terrain_height_at(x, y);
+}
 
-      mesh.data.indices[indices_index++] = (height * l + i + height);
-      mesh.data.indices[indices_index++] = (height * l + i + 1);
-      mesh.data.indices[indices_index++] = (height * l + i + height + 1);
+// Vertices per unit for each LOD, finest first.
+static const float terrain_lod_detail[TERRAIN_LOD_COUNT] = { 3.0f, 1.0f, 0.5f };
+
+inline u32 terrain_lod_size(u32 level) {
+  return CHUNK_SIZE_X * terrain_lod_detail[level] + 1;
+}
+
+inline void push_terrain_triangle(int *indices, u32 *count, u32 height, u32 a, u32 b, u32 c) {
+  int ax = a / height, ay = a % height;
+  int bx = b / height, by = b % height;
+  int cx = c / height, cy = c % height;
+
+  // Keep the winding of the grid triangles in generate_ground.
+  if ((bx - ax) * (cy - ay) - (by - ay) * (cx - ax) > 0) {
+    u32 swap = b;
+    b = c;
+    c = swap;
+  }
+
+  indices[(*count)++] = a;
+  indices[(*count)++] = b;
+  indices[(*count)++] = c;
+}
+
+inline u32 terrain_edge_vertex(u32 edge, u32 size, u32 depth, u32 t) {
+  switch (edge) {
+    case 0: return depth * size + t;
+    case 1: return (size - 1 - depth) * size + t;
+    case 2: return t * size + depth;
+    default: return t * size + (size - 1 - depth);
+  }
+}
+
+// Zips the outer vertex row of an edge to the row one step inside it. With
+// step > 1 the outer row only uses every step-th vertex, which lines up
+// with a coarser neighbour.
+void push_terrain_edge(int *indices, u32 *count, u32 size, u32 edge, u32 step) {
+  u32 outer = 0;
+  u32 inner = 1;
+
+  while (outer < size - 1 || inner < size - 2) {
+    bool advance_outer = inner == size - 2 || (outer < size - 1 && outer + step <= inner + 1);
+
+    u32 a = terrain_edge_vertex(edge, size, 0, outer);
+    u32 b = terrain_edge_vertex(edge, size, 1, inner);
+
+    if (advance_outer) {
+      outer += step;
+      push_terrain_triangle(indices, count, size, a, terrain_edge_vertex(edge, size, 0, outer), b);
+    } else {
+      inner += 1;
+      push_terrain_triangle(indices, count, size, a, terrain_edge_vertex(edge, size, 1, inner), b);
     }
   }
+}
 
-  for (u32 i=0; i<indices_count; i += 3) {
-    int indices_a = mesh.data.indices[i + 0] * 3;
-    int indices_b = mesh.data.indices[i + 1] * 3;
-    int indices_c = mesh.data.indices[i + 2] * 3;
+void initialize_terrain_indices(App *app) {
+  PROFILE_BLOCK("Terrain Indices");
 
-    vec3 v0 = vec3(mesh.data.vertices[indices_a + 0],
-                   mesh.data.vertices[indices_a + 1],
-                   mesh.data.vertices[indices_a + 2]);
+  for (u32 level=0; level<TERRAIN_LOD_COUNT; level++) {
+    TerrainLodIndices *lod = app->terrain_indices + level;
 
-    vec3 v1 = vec3(mesh.data.vertices[indices_b + 0],
-                   mesh.data.vertices[indices_b + 1],
-                   mesh.data.vertices[indices_b + 2]);
+    u32 size = terrain_lod_size(level);
+    u32 cells = size - 1;
 
-    vec3 v2 = vec3(mesh.data.vertices[indices_c + 0],
-                   mesh.data.vertices[indices_c + 1],
-                   mesh.data.vertices[indices_c + 2]);
+    // Interior cells, then every edge variant. Each variant has at most
+    // 2 * cells triangles.
+    u32 max_count = ((cells - 2) * (cells - 2) * 6) + 4 * TERRAIN_LOD_COUNT * cells * 2 * 3;
+    int *indices = (int *)malloc(sizeof(int) * max_count);
+    u32 count = 0;
 
-    vec3 normal = glm::normalize(glm::cross(v2 - v0, v1 - v0));
+    lod->interior.offset = count;
+    for (u32 i=1; i<size - 2; i++) {
+      for (u32 l=1; l<size - 2; l++) {
+        u32 base = size * l + i;
+        push_terrain_triangle(indices, &count, size, base, base + 1, base + size);
+        push_terrain_triangle(indices, &count, size, base + size, base + 1, base + size + 1);
+      }
+    }
+    lod->interior.count = count - lod->interior.offset;
 
-    mesh.data.normals[indices_a + 0] = -normal.x;
-    mesh.data.normals[indices_a + 1] = -normal.y;
-    mesh.data.normals[indices_a + 2] = -normal.z;
+    VertexCacheOptimizer vco;
+    vco.Optimize(indices + lod->interior.offset, lod->interior.count / 3);
 
-    mesh.data.normals[indices_b + 0] = -normal.x;
-    mesh.data.normals[indices_b + 1] = -normal.y;
-    mesh.data.normals[indices_b + 2] = -normal.z;
+    for (u32 edge=0; edge<4; edge++) {
+      TerrainIndexRange range;
+      range.offset = count;
+      push_terrain_edge(indices, &count, size, edge, 1);
+      range.count = count - range.offset;
 
-    mesh.data.normals[indices_c + 0] = -normal.x;
-    mesh.data.normals[indices_c + 1] = -normal.y;
-    mesh.data.normals[indices_c + 2] = -normal.z;
+      for (u32 neighbour=0; neighbour<=level; neighbour++) {
+        lod->edges[edge][neighbour] = range;
+      }
+    }
+
+    lod->full_count = count;
+
+    for (u32 edge=0; edge<4; edge++) {
+      for (u32 neighbour=level + 1; neighbour<TERRAIN_LOD_COUNT; neighbour++) {
+        TerrainIndexRange *range = &lod->edges[edge][neighbour];
+        range->offset = count;
+        push_terrain_edge(indices, &count, size, edge, (u32)(terrain_lod_detail[level] / terrain_lod_detail[neighbour]));
+        range->count = count - range->offset;
+      }
+    }
+
+    assert(count <= max_count);
+
+    glGenBuffers(1, &lod->indices_id);
+    gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, lod->indices_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(GLint), indices, GL_STATIC_DRAW);
+    gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    lod->indices = indices;
+    lod->indices_count = count;
   }
+}
+
+vec3 terrain_vertex_position(Model *model, u32 level, u32 index) {
+  TerrainVertex *vertices = (TerrainVertex *)model->mesh.data.data;
+  u32 size = terrain_lod_size(level);
 
-  for (u32 i=0; i<normals_count / 3; i += 3) {
-    float x = mesh.data.normals[i + 0];
-    float y = mesh.data.normals[i + 1];
-    float z = mesh.data.normals[i + 2];
+  return vec3((float)(index / size) / terrain_lod_detail[level], vertices[index].height, (float)(index % size) / terrain_lod_detail[level]);
+}
 
-    vec3 normal = glm::normalize(vec3(x, y, z));
+inline void octahedral_encode(vec3 normal, s16 *result) {
+  vec2 p = vec2(normal.x, normal.z) / (glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z));
 
-    mesh.data.normals[i + 0] = normal.x;
-    mesh.data.normals[i + 1] = normal.y;
-    mesh.data.normals[i + 2] = normal.z;
+  if (normal.y < 0.0f) {
+    vec2 sign = vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    p = (vec2(1.0f) - vec2(glm::abs(p.y), glm::abs(p.x))) * sign;
   }
 
-  model->id_name = allocate_string("chunk");
-  model->mesh = mesh;
-  model->radius = radius;
+  result[0] = (s16)glm::round(glm::clamp(p.x, -1.0f, 1.0f) * 32767.0f);
+  result[1] = (s16)glm::round(glm::clamp(p.y, -1.0f, 1.0f) * 32767.0f);
+}
+
+inline u32 atomic_increment(u32 volatile *value) {
+  for (;;) {
+    u32 original = *value;
+    if (platform.atomic_exchange(value, original, original + 1)) {
+      return original;
+    }
+  }
 }
 
-struct GenerateGrountWorkData {
+#define TERRAIN_STRIP_ROWS 16
+#define MAX_TERRAIN_STRIPS ((TERRAIN_TILE_WIDTH + TERRAIN_STRIP_ROWS - 1) / TERRAIN_STRIP_ROWS)
+
+// One LOD mesh of a chunk, built in strips of rows by up to one
+// generate_ground_work job per worker. Every job claims strips until
+// none are left. The job finishing the last strip publishes the model and
+// the last job to exit frees the build. Cancelled builds stop claiming
+// strips and are cleaned up by the TerrainStream that started them.
+struct GroundBuild {
   TerrainChunk *chunk;
   int detail_level;
+
+  // Stride of the height tile samples that were filled before the build.
+  u32 filled;
+
+  u32 strips_count;
+  u32 volatile next_strip;
+  u32 volatile strips_done;
+  u32 volatile references;
+  u32 volatile cancelled;
+
+  TerrainVertex *vertices;
+  float strip_radius2[MAX_TERRAIN_STRIPS];
 };
 
+void generate_ground_strip(GroundBuild *build, u32 strip) {
+  PROFILE_BLOCK("Generate Ground Strip");
+
+  TerrainChunk *chunk = build->chunk;
+  float detail = terrain_lod_detail[build->detail_level];
+  u32 stride = TERRAIN_TILE_DETAIL / detail;
+  u32 filled = build->filled;
+
+  int width = terrain_lod_size(build->detail_level);
+  int height = width;
+
+  int begin = strip * TERRAIN_STRIP_ROWS;
+  int end = glm::min(begin + TERRAIN_STRIP_ROWS, width);
+
+  float offset_x = chunk->x * CHUNK_SIZE_X;
+  float offset_y = chunk->y * CHUNK_SIZE_Y;
+
+  float sample_x[TERRAIN_TILE_HEIGHT + 2];
+  float sample_y[TERRAIN_TILE_HEIGHT + 2];
+  float sample_heights[TERRAIN_TILE_HEIGHT + 2];
+  u32 sample_index[TERRAIN_TILE_HEIGHT + 2];
+
+  // Heights of the strip plus one row and column of apron on every side for
+  // the central differences. Rows inside the strip come from the height
+  // tile, the apron is sampled directly since neighbouring rows can belong
+  // to strips that aren't done yet.
+  const int apron_height = TERRAIN_TILE_HEIGHT + 2;
+  float rows[(TERRAIN_STRIP_ROWS + 2) * apron_height];
+
+  for (int x=begin - 1; x<=end; x++) {
+    float x_coord = (float)(x) / detail;
+    float *row = rows + (x - begin + 1) * apron_height;
+
+    u32 count = 0;
+
+    if (x >= begin && x < end) {
+      u32 tile_x = x * stride;
+      float *column = chunk->heights + tile_x * TERRAIN_TILE_HEIGHT;
+
+      if (!filled || filled > stride) {
+        for (int y=0; y<height; y++) {
+          u32 tile_y = y * stride;
+          if (filled && tile_x % filled == 0 && tile_y % filled == 0) {
+            continue;
+          }
+
+          sample_x[count] = x_coord + offset_x;
+          sample_y[count] = (float)(y) / detail + offset_y;
+          sample_index[count] = tile_y;
+          count++;
+        }
+
+        get_terrain_heights(sample_x, sample_y, sample_heights, count);
+
+        for (u32 i=0; i<count; i++) {
+          column[sample_index[i]] = sample_heights[i];
+        }
+      }
+
+      for (int y=0; y<height; y++) {
+        row[y + 1] = column[y * stride];
+      }
+
+      sample_x[0] = x_coord + offset_x;
+      sample_y[0] = (float)(-1) / detail + offset_y;
+      sample_x[1] = x_coord + offset_x;
+      sample_y[1] = (float)(height) / detail + offset_y;
+
+      get_terrain_heights(sample_x, sample_y, sample_heights, 2);
+
+      row[0] = sample_heights[0];
+      row[height + 1] = sample_heights[1];
+    } else {
+      for (int y=-1; y<=height; y++) {
+        sample_x[count] = x_coord + offset_x;
+        sample_y[count] = (float)(y) / detail + offset_y;
+        count++;
+      }
+
+      get_terrain_heights(sample_x, sample_y, row, count);
+    }
+  }
+
+  float radius2 = 0.0f;
+  float spacing = 2.0f / detail;
+
+  for (int x=begin; x<end; x++) {
+    float x_coord = (float)(x) / detail;
+
+    float *previous_row = rows + (x - begin) * apron_height + 1;
+    float *row = previous_row + apron_height;
+    float *next_row = row + apron_height;
+
+    TerrainVertex *vertex = build->vertices + x * height;
+
+    for (int y=0; y<height; y++) {
+      float value = row[y];
+
+      vec3 normal = glm::normalize(vec3(previous_row[y] - next_row[y], spacing, row[y - 1] - row[y + 1]));
+
+      vertex[y].height = value;
+      octahedral_encode(normal, vertex[y].normal);
+
+      // TODO(sedivy): calculate center
+      float distance2 = glm::length2(vec3(x_coord, value, (float)(y) / detail));
+      if (distance2 > radius2) {
+        radius2 = distance2;
+      }
+    }
+  }
+
+  build->strip_radius2[strip] = radius2;
+}
+
+void release_ground_build(GroundBuild *build) {
+  u32 references;
+  do {
+    references = build->references;
+  } while (!platform.atomic_exchange(&build->references, references, references - 1));
+
+  if (references == 1) {
+    free(build);
+  }
+}
+
 void generate_ground_work(void *data) {
-  auto *work = (GenerateGrountWorkData*)(data);
+  PROFILE_BLOCK("Generate Ground");
 
-  TerrainChunk *chunk = work->chunk;
+  GroundBuild *build = (GroundBuild *)data;
 
-  Model *model = chunk->models + work->detail_level;
+  while (!build->cancelled) {
+    u32 strip = atomic_increment(&build->next_strip);
+    if (strip >= build->strips_count) {
+      break;
+    }
+
+    generate_ground_strip(build, strip);
 
-  if (platform.atomic_exchange(&model->state, AssetState::EMPTY, AssetState::PROCESSING)) {
-    float resolution = 0.0f;
-    if (work->detail_level == 0) {
-      resolution = 3.0f;
-    } else if (work->detail_level == 1) {
-      resolution = 1.0f;
-    } else if (work->detail_level == 2) {
-      resolution = 0.5f;
+    if (atomic_increment(&build->strips_done) + 1 == build->strips_count) {
+      TerrainChunk *chunk = build->chunk;
+      Model *model = chunk->models + build->detail_level;
+
+      u32 stride = TERRAIN_TILE_DETAIL / terrain_lod_detail[build->detail_level];
+      if (!build->filled || build->filled > stride) {
+        chunk->heights_stride = stride;
+      }
+
+      float radius2 = 0.0f;
+      for (u32 i=0; i<build->strips_count; i++) {
+        radius2 = glm::max(radius2, build->strip_radius2[i]);
+      }
+
+      u32 size = terrain_lod_size(build->detail_level);
+
+      Mesh mesh = {};
+      mesh.data.data = build->vertices;
+      mesh.data.vertices_count = size * size;
+
+      model->id_name = "chunk";
+      model->mesh = mesh;
+      model->radius = glm::sqrt(radius2);
+
+      model->state = AssetState::HAS_DATA;
     }
+  }
+
+  release_ground_build(build);
+}
+
+bool is_chunk_busy(TerrainChunk *chunk) {
+  for (u32 i=0; i<array_count(chunk->models); i++) {
+    // The upload queue holds a pointer to the model.
+    if (chunk->models[i].state == AssetState::UPLOADING) {
+      return true;
+    }
+
+    if (chunk->queued_jobs & (1 << i)) {
+      u32 state = chunk->models[i].state;
+      if (state == AssetState::EMPTY || state == AssetState::PROCESSING) {
+        return true;
+      }
+    }
+  }
 
-    generate_ground(model, chunk->x, chunk->y, resolution);
+  return false;
+}
+
+void request_terrain_model(TerrainStream *stream, TerrainChunk *chunk, int detail_level, float weight) {
+  if (chunk->requested_frame[detail_level] == stream->frame) {
+    return;
+  }
 
-    optimize_model(model);
+  chunk->requested_frame[detail_level] = stream->frame;
 
-    model->state = AssetState::HAS_DATA;
+  if (stream->requests_count == MAX_TERRAIN_REQUESTS) {
+    return;
   }
 
-  free(work);
+  vec2 offset = vec2(chunk->x + 0.5f, chunk->y + 0.5f) - stream->camera_position;
+  float distance = glm::length(offset);
+
+  // 1x straight ahead, 2x behind the camera.
+  float facing = distance > 0.5f ? glm::dot(offset / distance, stream->camera_direction) : 1.0f;
+
+  TerrainRequest *request = stream->requests + stream->requests_count++;
+  request->chunk = chunk;
+  request->detail_level = detail_level;
+  request->score = distance * (1.5f - 0.5f * facing) * weight;
 }
 
-inline bool process_terrain(Memory *memory, TerrainChunk *chunk, int detail_level) {
+inline bool process_terrain(App *app, TerrainChunk *chunk, int detail_level) {
   Model *model = chunk->models + detail_level;
 
   if (model->state == AssetState::INITIALIZED) {
@@ -210,28 +638,21 @@ inline bool process_terrain(Memory *memory, TerrainChunk *chunk, int detail_leve
   }
 
   if (model->state == AssetState::HAS_DATA) {
-    initialize_model(model);
+    if (queue_upload(&app->uploads, UploadType::TERRAIN, model, &model->state)) {
+      chunk->queued_jobs &= ~(1 << detail_level);
+    }
     return true;
   }
 
-  if (platform.queue_has_free_spot(memory->main_queue)) {
-    if (model->state == AssetState::EMPTY) {
-      auto *work = (GenerateGrountWorkData*)(malloc(sizeof(GenerateGrountWorkData)));
-      work->chunk = chunk;
-      work->detail_level = detail_level;
-
-      platform.add_work(memory->main_queue, generate_ground_work, work);
-
-      return true;
-    }
-  }
+  // NOTE: requested while processing as well, builds that stop being
+  // requested get cancelled.
+  request_terrain_model(&app->terrain_stream, chunk, detail_level, 1.0f);
 
   return true;
 }
 
-
-Model *chunk_get_model(Memory *memory, TerrainChunk *chunk, int detail_level) {
-  if (process_terrain(memory, chunk, detail_level)) {
+Model *chunk_get_model(App *app, TerrainChunk *chunk, int detail_level) {
+  if (process_terrain(app, chunk, detail_level)) {
     for (u32 i=0; i<array_count(chunk->models); i++) {
       Model *model = chunk->models + i;
       if (model->state == AssetState::INITIALIZED) {
@@ -244,32 +665,291 @@ Model *chunk_get_model(Memory *memory, TerrainChunk *chunk, int detail_level) {
   return chunk->models + detail_level;
 }
 
-void render_terrain_chunk(App *app, TerrainChunk *chunk, Model *model) {
+// NOTE: one build per chunk at a time, builds of different LODs would
+// fill the same height tile samples. The caller keeps the returned
+// reference.
+GroundBuild *start_ground_build(Memory *memory, TerrainChunk *chunk, int detail_level) {
+  Model *model = chunk->models + detail_level;
+
+  if (!chunk->heights) {
+    chunk->heights = (float *)malloc(sizeof(float) * TERRAIN_TILE_WIDTH * TERRAIN_TILE_HEIGHT);
+  }
+
+  u32 size = terrain_lod_size(detail_level);
+
+  GroundBuild *build = (GroundBuild *)malloc(sizeof(GroundBuild));
+  build->chunk = chunk;
+  build->detail_level = detail_level;
+  build->filled = chunk->heights_stride;
+  build->strips_count = (size + TERRAIN_STRIP_ROWS - 1) / TERRAIN_STRIP_ROWS;
+  build->next_strip = 0;
+  build->strips_done = 0;
+  build->references = 1;
+  build->cancelled = 0;
+  build->vertices = (TerrainVertex *)malloc(sizeof(TerrainVertex) * size * size);
+
+  model->state = AssetState::PROCESSING;
+  chunk->queued_jobs |= 1 << detail_level;
+
+  u32 jobs_count = glm::min(build->strips_count, platform.get_worker_count(memory->jobs));
+  for (u32 i=0; i<jobs_count; i++) {
+    atomic_increment(&build->references);
+    platform.add_work(memory->jobs, JobPriority::HIGH, generate_ground_work, build, NULL);
+  }
+
+  return build;
+}
+
+void initialize_terrain_stream(TerrainStream *stream) {
+  stream->frame = 1;
+  stream->requests_count = 0;
+  stream->builds_count = 0;
+  stream->settling = false;
+  stream->settle_start = 0.0f;
+  stream->stats = {};
+}
+
+void begin_terrain_stream(TerrainStream *stream, WorldPosition position, vec3 forward) {
+  stream->frame += 1;
+  stream->requests_count = 0;
+
+  stream->camera_position = vec2(position.chunk_x + position.offset_.x / CHUNK_SIZE_X, position.chunk_y + position.offset_.z / CHUNK_SIZE_Y);
+
+  vec2 direction = vec2(forward.x, forward.z);
+  float length = glm::length(direction);
+  stream->camera_direction = length > 0.0001f ? direction / length : vec2(0.0f);
+}
+
+struct TerrainRequestSort {
+  bool operator()(const TerrainRequest &a, const TerrainRequest &b) const {
+    return a.score < b.score;
+  }
+};
+
+// Called once per frame after every request was made. Cleans up finished
+// and cancelled builds, cancels builds nobody wants anymore and starts the
+// best scored requests while fewer than two builds per worker are running.
+void update_terrain_stream(Memory *memory, TerrainStream *stream, u32 pending_visible, float time) {
+  PROFILE_BLOCK("Update Terrain Stream", stream->requests_count);
+
+  for (u32 i=0; i<stream->builds_count;) {
+    GroundBuild *build = stream->builds[i];
+    TerrainChunk *chunk = build->chunk;
+    int detail_level = build->detail_level;
+
+    // Only our reference is left, every job exited.
+    if (build->references == 1) {
+      if (build->strips_done != build->strips_count) {
+        // NOTE: the height tile keeps its old stride, samples the build did
+        // fill hold the same heights the next build would write.
+        free(build->vertices);
+        chunk->models[detail_level].state = AssetState::EMPTY;
+        chunk->queued_jobs &= ~(1 << detail_level);
+        stream->stats.cancelled += 1;
+      }
+
+      release_ground_build(build);
+      stream->builds[i] = stream->builds[--stream->builds_count];
+      continue;
+    }
+
+    if (!build->cancelled && stream->frame - chunk->requested_frame[detail_level] > TERRAIN_CANCEL_FRAMES) {
+      build->cancelled = 1;
+    }
+
+    i++;
+  }
+
+  std::sort(stream->requests, stream->requests + stream->requests_count, TerrainRequestSort());
+
+  u32 max_builds = glm::min((u32)MAX_TERRAIN_BUILDS, platform.get_worker_count(memory->jobs) * 2);
+
+  for (u32 i=0; i<stream->requests_count && stream->builds_count < max_builds; i++) {
+    TerrainRequest *request = stream->requests + i;
+
+    if (request->chunk->models[request->detail_level].state != AssetState::EMPTY || is_chunk_busy(request->chunk)) {
+      continue;
+    }
+
+    stream->builds[stream->builds_count++] = start_ground_build(memory, request->chunk, request->detail_level);
+    stream->stats.issued += 1;
+  }
+
+  if (pending_visible && !stream->settling) {
+    stream->settling = true;
+    stream->settle_start = time;
+  } else if (!pending_visible && stream->settling) {
+    stream->settling = false;
+    stream->stats.settle_time = time - stream->settle_start;
+  }
+
+  stream->stats.requests = stream->requests_count;
+  stream->stats.in_flight = stream->builds_count;
+  stream->stats.pending_visible = pending_visible;
+}
+
+void render_terrain_chunk(App *app, TerrainChunk *chunk, Model *model, int detail_level, int *neighbour_levels) {
   mat4 model_view;
   model_view = glm::translate(model_view, vec3(chunk->x * CHUNK_SIZE_X, 0.0f, chunk->y * CHUNK_SIZE_Y));
 
   mat3 normal = glm::inverseTranspose(mat3(model_view));
 
-  if (shader_has_uniform(app->current_program, "uNMatrix")) {
-    set_uniform(app->current_program, "uNMatrix", normal);
+  if (shader_has_uniform(app->current_program, Uniform::N_MATRIX)) {
+    set_uniform(app->current_program, Uniform::N_MATRIX, normal);
   }
 
-  if (shader_has_uniform(app->current_program, "uMVMatrix")) {
-    set_uniform(app->current_program, "uMVMatrix", model_view);
+  if (shader_has_uniform(app->current_program, Uniform::MV_MATRIX)) {
+    set_uniform(app->current_program, Uniform::MV_MATRIX, model_view);
   }
 
-  if (shader_has_uniform(app->current_program, "in_color")) {
-    set_uniform(app->current_program, "in_color", vec4(0.0f, 0.3f, 0.1f, 1.0f));
+  if (shader_has_uniform(app->current_program, Uniform::IN_COLOR)) {
+    set_uniform(app->current_program, Uniform::IN_COLOR, vec4(0.0f, 0.3f, 0.1f, 1.0f));
+  }
+
+  TerrainLodIndices *lod = app->terrain_indices + detail_level;
+
+  GLsizei counts[5];
+  const void *offsets[5];
+
+  counts[0] = lod->interior.count;
+  offsets[0] = (void *)(lod->interior.offset * sizeof(GLint));
+
+  for (u32 edge=0; edge<4; edge++) {
+    TerrainIndexRange *range = &lod->edges[edge][neighbour_levels[edge]];
+    counts[edge + 1] = range->count;
+    offsets[edge + 1] = (void *)(range->offset * sizeof(GLint));
   }
 
-  use_model_mesh(app, &model->mesh);
-  glDrawElements(GL_TRIANGLES, model->mesh.data.indices_count, GL_UNSIGNED_INT, 0);
+  set_uniformi(app->current_program, Uniform::GRID_SIZE, terrain_lod_size(detail_level));
+  set_uniformf(app->current_program, Uniform::GRID_DETAIL, terrain_lod_detail[detail_level]);
+
+  gl_bind_buffer(GL_ARRAY_BUFFER, model->mesh.buffer);
+  gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::HEIGHT), 1, GL_FLOAT, GL_FALSE, sizeof(TerrainVertex), (void *)offsetof(TerrainVertex, height));
+
+  // NOTE: the depth-only terrain program reads just the height
+  if (shader_has_attribute(app->current_program, Attribute::NORMAL)) {
+    gl_vertex_attrib_pointer(shader_get_attribute_location(app->current_program, Attribute::NORMAL), 2, GL_SHORT, GL_TRUE, sizeof(TerrainVertex), (void *)offsetof(TerrainVertex, normal));
+  }
+
+  gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, lod->indices_id);
+  glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, array_count(counts));
 }
 
 void rebuild_chunks(App *app) {
-  PROFILE_BLOCK("Unload Chunk", app->chunk_cache_count);
-  for (u32 i=0; i<app->chunk_cache_count; i++) {
-    TerrainChunk *chunk = app->chunk_cache + i;
-    unload_chunk(chunk);
+  ChunkCache *cache = &app->chunk_cache;
+
+  PROFILE_BLOCK("Unload Chunk", cache->count);
+  for (u32 i=0; i<cache->count; i++) {
+    TerrainChunk *chunk = cache->chunks + i;
+    if (chunk->initialized && !is_chunk_busy(chunk)) {
+      unload_chunk(chunk);
+    }
+  }
+}
+
+void get_chunk_memory_usage(TerrainChunk *chunk, u64 *cpu_bytes, u64 *gpu_bytes) {
+  for (u32 i=0; i<array_count(chunk->models); i++) {
+    Model *model = chunk->models + i;
+
+    if (model->state == AssetState::HAS_DATA || model->state == AssetState::UPLOADING || model->state == AssetState::INITIALIZED) {
+      u64 size = model->mesh.data.vertices_count * sizeof(TerrainVertex);
+
+      *cpu_bytes += size;
+      if (model->state == AssetState::INITIALIZED) {
+        *gpu_bytes += size;
+      }
+    }
+  }
+
+  if (chunk->heights) {
+    *cpu_bytes += sizeof(float) * TERRAIN_TILE_WIDTH * TERRAIN_TILE_HEIGHT;
+  }
+}
+
+void evict_chunk(ChunkCache *cache, u32 index) {
+  TerrainChunk *chunk = cache->chunks + index;
+
+  unload_chunk(chunk);
+  remove_chunk_slot(cache, chunk->x, chunk->y);
+
+  chunk->initialized = false;
+  cache->free_indices[cache->free_count++] = index;
+  cache->stats.evictions += 1;
+}
+
+struct ChunkEvictionSort {
+  ChunkCache *cache;
+  int camera_x;
+  int camera_y;
+
+  bool operator()(u32 a, u32 b) const {
+    TerrainChunk *chunk_a = cache->chunks + a;
+    TerrainChunk *chunk_b = cache->chunks + b;
+
+    int ax = chunk_a->x - camera_x;
+    int ay = chunk_a->y - camera_y;
+    int bx = chunk_b->x - camera_x;
+    int by = chunk_b->y - camera_y;
+
+    int distance_a = ax * ax + ay * ay;
+    int distance_b = bx * bx + by * by;
+
+    if (distance_a != distance_b) {
+      return distance_a > distance_b;
+    }
+
+    return chunk_a->last_used_frame < chunk_b->last_used_frame;
   }
+};
+
+// Called once per frame after the terrain was drawn. Chunks touched this
+// frame are kept, the rest are evicted farthest from the camera first until
+// the pool has room for a full view and memory is within budget.
+void update_chunk_cache(ChunkCache *cache, int camera_x, int camera_y, u32 reserve) {
+  PROFILE_BLOCK("Update Chunk Cache");
+
+  u64 cpu_bytes = 0;
+  u64 gpu_bytes = 0;
+  u32 candidates_count = 0;
+
+  for (u32 i=0; i<cache->count; i++) {
+    TerrainChunk *chunk = cache->chunks + i;
+    if (!chunk->initialized) { continue; }
+
+    get_chunk_memory_usage(chunk, &cpu_bytes, &gpu_bytes);
+
+    if (chunk->last_used_frame != cache->frame && !is_chunk_busy(chunk)) {
+      cache->eviction_candidates[candidates_count++] = i;
+    }
+  }
+
+  u64 budget = (u64)(cache->memory_budget * Megabytes(1));
+
+  if (cpu_bytes + gpu_bytes > budget || cache->free_count < reserve) {
+    ChunkEvictionSort sort = { cache, camera_x, camera_y };
+    std::sort(cache->eviction_candidates, cache->eviction_candidates + candidates_count, sort);
+
+    for (u32 i=0; i<candidates_count; i++) {
+      if (cpu_bytes + gpu_bytes <= budget && cache->free_count >= reserve) {
+        break;
+      }
+
+      u32 index = cache->eviction_candidates[i];
+
+      u64 chunk_cpu_bytes = 0;
+      u64 chunk_gpu_bytes = 0;
+      get_chunk_memory_usage(cache->chunks + index, &chunk_cpu_bytes, &chunk_gpu_bytes);
+
+      evict_chunk(cache, index);
+
+      cpu_bytes -= chunk_cpu_bytes;
+      gpu_bytes -= chunk_gpu_bytes;
+    }
+  }
+
+  cache->stats.resident = cache->count - cache->free_count;
+  cache->stats.cpu_bytes = cpu_bytes;
+  cache->stats.gpu_bytes = gpu_bytes;
+
+  cache->frame += 1;
 }
@@ -3,15 +3,168 @@
 #define CHUNK_SIZE_X 50
 #define CHUNK_SIZE_Y 50
 
+// Heights for all LODs of a chunk are sampled from one tile at the finest
+// detail. Coarser LODs read every 3rd or 6th sample.
+#define TERRAIN_TILE_DETAIL 3
+#define TERRAIN_TILE_WIDTH (CHUNK_SIZE_X * TERRAIN_TILE_DETAIL + 1)
+#define TERRAIN_TILE_HEIGHT (CHUNK_SIZE_Y * TERRAIN_TILE_DETAIL + 1)
+
+#define TERRAIN_LOD_COUNT 3
+
+// Cells per side of the grid a chunk is drawn with into the occlusion
+// buffer, has to divide the tile into whole cells of every LOD.
+#define TERRAIN_OCCLUDER_CELLS 5
+
+// X and Z come from gl_VertexID in terrain.vert, the normal is octahedral
+// encoded. Terrain models keep an array of these in mesh.data.data with
+// mesh.data.vertices_count entries.
+struct TerrainVertex {
+  float height;
+  s16 normal[2];
+};
+
+struct TerrainIndexRange {
+  u32 offset;
+  u32 count;
+};
+
+// Index buffer shared by every chunk drawn at one LOD. The outer ring of
+// cells is split into four edge strips. edges[edge][level] is the strip to
+// draw when the neighbour on that edge is drawn at the given LOD, stitched
+// to the neighbour's vertices when it is coarser. Edges are in order
+// x min, x max, y min, y max.
+//
+// The first full_count indices are the unstitched grid.
+struct TerrainLodIndices {
+  GLuint indices_id;
+
+  int *indices;
+  u32 indices_count;
+  u32 full_count;
+
+  TerrainIndexRange interior;
+  TerrainIndexRange edges[4][TERRAIN_LOD_COUNT];
+};
+
 struct TerrainChunk {
   u32 x;
   u32 y;
 
-  Model models[3];
+  Model models[TERRAIN_LOD_COUNT];
+
+  // heights_stride is the step between filled samples, 0 when the tile
+  // is empty and 1 when every sample is filled. Only one mesh build at a
+  // time writes to the tile.
+  float *heights;
+  u32 volatile heights_stride;
+
+  // See update_chunk_occluder, built from the tile at occluder_stride and
+  // rebuilt when the tile gets finer. 0 when not built.
+  float occluder_heights[(TERRAIN_OCCLUDER_CELLS + 1) * (TERRAIN_OCCLUDER_CELLS + 1)];
+  u32 occluder_stride;
 
   bool initialized;
 
-  TerrainChunk *prev;
-  TerrainChunk *next;
+  // Bit per LOD set while a generate job holds a pointer to the chunk.
+  // Chunks with pending jobs are never evicted.
+  u8 queued_jobs;
+  u32 last_used_frame;
+
+  // TerrainStream frame in which each LOD was last requested.
+  u32 requested_frame[TERRAIN_LOD_COUNT];
 };
 
+#define CHUNK_SLOT_EMPTY 0xFFFFFFFF
+#define CHUNK_SLOT_TOMBSTONE 0xFFFFFFFE
+
+struct ChunkSlot {
+  u32 x;
+  u32 y;
+  u32 index;
+};
+
+struct ChunkCacheStats {
+  u32 hits;
+  u32 misses;
+  u32 evictions;
+  u32 resident;
+
+  u64 cpu_bytes;
+  u64 gpu_bytes;
+};
+
+// Chunks live in a fixed pool and are found through an open-addressed
+// table of slots. Chunks the camera left are evicted, farthest first,
+// once the pool runs low or the meshes go over memory_budget.
+struct ChunkCache {
+  TerrainChunk *chunks;
+  u32 count;
+
+  u32 *free_indices;
+  u32 free_count;
+
+  ChunkSlot *slots;
+  u32 slots_count;
+  u32 tombstones;
+
+  u32 *eviction_candidates;
+
+  // In megabytes, CPU and GL memory together.
+  float memory_budget;
+
+  u32 frame;
+  ChunkCacheStats stats;
+};
+
+
+#define MAX_TERRAIN_REQUESTS 256
+#define MAX_TERRAIN_BUILDS 64
+
+// Builds that weren't requested for this many frames are cancelled.
+#define TERRAIN_CANCEL_FRAMES 8
+
+// Seconds of follow entity movement whose chunks are prefetched.
+#define TERRAIN_PREFETCH_SECONDS 1.5f
+
+struct GroundBuild;
+
+struct TerrainRequest {
+  TerrainChunk *chunk;
+  int detail_level;
+  float score;
+};
+
+struct TerrainStreamStats {
+  u32 requests;
+  u32 in_flight;
+  u32 issued;
+  u32 cancelled;
+
+  // Visible chunks not drawn at the LOD they asked for, and how long it
+  // took the last time until there were none.
+  u32 pending_visible;
+  float settle_time;
+};
+
+// LOD meshes asked for by the renderer are collected every frame and
+// built lowest score first, the score being the distance to the camera
+// weighted by how far the chunk is off the view direction. Builds nobody
+// asked for in a while are cancelled.
+struct TerrainStream {
+  u32 frame;
+
+  // In chunks.
+  vec2 camera_position;
+  vec2 camera_direction;
+
+  TerrainRequest requests[MAX_TERRAIN_REQUESTS];
+  u32 requests_count;
+
+  GroundBuild *builds[MAX_TERRAIN_BUILDS];
+  u32 builds_count;
+
+  bool settling;
+  float settle_start;
+
+  TerrainStreamStats stats;
+};
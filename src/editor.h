@@ -40,6 +40,7 @@ struct Editor {
   bool show_performance = false;
 
   bool show_camera_frustum = false;
+  bool show_occlusion_buffer = false;
 
   bool experimental_terrain_entity_movement = false;
 
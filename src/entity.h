@@ -14,7 +14,8 @@ namespace EntityFlags {
     RENDER_WIREFRAME = (1 << 4),
     RENDER_IGNORE_DEPTH = (1 << 5),
     HIDE_IN_EDITOR = (1 << 6),
-    LOOK_AT_CAMERA = (1 << 7)
+    LOOK_AT_CAMERA = (1 << 7),
+    OCCLUDER = (1 << 8)
   };
 };
 
@@ -57,6 +58,15 @@ struct EntityParticleEmitter {
   vec4 initial_color = vec4(1.0);
   float particle_size = 10.0f;
   float gravity = 500.0f;
+
+  // Particles per second, their lifetime in seconds and how many can be
+  // alive at once.
+  float spawn_rate = 60.0f;
+  float lifetime = 2.0f;
+  u32 max_particles = 256;
+
+  // Slice in app->particles, only a hint checked against the id.
+  u32 particle_slice = 0;
 };
 
 struct EntityGrass {
@@ -76,9 +86,7 @@ struct EntityGrass {
   vec3 *rotations;
   vec3 *tints;
 
-  GLuint position_data_id;
-
-  bool initialized;
+  // Set when the positions were regenerated, see update_grass_field.
   bool reload_data;
   bool render;
 };
@@ -0,0 +1,151 @@
+void reset_gl_state(GLState *state) {
+  state->program = GL_STATE_UNKNOWN;
+  state->vertex_array = GL_STATE_UNKNOWN;
+  state->array_buffer = GL_STATE_UNKNOWN;
+  state->element_array_buffer = GL_STATE_UNKNOWN;
+  state->active_texture = GL_STATE_UNKNOWN;
+
+  for (u32 i=0; i<GL_STATE_TEXTURE_UNITS; i++) {
+    state->textures[i][0] = GL_STATE_UNKNOWN;
+    state->textures[i][1] = GL_STATE_UNKNOWN;
+  }
+
+  state->polygon_mode = GL_STATE_UNKNOWN;
+  state->depth_func = GL_STATE_UNKNOWN;
+  state->cull_face = GL_STATE_UNKNOWN;
+}
+
+// Called at the start of every frame.
+void begin_gl_state_frame(GLState *state) {
+  state->last_stats = state->stats;
+  state->stats = {};
+}
+
+inline bool gl_state_changed(GLuint *current, GLuint value) {
+  if (*current == value) {
+    gl_state->stats.elided += 1;
+    return false;
+  }
+
+  *current = value;
+  gl_state->stats.issued += 1;
+  return true;
+}
+
+inline void gl_use_program(GLuint program) {
+  if (gl_state_changed(&gl_state->program, program)) {
+    glUseProgram(program);
+  }
+}
+
+inline void gl_bind_vertex_array(GLuint vertex_array) {
+  if (gl_state_changed(&gl_state->vertex_array, vertex_array)) {
+    glBindVertexArray(vertex_array);
+    gl_state->element_array_buffer = GL_STATE_UNKNOWN;
+  }
+}
+
+// Drops the tracked binding of a deleted vertex array, GL unbinds it.
+inline void gl_forget_vertex_array(GLuint vertex_array) {
+  if (gl_state->vertex_array == vertex_array) {
+    gl_state->vertex_array = GL_STATE_UNKNOWN;
+    gl_state->element_array_buffer = GL_STATE_UNKNOWN;
+  }
+}
+
+inline void gl_bind_buffer(GLenum target, GLuint buffer) {
+  GLuint *current = NULL;
+
+  if (target == GL_ARRAY_BUFFER) {
+    current = &gl_state->array_buffer;
+  } else if (target == GL_ELEMENT_ARRAY_BUFFER) {
+    current = &gl_state->element_array_buffer;
+  }
+
+  if (!current) {
+    gl_state->stats.issued += 1;
+    glBindBuffer(target, buffer);
+  } else if (gl_state_changed(current, buffer)) {
+    glBindBuffer(target, buffer);
+  }
+}
+
+// Drops the tracked binding of a deleted buffer, GL unbinds it.
+inline void gl_forget_buffer(GLuint buffer) {
+  if (gl_state->array_buffer == buffer) {
+    gl_state->array_buffer = GL_STATE_UNKNOWN;
+  }
+
+  if (gl_state->element_array_buffer == buffer) {
+    gl_state->element_array_buffer = GL_STATE_UNKNOWN;
+  }
+}
+
+inline void gl_active_texture(GLenum unit) {
+  if (gl_state_changed(&gl_state->active_texture, unit)) {
+    glActiveTexture(unit);
+  }
+}
+
+inline void gl_bind_texture(GLenum target, GLuint texture) {
+  u32 unit = gl_state->active_texture - GL_TEXTURE0;
+
+  int index = -1;
+  if (target == GL_TEXTURE_2D) {
+    index = 0;
+  } else if (target == GL_TEXTURE_CUBE_MAP) {
+    index = 1;
+  }
+
+  if (index == -1 || gl_state->active_texture == GL_STATE_UNKNOWN || unit >= GL_STATE_TEXTURE_UNITS) {
+    gl_state->stats.issued += 1;
+    glBindTexture(target, texture);
+
+    if (index != -1 && unit < GL_STATE_TEXTURE_UNITS) {
+      gl_state->textures[unit][index] = texture;
+    }
+  } else if (gl_state_changed(&gl_state->textures[unit][index], texture)) {
+    glBindTexture(target, texture);
+  }
+}
+
+// Drops the tracked bindings of a deleted texture, GL unbinds it.
+inline void gl_forget_texture(GLuint texture) {
+  for (u32 i=0; i<GL_STATE_TEXTURE_UNITS; i++) {
+    for (u32 l=0; l<2; l++) {
+      if (gl_state->textures[i][l] == texture) {
+        gl_state->textures[i][l] = GL_STATE_UNKNOWN;
+      }
+    }
+  }
+}
+
+inline void gl_polygon_mode(GLenum mode) {
+  if (gl_state_changed(&gl_state->polygon_mode, mode)) {
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+  }
+}
+
+inline void gl_depth_func(GLenum func) {
+  if (gl_state_changed(&gl_state->depth_func, func)) {
+    glDepthFunc(func);
+  }
+}
+
+inline void gl_cull_face(GLenum mode) {
+  if (gl_state_changed(&gl_state->cull_face, mode)) {
+    glCullFace(mode);
+  }
+}
+
+// Attribute state lives in the bound vertex array and isn't shadowed, these
+// only count the calls.
+inline void gl_vertex_attrib_pointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) {
+  gl_state->stats.issued += 1;
+  glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+inline void gl_vertex_attrib_divisor(GLuint index, GLuint divisor) {
+  gl_state->stats.issued += 1;
+  glVertexAttribDivisor(index, divisor);
+}
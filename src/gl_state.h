@@ -0,0 +1,36 @@
+#pragma once
+
+#define GL_STATE_TEXTURE_UNITS 8
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+
+struct GLStateStats {
+  u32 issued;
+  u32 elided;
+
+  u32 draws;
+  u32 instances;
+};
+
+// Shadow of the GL state set through the gl_* wrappers in gl_state.cpp.
+// Calls that wouldn't change anything are dropped. GL_STATE_UNKNOWN means
+// the next call always goes through.
+struct GLState {
+  GLuint program;
+  GLuint vertex_array;
+  GLuint array_buffer;
+
+  // Part of the vertex array state, forgotten when the vertex array changes.
+  GLuint element_array_buffer;
+
+  GLuint active_texture;
+
+  // 2D and cube map binding of every unit.
+  GLuint textures[GL_STATE_TEXTURE_UNITS][2];
+
+  GLenum polygon_mode;
+  GLenum depth_func;
+  GLenum cull_face;
+
+  GLStateStats stats;
+  GLStateStats last_stats;
+};
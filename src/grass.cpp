@@ -0,0 +1,280 @@
+inline float get_distance_to_box(vec3 position, Box box) {
+  return glm::distance(position, glm::clamp(position, box.min, box.max));
+}
+
+u32 find_grass_cell(GrassField *field, s32 x, s32 y, Model *model, Texture *texture, u32 hint) {
+  if (hint < field->cells.size) {
+    GrassCell *cell = &field->cells[hint];
+    if (cell->x == x && cell->y == y && cell->model == model && cell->texture == texture) { return hint; }
+  }
+
+  for (u32 i=0; i<field->cells.size; i++) {
+    GrassCell *cell = &field->cells[i];
+    if (cell->x == x && cell->y == y && cell->model == model && cell->texture == texture) { return i; }
+  }
+
+  GrassCell cell = {};
+  cell.x = x;
+  cell.y = y;
+  cell.model = model;
+  cell.texture = texture;
+  cell.dirty = true;
+
+  array::push_back(field->cells, cell);
+  return field->cells.size - 1;
+}
+
+// Buckets the instances of every ready group into cells, shuffles each cell
+// and hands the buffers of cells that still exist over to the new ones.
+void rebuild_grass_field(App *app, GrassField *field) {
+  PROFILE_BLOCK("Rebuild Grass");
+
+  array::clear(field->previous_cells);
+  for (u32 i=0; i<field->cells.size; i++) {
+    array::push_back(field->previous_cells, field->cells[i]);
+  }
+
+  array::clear(field->cells);
+  array::clear(field->instance_cells);
+
+  u32 hint = 0;
+
+  for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
+    if (it->header.type != EntityType::EntityGrass) { continue; }
+
+    EntityGrass *grass = (EntityGrass *)it;
+    if (!grass->render) { continue; }
+
+    for (u32 i=0; i<grass->grass_count; i++) {
+      s32 x = (s32)glm::floor(grass->positions[i].x / (float)CHUNK_SIZE_X);
+      s32 y = (s32)glm::floor(grass->positions[i].z / (float)CHUNK_SIZE_Y);
+
+      hint = find_grass_cell(field, x, y, grass->grass_model, grass->texture, hint);
+      field->cells[hint].count += 1;
+
+      array::push_back(field->instance_cells, hint);
+    }
+  }
+
+  u32 offset = 0;
+  for (u32 i=0; i<field->cells.size; i++) {
+    field->cells[i].first = offset;
+    offset += field->cells[i].count;
+    field->cells[i].count = 0;
+  }
+
+  array::resize(field->instances, offset);
+
+  u32 instance = 0;
+
+  for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
+    if (it->header.type != EntityType::EntityGrass) { continue; }
+
+    EntityGrass *grass = (EntityGrass *)it;
+    if (!grass->render) { continue; }
+
+    for (u32 i=0; i<grass->grass_count; i++) {
+      GrassCell *cell = &field->cells[field->instance_cells[instance++]];
+
+      GrassInstance *result = &field->instances[cell->first + cell->count++];
+      result->position = grass->positions[i];
+      result->rotation = grass->rotations[i];
+      result->tint = grass->tints[i];
+    }
+  }
+
+  for (u32 c=0; c<field->cells.size; c++) {
+    GrassCell *cell = &field->cells[c];
+    GrassInstance *instances = &field->instances[cell->first];
+
+    for (u32 i=cell->count - 1; i>0; i--) {
+      std::swap(instances[i], instances[rand() % (i + 1)]);
+    }
+
+    // NOTE: the scale is the height of the blade at most
+    cell->bounds.min = vec3(instances[0].position);
+    cell->bounds.max = vec3(instances[0].position);
+
+    for (u32 i=0; i<cell->count; i++) {
+      vec3 position = vec3(instances[i].position);
+      cell->bounds.min = glm::min(cell->bounds.min, position - instances[i].position.w);
+      cell->bounds.max = glm::max(cell->bounds.max, position + instances[i].position.w);
+    }
+
+    for (u32 i=0; i<field->previous_cells.size; i++) {
+      GrassCell *previous = &field->previous_cells[i];
+
+      if (previous->buffer && previous->x == cell->x && previous->y == cell->y && previous->model == cell->model && previous->texture == cell->texture) {
+        cell->buffer = previous->buffer;
+        previous->buffer = 0;
+        break;
+      }
+    }
+  }
+
+  for (u32 i=0; i<field->previous_cells.size; i++) {
+    GrassCell *previous = &field->previous_cells[i];
+
+    if (previous->buffer) {
+      gl_forget_buffer(previous->buffer);
+      glDeleteBuffers(1, &previous->buffer);
+    }
+  }
+}
+
+// Rebuilds the cells when a group was regenerated, added or removed and
+// streams cell buffers in and out around the camera.
+void update_grass_field(App *app, GrassField *field, vec3 camera_position) {
+  PROFILE_BLOCK("Update Grass");
+
+  field->stats = {};
+
+  bool changed = false;
+  u32 group_count = 0;
+  u32 group_hash = 0;
+
+  for (auto it = array::begin(app->entities); it != array::end(app->entities); it++) {
+    if (it->header.type != EntityType::EntityGrass) { continue; }
+
+    EntityGrass *grass = (EntityGrass *)it;
+    if (!grass->render) { continue; }
+
+    if (grass->reload_data) {
+      grass->reload_data = false;
+      changed = true;
+    }
+
+    group_count += 1;
+    group_hash = group_hash * 31 + grass->header.id;
+  }
+
+  if (changed || group_count != field->group_count || group_hash != field->group_hash) {
+    field->group_count = group_count;
+    field->group_hash = group_hash;
+
+    rebuild_grass_field(app, field);
+  }
+
+  u32 uploads = 0;
+
+  for (u32 i=0; i<field->cells.size; i++) {
+    GrassCell *cell = &field->cells[i];
+    float distance = get_distance_to_box(camera_position, cell->bounds);
+
+    if (distance > GRASS_RELEASE_DISTANCE) {
+      if (cell->buffer) {
+        gl_forget_buffer(cell->buffer);
+        glDeleteBuffers(1, &cell->buffer);
+
+        cell->buffer = 0;
+        cell->dirty = true;
+      }
+
+      continue;
+    }
+
+    if (distance > GRASS_LOD_FAR || !cell->dirty || uploads == GRASS_UPLOADS_PER_FRAME) { continue; }
+
+    if (!cell->buffer) {
+      glGenBuffers(1, &cell->buffer);
+    }
+
+    gl_bind_buffer(GL_ARRAY_BUFFER, cell->buffer);
+    glBufferData(GL_ARRAY_BUFFER, cell->count * sizeof(GrassInstance), &field->instances[cell->first], GL_STATIC_DRAW);
+
+    cell->dirty = false;
+    uploads += 1;
+  }
+}
+
+// Draws the streamed in cells in the frustum, each as one instanced draw of
+// a prefix thinned by distance.
+void render_grass(Memory *memory, App *app, GrassField *field, Camera *camera) {
+  if (!field->cells.size) { return; }
+
+  PROFILE_BLOCK("Render Grass");
+
+  vec3 camera_position = get_world_position(camera->position);
+
+  glDisable(GL_CULL_FACE);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  gl_depth_func(GL_LESS);
+
+  use_program(app, &app->grass_program);
+  Shader *shader = app->current_program;
+
+  set_uniform(shader, Uniform::P_MATRIX, camera->view_matrix);
+  set_uniformi(shader, Uniform::SHADOW, 0);
+  set_uniform(shader, Uniform::TEXMAPSCALE, vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
+  set_uniform(shader, Uniform::SHADOW_LIGHT_POSITION, get_world_position(app->shadow_camera.position));
+  set_uniformi(shader, Uniform::TEXTURE_IMAGE, 1);
+  set_uniform_array(shader, Uniform::SHADOW_MATRICES, app->shadow_matrices, SHADOW_CASCADES);
+  set_uniformf(shader, Uniform::TIME, app->time);
+
+  GLuint position_id = shader_get_attribute_location(shader, "position_data");
+  GLuint rotation_id = shader_get_attribute_location(shader, "rotation");
+  GLuint tint_id = shader_get_attribute_location(shader, "tint");
+
+  gl_vertex_attrib_divisor(0, 0);
+  gl_vertex_attrib_divisor(1, 0);
+  gl_vertex_attrib_divisor(2, 0);
+  gl_vertex_attrib_divisor(3, 1);
+  gl_vertex_attrib_divisor(4, 1);
+  gl_vertex_attrib_divisor(5, 1);
+
+  Model *last_model = NULL;
+
+  for (u32 i=0; i<field->cells.size; i++) {
+    GrassCell *cell = &field->cells[i];
+
+    // NOTE: a dirty buffer may hold fewer instances than the cell
+    if (!cell->buffer || cell->dirty || !cell->count) { continue; }
+
+    float distance = get_distance_to_box(camera_position, cell->bounds);
+    if (distance > GRASS_LOD_FAR) { continue; }
+
+    if (test_box_in_frustum(&camera->frustum, cell->bounds) == FrustumTest::OUTSIDE) { continue; }
+
+    bool texture_wait = process_texture(memory, cell->texture);
+    bool model_wait = process_model(memory, cell->model);
+    if (texture_wait || model_wait) { continue; }
+
+    float density = 1.0f - glm::clamp((distance - GRASS_LOD_NEAR) / (GRASS_LOD_FAR - GRASS_LOD_NEAR), 0.0f, 1.0f);
+    density = glm::max(density, GRASS_MIN_DENSITY);
+
+    u32 count = glm::max((u32)(cell->count * density), 1u);
+
+    gl_active_texture(GL_TEXTURE0 + 1);
+    gl_bind_texture(GL_TEXTURE_2D, cell->texture->id);
+
+    Mesh *mesh = &cell->model->mesh;
+
+    if (cell->model != last_model) {
+      last_model = cell->model;
+
+      // NOTE: the instance attributes would clobber the mesh vertex
+      // array, grass draws from the shared one
+      set_mesh_attributes(mesh, false);
+      gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_id);
+    }
+
+    gl_bind_buffer(GL_ARRAY_BUFFER, cell->buffer);
+    gl_vertex_attrib_pointer(position_id, 4, GL_FLOAT, GL_FALSE, sizeof(GrassInstance), (void *)offsetof(GrassInstance, position));
+    gl_vertex_attrib_pointer(rotation_id, 3, GL_FLOAT, GL_FALSE, sizeof(GrassInstance), (void *)offsetof(GrassInstance, rotation));
+    gl_vertex_attrib_pointer(tint_id, 3, GL_FLOAT, GL_FALSE, sizeof(GrassInstance), (void *)offsetof(GrassInstance, tint));
+
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->data.indices_count, GL_UNSIGNED_INT, 0, count);
+
+    field->stats.visible_cells += 1;
+    field->stats.instances += count;
+    field->stats.draws += 1;
+  }
+
+  gl_vertex_attrib_divisor(0, 0);
+  gl_vertex_attrib_divisor(1, 0);
+  gl_vertex_attrib_divisor(2, 0);
+  gl_vertex_attrib_divisor(3, 0);
+  gl_vertex_attrib_divisor(4, 0);
+  gl_vertex_attrib_divisor(5, 0);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// Grass denser than this far from the camera is thinned linearly down to
+// GRASS_MIN_DENSITY at GRASS_LOD_FAR, nothing is drawn past it.
+#define GRASS_LOD_NEAR 40.0f
+#define GRASS_LOD_FAR 160.0f
+#define GRASS_MIN_DENSITY 0.1f
+
+// Cells farther than this give their buffer back.
+#define GRASS_RELEASE_DISTANCE (GRASS_LOD_FAR * 1.5f)
+
+#define GRASS_UPLOADS_PER_FRAME 4
+
+// Interleaved layout of the cell buffers, locations 3 to 5 in grass.vert.
+struct GrassInstance {
+  vec4 position; // scale in w
+  vec3 rotation;
+  vec3 tint;
+};
+
+// Grass of all groups that falls into one terrain chunk and shares a model
+// and texture. Instances are shuffled so any prefix is an even thinning of
+// the whole cell.
+struct GrassCell {
+  s32 x;
+  s32 y;
+
+  Model *model;
+  Texture *texture;
+
+  // Range in GrassField::instances.
+  u32 first;
+  u32 count;
+
+  Box bounds;
+
+  // 0 until the cell is streamed in, dirty when the buffer is out of date.
+  GLuint buffer;
+  bool dirty;
+};
+
+struct GrassStats {
+  u32 visible_cells;
+  u32 instances;
+  u32 draws;
+};
+
+// Built from the EntityGrass groups whenever one of them is regenerated or
+// the set of groups changes, see update_grass_field.
+struct GrassField {
+  Array<GrassCell> cells;
+  Array<GrassInstance> instances;
+
+  // Scratch for rebuilds.
+  Array<GrassCell> previous_cells;
+  Array<u32> instance_cells;
+
+  // Number and ids of the groups the cells were built from.
+  u32 group_count;
+  u32 group_hash;
+
+  GrassStats stats;
+};
@@ -1,3 +1,23 @@
+// Settings of an emitter placed in the editor, also used for entity files
+// that don't have them.
+void set_default_particle_emitter(EntityParticleEmitter *emitter) {
+  emitter->initial_color = vec4(1.0f);
+  emitter->particle_size = 0.4f;
+  emitter->gravity = 0.0f;
+  emitter->spawn_rate = 60.0f;
+  emitter->lifetime = 2.0f;
+  emitter->max_particles = 256;
+}
+
+void save_particle_emitter(EntityParticleEmitter *src, EntitySave *dest) {
+  dest->initial_color = src->initial_color;
+  dest->particle_size = src->particle_size;
+  dest->gravity = src->gravity;
+  dest->spawn_rate = src->spawn_rate;
+  dest->lifetime = src->lifetime;
+  dest->max_particles = src->max_particles;
+}
+
 void deserialize_entity(App *app, EntitySave *src, Entity *dest) {
   dest->header.id = src->id;
   dest->header.type = src->type;
@@ -15,8 +35,19 @@ void deserialize_entity(App *app, EntitySave *src, Entity *dest) {
     dest->header.model = NULL;
   }
 
+  if (dest->header.type == EntityType::EntityParticleEmitter) {
+    EntityParticleEmitter *emitter = (EntityParticleEmitter *)dest;
+    emitter->initial_color = src->initial_color;
+    emitter->particle_size = src->particle_size;
+    emitter->gravity = src->gravity;
+    emitter->spawn_rate = src->spawn_rate;
+    emitter->lifetime = src->lifetime;
+    emitter->max_particles = src->max_particles;
+    emitter->particle_slice = 0;
+  }
+
   if (dest->header.flags & EntityFlags::MOUNT_TO_TERRAIN) {
-    mount_entity_to_terrain(dest);
+    mount_entity_to_terrain(app, dest);
   }
 }
 
@@ -72,6 +103,15 @@ void save_text_level_file(Memory *memory, LoadedLevel level) {
     platform.print_to_file(file, "orientation: %f, %f, %f\n", it->orientation.x, it->orientation.y, it->orientation.z);
     platform.print_to_file(file, "color: %f, %f, %f, %f\n", it->color.x, it->color.y, it->color.z, it->color.w);
 
+    if (it->type == EntityType::EntityParticleEmitter) {
+      platform.print_to_file(file, "initial_color: %f, %f, %f, %f\n", it->initial_color.x, it->initial_color.y, it->initial_color.z, it->initial_color.w);
+      platform.print_to_file(file, "particle_size: %f\n", it->particle_size);
+      platform.print_to_file(file, "gravity: %f\n", it->gravity);
+      platform.print_to_file(file, "spawn_rate: %f\n", it->spawn_rate);
+      platform.print_to_file(file, "lifetime: %f\n", it->lifetime);
+      platform.print_to_file(file, "max_particles: %u\n", it->max_particles);
+    }
+
     platform.close_file(file);
   }
 #endif
@@ -113,6 +153,10 @@ void save_level(Memory *memory, App *app) {
       save_entity.orientation = it->header.orientation;
       save_entity.color = it->header.color;
       save_entity.flags = it->header.flags;
+
+      if (it->header.type == EntityType::EntityParticleEmitter) {
+        save_particle_emitter((EntityParticleEmitter *)it, &save_entity);
+      }
       if (it->header.model) {
         save_entity.has_model = true;
         strcpy(save_entity.model_name, it->header.model->id_name);
@@ -173,6 +217,12 @@ void load_debug_level(Memory *memory, App *app) {
             EntitySave entity = {};
             entity.has_model = false;
 
+            {
+              EntityParticleEmitter emitter;
+              set_default_particle_emitter(&emitter);
+              save_particle_emitter(&emitter, &entity);
+            }
+
             PlatformFileLine line = platform.read_file_line(file);
             if (!line.empty) {
               sscanf(line.contents, "%d", &entity.id);
@@ -206,6 +256,18 @@ void load_debug_level(Memory *memory, App *app) {
                 entity.orientation = read_quat(start);
               } else if (strcmp(property_name, "color") == 0) {
                 entity.color = read_vector4(start);
+              } else if (strcmp(property_name, "initial_color") == 0) {
+                entity.initial_color = read_vector4(start);
+              } else if (strcmp(property_name, "particle_size") == 0) {
+                sscanf(start, "%f", &entity.particle_size);
+              } else if (strcmp(property_name, "gravity") == 0) {
+                sscanf(start, "%f", &entity.gravity);
+              } else if (strcmp(property_name, "spawn_rate") == 0) {
+                sscanf(start, "%f", &entity.spawn_rate);
+              } else if (strcmp(property_name, "lifetime") == 0) {
+                sscanf(start, "%f", &entity.lifetime);
+              } else if (strcmp(property_name, "max_particles") == 0) {
+                sscanf(start, "%u", &entity.max_particles);
               }
             }
 
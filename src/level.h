@@ -16,6 +16,14 @@ struct EntitySave {
 
   bool has_model;
   char model_name[128];
+
+  // EntityParticleEmitter only.
+  vec4 initial_color;
+  float particle_size;
+  float gravity;
+  float spawn_rate;
+  float lifetime;
+  u32 max_particles;
 };
 #pragma options align=reset
 
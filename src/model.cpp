@@ -1,8 +1,19 @@
 void unload_model(Model *model) {
   if (platform.atomic_exchange(&model->state, AssetState::INITIALIZED, AssetState::PROCESSING)) {
+    gl_forget_vertex_array(model->mesh.vao);
+    gl_forget_buffer(model->mesh.buffer);
+    gl_forget_buffer(model->mesh.indices_id);
+
+    glDeleteVertexArrays(1, &model->mesh.vao);
     glDeleteBuffers(1, &model->mesh.buffer);
+    glDeleteBuffers(1, &model->mesh.indices_id);
 
-    free(model->mesh.data.data);
+    if (model->mesh.data.mapped_file.contents) {
+      platform.unmap_file(model->mesh.data.mapped_file);
+      model->mesh.data.mapped_file = {};
+    } else {
+      free(model->mesh.data.data);
+    }
 
     model->state = AssetState::EMPTY;
   }
@@ -26,15 +37,49 @@ void optimize_model(Model *model) {
   vco.Optimize(model->mesh.data.indices, model->mesh.data.indices_count / 3); // TODO(sedivy): why divide by three
 }
 
+// Points the mesh attributes at the mesh buffer in the bound vertex array.
+// The locations match the layouts in the shaders.
+void set_mesh_attributes(Mesh *mesh, bool enable) {
+  gl_bind_buffer(GL_ARRAY_BUFFER, mesh->buffer);
+
+  u32 counts[] = { mesh->data.vertices_count, mesh->data.normals_count, mesh->data.uv_count, mesh->data.colors_count };
+  GLint sizes[] = { 3, 3, 2, 3 };
+
+  u32 offset = 0;
+
+  for (u32 i=0; i<4; i++) {
+    if (counts[i]) {
+      gl_vertex_attrib_pointer(i, sizes[i], GL_FLOAT, GL_FALSE, 0, (void *)(size_t)offset);
+
+      if (enable) {
+        glEnableVertexAttribArray(i);
+      }
+    }
+
+    offset += counts[i] * sizeof(float);
+  }
+}
+
+// Leaves the new vertex array bound.
+void create_mesh_vertex_array(Mesh *mesh) {
+  glGenVertexArrays(1, &mesh->vao);
+  gl_bind_vertex_array(mesh->vao);
+
+  mesh->instance_attributes = false;
+
+  set_mesh_attributes(mesh, true);
+  gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_id);
+}
+
 void initialize_model(Model *model) {
   u32 vertices_size = model->mesh.data.vertices_count * sizeof(float);
   u32 normals_size = model->mesh.data.normals_count * sizeof(float);
   u32 uv_size = model->mesh.data.uv_count * sizeof(float);
-  u32 colors_size = model->mesh.data.colors_count + sizeof(float);
+  u32 colors_size = model->mesh.data.colors_count * sizeof(float);
 
   GLuint buffer;
   glGenBuffers(1, &buffer);
-  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  gl_bind_buffer(GL_ARRAY_BUFFER, buffer);
   glBufferData(GL_ARRAY_BUFFER, vertices_size + normals_size + uv_size + colors_size, NULL, GL_STATIC_DRAW);
 
   glBufferSubData(GL_ARRAY_BUFFER, 0, vertices_size, model->mesh.data.vertices);
@@ -42,16 +87,21 @@ void initialize_model(Model *model) {
   glBufferSubData(GL_ARRAY_BUFFER, vertices_size + normals_size, uv_size, model->mesh.data.uv);
   glBufferSubData(GL_ARRAY_BUFFER, vertices_size + normals_size + uv_size, colors_size, model->mesh.data.colors);
 
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  gl_bind_buffer(GL_ARRAY_BUFFER, 0);
 
-  GLuint indices_id;
-  glGenBuffers(1, &indices_id);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, model->mesh.data.indices_count * sizeof(GLint), model->mesh.data.indices, GL_STATIC_DRAW);
+  // NOTE: terrain chunks draw with index buffers shared by LOD level
+  GLuint indices_id = 0;
+  if (model->mesh.data.indices_count) {
+    glGenBuffers(1, &indices_id);
+    gl_bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, model->mesh.data.indices_count * sizeof(GLint), model->mesh.data.indices, GL_STATIC_DRAW);
+  }
 
   model->mesh.buffer = buffer;
   model->mesh.indices_id = indices_id;
 
+  create_mesh_vertex_array(&model->mesh);
+
   model->state = AssetState::INITIALIZED; // TODO(sedivy): atomic
 }
 
@@ -88,162 +138,290 @@ void allocate_mesh(Mesh *mesh, u32 vertices_count, u32 normals_count, u32 indice
   mesh->data.colors_count = colors_count;
 }
 
-void load_model_work(void *data) {
-  PROFILE_BLOCK("Loading Model");
-  LoadModelWork *work = (LoadModelWork *)data;
+void import_model(Model *model) {
+  PROFILE_BLOCK("Import Model");
 
-  if (platform.atomic_exchange(&work->model->state, AssetState::EMPTY, AssetState::PROCESSING)) {
-    acquire_asset_file((char *)work->model->path);
+  DebugReadFileResult result = platform.debug_read_entire_file(model->path);
 
-    DebugReadFileResult result = platform.debug_read_entire_file(work->model->path);
+  Assimp::Importer importer;
 
-    Assimp::Importer importer;
+  const aiScene* scene = importer.ReadFileFromMemory(result.contents, result.fileSize, aiProcess_GenNormals |
+      aiProcess_CalcTangentSpace |
+      aiProcess_Triangulate |
+      aiProcess_JoinIdenticalVertices |
+      aiProcess_OptimizeGraph |
+      aiProcess_SortByPType);
 
-    const aiScene* scene = importer.ReadFileFromMemory(result.contents, result.fileSize, aiProcess_GenNormals |
-        aiProcess_CalcTangentSpace |
-        aiProcess_Triangulate |
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_OptimizeGraph |
-        aiProcess_SortByPType);
+  float max_distance = 0.0f;
 
-    Model *model = work->model;
+  Box bounds;
+  bounds.min = vec3(0.0f);
+  bounds.max = vec3(0.0f);
 
-    float max_distance = 0.0f;
+  model->mesh = {};
 
-    if (scene->HasMeshes()) {
-      u32 indices_offset = 0;
+  if (scene->HasMeshes()) {
+    u32 indices_offset = 0;
 
-      u32 count = 0;
-      u32 index_count = 0;
+    u32 count = 0;
+    u32 index_count = 0;
 
-      for (u32 i=0; i<scene->mNumMeshes; i++) {
-        aiMesh *mesh_data = scene->mMeshes[i];
-        count += mesh_data->mNumVertices;
+    for (u32 i=0; i<scene->mNumMeshes; i++) {
+      aiMesh *mesh_data = scene->mMeshes[i];
+      count += mesh_data->mNumVertices;
 
-        for (u32 l=0; l<mesh_data->mNumFaces; l++) {
-          aiFace face = mesh_data->mFaces[l];
+      for (u32 l=0; l<mesh_data->mNumFaces; l++) {
+        aiFace face = mesh_data->mFaces[l];
 
-          index_count += face.mNumIndices;
-        }
+        index_count += face.mNumIndices;
       }
+    }
 
-      u32 vertices_count = count * 3;
-      u32 normals_count = count * 3;
-      u32 uv_count = count * 2;
-      u32 indices_count = index_count;
+    u32 vertices_count = count * 3;
+    u32 normals_count = count * 3;
+    u32 uv_count = count * 2;
+    u32 indices_count = index_count;
 
-      u32 vertices_index = 0;
-      u32 normals_index = 0;
-      u32 uv_index = 0;
-      u32 indices_index = 0;
+    u32 vertices_index = 0;
+    u32 normals_index = 0;
+    u32 uv_index = 0;
+    u32 indices_index = 0;
 
-      Mesh mesh = {};
-      allocate_mesh(&mesh, vertices_count, normals_count, indices_count, uv_count, 0);
+    Mesh mesh = {};
+    allocate_mesh(&mesh, vertices_count, normals_count, indices_count, uv_count, 0);
 
-      for (u32 i=0; i<scene->mNumMeshes; i++) {
-        aiMesh *mesh_data = scene->mMeshes[i];
+    if (count) {
+      vec3 first = vec3(scene->mMeshes[0]->mVertices[0].x, scene->mMeshes[0]->mVertices[0].y, scene->mMeshes[0]->mVertices[0].z);
+      bounds.min = first;
+      bounds.max = first;
+    }
 
-        for (u32 l=0; l<mesh_data->mNumVertices; l++) {
-          mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].x;
-          mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].y;
-          mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].z;
+    for (u32 i=0; i<scene->mNumMeshes; i++) {
+      aiMesh *mesh_data = scene->mMeshes[i];
 
-          float new_distance = glm::length(vec3(mesh_data->mVertices[l].x, mesh_data->mVertices[l].y, mesh_data->mVertices[l].z));
-          if (new_distance > max_distance) {
-            max_distance = new_distance;
-          }
+      for (u32 l=0; l<mesh_data->mNumVertices; l++) {
+        mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].x;
+        mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].y;
+        mesh.data.vertices[vertices_index++] = mesh_data->mVertices[l].z;
 
-          mesh.data.normals[normals_index++] = mesh_data->mNormals[l].x;
-          mesh.data.normals[normals_index++] = mesh_data->mNormals[l].y;
-          mesh.data.normals[normals_index++] = mesh_data->mNormals[l].z;
+        vec3 vertex = vec3(mesh_data->mVertices[l].x, mesh_data->mVertices[l].y, mesh_data->mVertices[l].z);
 
-          if (mesh_data->mTextureCoords[0]) {
-            mesh.data.uv[uv_index++] = mesh_data->mTextureCoords[0][l].x;
-            mesh.data.uv[uv_index++] = mesh_data->mTextureCoords[0][l].y;
-          }
+        float new_distance = glm::length(vertex);
+        if (new_distance > max_distance) {
+          max_distance = new_distance;
         }
 
-        for (u32 l=0; l<mesh_data->mNumFaces; l++) {
-          aiFace face = mesh_data->mFaces[l];
+        bounds.min = glm::min(bounds.min, vertex);
+        bounds.max = glm::max(bounds.max, vertex);
+
+        mesh.data.normals[normals_index++] = mesh_data->mNormals[l].x;
+        mesh.data.normals[normals_index++] = mesh_data->mNormals[l].y;
+        mesh.data.normals[normals_index++] = mesh_data->mNormals[l].z;
 
-          for (u32 j=0; j<face.mNumIndices; j++) {
-            mesh.data.indices[indices_index++] = face.mIndices[j] + indices_offset;
-          }
+        if (mesh_data->mTextureCoords[0]) {
+          mesh.data.uv[uv_index++] = mesh_data->mTextureCoords[0][l].x;
+          mesh.data.uv[uv_index++] = mesh_data->mTextureCoords[0][l].y;
         }
+      }
+
+      for (u32 l=0; l<mesh_data->mNumFaces; l++) {
+        aiFace face = mesh_data->mFaces[l];
 
-        indices_offset += mesh_data->mNumVertices;
+        for (u32 j=0; j<face.mNumIndices; j++) {
+          mesh.data.indices[indices_index++] = face.mIndices[j] + indices_offset;
+        }
       }
 
-      model->mesh = mesh;
+      indices_offset += mesh_data->mNumVertices;
     }
 
-    platform.debug_free_file(result);
+    model->mesh = mesh;
+  }
 
-    optimize_model(model);
+  platform.debug_free_file(result);
 
-    model->radius = max_distance;
-    model->state = AssetState::HAS_DATA; // TODO(sedivy): atomic
-  }
+  optimize_model(model);
 
-  free(work);
+  model->radius = max_distance;
+  model->bounds = bounds;
 }
 
-inline bool process_model(Memory *memory, Model *model) {
-  if (model->state == AssetState::INITIALIZED) {
+inline u32 align_baked_offset(u32 offset) {
+  return (offset + 15) & ~15;
+}
+
+inline bool is_baked_range_valid(PlatformMappedFile *file, u32 offset, u32 count, u32 size) {
+  return offset % 4 == 0 && (u64)offset + (u64)count * size <= file->size;
+}
+
+// Returns false when the file is missing, from another version or cut
+// short, the model has to be imported again.
+bool load_baked_model(Model *model, char *path) {
+  PROFILE_BLOCK("Load Baked Model");
+
+  PlatformMappedFile file = platform.map_file(path);
+  if (!file.contents) {
     return false;
   }
 
-  if (platform.queue_has_free_spot(memory->low_queue)) {
-    if (model->state == AssetState::EMPTY) {
-      LoadModelWork *work = (LoadModelWork *)malloc(sizeof(LoadModelWork));
-      work->model = model;
+  BakedModelHeader *header = (BakedModelHeader *)file.contents;
 
-      platform.add_work(memory->low_queue, load_model_work, work);
+  bool valid = file.size >= sizeof(BakedModelHeader) &&
+    header->magic == BAKED_MODEL_MAGIC &&
+    header->version == BAKED_MODEL_VERSION &&
+    is_baked_range_valid(&file, header->vertices_offset, header->vertices_count, sizeof(float)) &&
+    is_baked_range_valid(&file, header->normals_offset, header->normals_count, sizeof(float)) &&
+    is_baked_range_valid(&file, header->uv_offset, header->uv_count, sizeof(float)) &&
+    is_baked_range_valid(&file, header->indices_offset, header->indices_count, sizeof(GLint)) &&
+    is_baked_range_valid(&file, header->colors_offset, header->colors_count, sizeof(float));
 
-      return true;
-    }
+  if (!valid) {
+    platform.unmap_file(file);
+    return false;
   }
 
-  if (model->state == AssetState::HAS_DATA) {
-    initialize_model(model);
-    return false;
+  u8 *base = (u8 *)file.contents;
+
+  // NOTE: fault the pages in on this thread, not on the render thread when
+  // the upload queue copies the mesh.
+  u8 volatile touch = 0;
+  for (u64 i=0; i<file.size; i += Kilobytes(4)) {
+    touch += base[i];
   }
 
+  Mesh mesh = {};
+  mesh.data.data = base;
+  mesh.data.mapped_file = file;
+
+  mesh.data.vertices = (float *)(base + header->vertices_offset);
+  mesh.data.vertices_count = header->vertices_count;
+
+  mesh.data.normals = (float *)(base + header->normals_offset);
+  mesh.data.normals_count = header->normals_count;
+
+  mesh.data.uv = (float *)(base + header->uv_offset);
+  mesh.data.uv_count = header->uv_count;
+
+  mesh.data.indices = (int *)(base + header->indices_offset);
+  mesh.data.indices_count = header->indices_count;
+
+  mesh.data.colors = (float *)(base + header->colors_offset);
+  mesh.data.colors_count = header->colors_count;
+
+  model->mesh = mesh;
+  model->radius = header->radius;
+  model->bounds = header->bounds;
+
   return true;
 }
 
-inline void use_model_mesh(App *app, Mesh *mesh) {
-  glBindBuffer(GL_ARRAY_BUFFER, mesh->buffer);
+void write_baked_array(PlatformFile file, u32 *written, u32 offset, void *data, u32 size) {
+  u8 padding[16] = {};
+  platform.write_to_file(file, offset - *written, padding);
 
-  u32 offset = 0;
+  if (size) {
+    platform.write_to_file(file, size, data);
+  }
+
+  *written = offset + size;
+}
+
+void bake_model(Model *model, char *path) {
+  PROFILE_BLOCK("Bake Model");
+
+  ModelData *data = &model->mesh.data;
 
-  if (shader_has_attribute(app->current_program, "position")) {
-    GLuint id = shader_get_attribute_location(app->current_program, "position");
-    glVertexAttribPointer(id, 3, GL_FLOAT, GL_FALSE, 0, (void *)offset);
+  BakedModelHeader header = {};
+  header.magic = BAKED_MODEL_MAGIC;
+  header.version = BAKED_MODEL_VERSION;
+  header.radius = model->radius;
+  header.bounds = model->bounds;
+
+  header.vertices_count = data->vertices_count;
+  header.normals_count = data->normals_count;
+  header.uv_count = data->uv_count;
+  header.indices_count = data->indices_count;
+  header.colors_count = data->colors_count;
+
+  u32 offset = align_baked_offset(sizeof(BakedModelHeader));
+
+  header.vertices_offset = offset;
+  offset = align_baked_offset(offset + data->vertices_count * sizeof(float));
+
+  header.normals_offset = offset;
+  offset = align_baked_offset(offset + data->normals_count * sizeof(float));
+
+  header.uv_offset = offset;
+  offset = align_baked_offset(offset + data->uv_count * sizeof(float));
+
+  header.indices_offset = offset;
+  offset = align_baked_offset(offset + data->indices_count * sizeof(GLint));
+
+  header.colors_offset = offset;
+
+  PlatformFile file = platform.open_file(path, "wb");
+  if (file.error) {
+    return;
   }
 
-  offset += mesh->data.vertices_count * sizeof(float);
+  platform.write_to_file(file, sizeof(BakedModelHeader), &header);
+
+  u32 written = sizeof(BakedModelHeader);
+  write_baked_array(file, &written, header.vertices_offset, data->vertices, data->vertices_count * sizeof(float));
+  write_baked_array(file, &written, header.normals_offset, data->normals, data->normals_count * sizeof(float));
+  write_baked_array(file, &written, header.uv_offset, data->uv, data->uv_count * sizeof(float));
+  write_baked_array(file, &written, header.indices_offset, data->indices, data->indices_count * sizeof(GLint));
+  write_baked_array(file, &written, header.colors_offset, data->colors, data->colors_count * sizeof(float));
+
+  platform.close_file(file);
+}
+
+void load_model_work(void *data) {
+  PROFILE_BLOCK("Loading Model");
+  LoadModelWork *work = (LoadModelWork *)data;
+
+  if (platform.atomic_exchange(&work->model->state, AssetState::QUEUED, AssetState::PROCESSING)) {
+    Model *model = work->model;
+
+    acquire_asset_file((char *)model->path);
+
+    // NOTE: Assimp only runs when the source changed since the last bake
+    char *baked_path = mprintf("%s.baked", model->path);
+
+    if (platform.get_file_time((char *)model->path) > platform.get_file_time(baked_path) || !load_baked_model(model, baked_path)) {
+      import_model(model);
+      bake_model(model, baked_path);
+    }
+
+    free(baked_path);
 
-  if (shader_has_attribute(app->current_program, "normals")) {
-    GLuint id = shader_get_attribute_location(app->current_program, "normals");
-    glVertexAttribPointer(id, 3, GL_FLOAT, GL_FALSE, 0, (void *)offset);
+    model->state = AssetState::HAS_DATA; // TODO(sedivy): atomic
   }
 
-  offset += mesh->data.normals_count * sizeof(float);
+  free(work);
+}
 
-  if (shader_has_attribute(app->current_program, "uv")) {
-    GLuint id = shader_get_attribute_location(app->current_program, "uv");
-    glVertexAttribPointer(id, 2, GL_FLOAT, GL_FALSE, 0, (void *)offset);
+inline bool process_model(Memory *memory, Model *model) {
+  if (model->state == AssetState::INITIALIZED) {
+    return false;
   }
 
-  offset += mesh->data.uv_count * sizeof(float);
+  if (platform.atomic_exchange(&model->state, AssetState::EMPTY, AssetState::QUEUED)) {
+    LoadModelWork *work = (LoadModelWork *)malloc(sizeof(LoadModelWork));
+    work->model = model;
+
+    platform.add_work(memory->jobs, JobPriority::NORMAL, load_model_work, work, NULL);
 
-  if (shader_has_attribute(app->current_program, "colors")) {
-    GLuint id = shader_get_attribute_location(app->current_program, "colors");
-    glVertexAttribPointer(id, 3, GL_FLOAT, GL_FALSE, 0, (void *)offset);
+    return true;
   }
 
-  offset += mesh->data.colors_count * sizeof(float);
+  if (model->state == AssetState::HAS_DATA) {
+    queue_upload(&memory->app->uploads, UploadType::MODEL, model, &model->state);
+  }
+
+  return true;
+}
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indices_id);
+inline void use_model_mesh(Mesh *mesh) {
+  gl_bind_vertex_array(mesh->vao);
 }
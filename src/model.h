@@ -13,12 +13,23 @@ struct ModelData {
   u32 uv_count = 0;
   u32 indices_count = 0;
   u32 colors_count = 0;
+
+  // Set when data points into a mapped baked file instead of malloc memory.
+  PlatformMappedFile mapped_file = {};
 };
 
 struct Mesh {
   GLuint buffer;
   GLuint indices_id;
 
+  // Attribute pointers and the index buffer, 0 for terrain chunks which set
+  // their pointers by hand.
+  GLuint vao;
+
+  // Set once the vertex array has the instance attributes enabled, see
+  // draw_instances.
+  bool instance_attributes;
+
   ModelData data;
 };
 
@@ -29,6 +40,7 @@ struct Model {
   Mesh mesh;
 
   float radius;
+  Box bounds;
 
   u32 state;
 };
@@ -36,3 +48,29 @@ struct Model {
 struct LoadModelWork {
   Model *model;
 };
+
+#define BAKED_MODEL_MAGIC 0x4C444D42
+#define BAKED_MODEL_VERSION 1
+
+// Imported models are written next to their source file as "<path>.baked"
+// with the indices already vertex cache optimized. The arrays follow the
+// header, offsets are from the start of the file and 16 byte aligned.
+struct BakedModelHeader {
+  u32 magic;
+  u32 version;
+
+  float radius;
+  Box bounds;
+
+  u32 vertices_count;
+  u32 normals_count;
+  u32 uv_count;
+  u32 indices_count;
+  u32 colors_count;
+
+  u32 vertices_offset;
+  u32 normals_offset;
+  u32 uv_offset;
+  u32 indices_offset;
+  u32 colors_offset;
+};
@@ -0,0 +1,435 @@
+// CPU occlusion culling for the main camera.
+//
+// begin_occlusion collects the terrain around the camera and the entities
+// flagged as occluders and rasterizes them on the job system while the
+// shadow pass is drawn. Occluders have to stay inside what they stand for,
+// so terrain uses heights that never rise above the drawn LODs and entities
+// their own mesh. end_occlusion waits for the buffer, after that
+// is_sphere_occluded tests bounds against its depth pyramid. Nothing here
+// touches GL.
+
+void initialize_occlusion_buffer(OcclusionBuffer *buffer) {
+  u32 total = 0;
+  for (u32 i=0; i<OCCLUSION_LEVELS; i++) {
+    total += (OCCLUSION_WIDTH >> i) * (OCCLUSION_HEIGHT >> i);
+  }
+
+  float *depth = (float *)calloc(total, sizeof(float));
+  for (u32 i=0; i<OCCLUSION_LEVELS; i++) {
+    buffer->levels[i] = depth;
+    depth += (OCCLUSION_WIDTH >> i) * (OCCLUSION_HEIGHT >> i);
+  }
+
+  buffer->counter = {};
+  buffer->enabled = true;
+  buffer->ready = false;
+  buffer->stats = {};
+}
+
+// Heights of a coarse grid over the chunk that never rise above the terrain
+// drawn at any LOD. LOD vertex spacing divides the cell size so every LOD
+// triangle lies inside one cell, a vertex takes the lowest sample of the
+// cells around it.
+void update_chunk_occluder(TerrainChunk *chunk, u32 stride) {
+  const u32 cells = TERRAIN_OCCLUDER_CELLS;
+  const u32 cell_size = (TERRAIN_TILE_WIDTH - 1) / TERRAIN_OCCLUDER_CELLS;
+
+  float lowest[cells][cells];
+
+  for (u32 cx=0; cx<cells; cx++) {
+    for (u32 cy=0; cy<cells; cy++) {
+      float result = FLT_MAX;
+
+      for (u32 x=cx * cell_size; x<=(cx + 1) * cell_size; x += stride) {
+        float *column = chunk->heights + x * TERRAIN_TILE_HEIGHT;
+
+        for (u32 y=cy * cell_size; y<=(cy + 1) * cell_size; y += stride) {
+          result = glm::min(result, column[y]);
+        }
+      }
+
+      lowest[cx][cy] = result;
+    }
+  }
+
+  for (u32 x=0; x<=cells; x++) {
+    for (u32 y=0; y<=cells; y++) {
+      float result = FLT_MAX;
+
+      for (u32 cx=(x ? x - 1 : 0); cx<=glm::min(x, cells - 1); cx++) {
+        for (u32 cy=(y ? y - 1 : 0); cy<=glm::min(y, cells - 1); cy++) {
+          result = glm::min(result, lowest[cx][cy]);
+        }
+      }
+
+      chunk->occluder_heights[x * (cells + 1) + y] = result;
+    }
+  }
+
+  chunk->occluder_stride = stride;
+}
+
+// Vertices are in pixels with 1/w in z, any winding.
+void rasterize_occlusion_screen_triangle(float *depth, vec3 v0, vec3 v1, vec3 v2) {
+  float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+  if (glm::abs(area) < 0.0001f) { return; }
+
+  if (area < 0.0f) {
+    std::swap(v1, v2);
+    area = -area;
+  }
+
+  int min_x = glm::max((int)glm::floor(glm::min(v0.x, glm::min(v1.x, v2.x))), 0);
+  int min_y = glm::max((int)glm::floor(glm::min(v0.y, glm::min(v1.y, v2.y))), 0);
+  int max_x = glm::min((int)glm::ceil(glm::max(v0.x, glm::max(v1.x, v2.x))), OCCLUSION_WIDTH - 1);
+  int max_y = glm::min((int)glm::ceil(glm::max(v0.y, glm::max(v1.y, v2.y))), OCCLUSION_HEIGHT - 1);
+
+  if (min_x > max_x || min_y > max_y) { return; }
+
+  // Edge functions a * x + b * y + c, positive inside. Each one is the
+  // barycentric weight of the opposite vertex times the area.
+  float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = v1.x * v2.y - v1.y * v2.x;
+  float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = v2.x * v0.y - v2.y * v0.x;
+  float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = v0.x * v1.y - v0.y * v1.x;
+
+  float inverse_area = 1.0f / area;
+  float za = (a0 * v0.z + a1 * v1.z + a2 * v2.z) * inverse_area;
+  float zb = (b0 * v0.z + b1 * v1.z + b2 * v2.z) * inverse_area;
+  float zc = (c0 * v0.z + c1 * v1.z + c2 * v2.z) * inverse_area;
+
+#ifdef USE_SSE2
+  // NOTE: four pixels at a time, rows are a multiple of four wide
+  min_x &= ~3;
+
+  __m128 pixel_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+  for (int y=min_y; y<=max_y; y++) {
+    float py = (float)y + 0.5f;
+    float *row = depth + y * OCCLUSION_WIDTH;
+
+    __m128 row0 = _mm_set1_ps(b0 * py + c0);
+    __m128 row1 = _mm_set1_ps(b1 * py + c1);
+    __m128 row2 = _mm_set1_ps(b2 * py + c2);
+    __m128 row_z = _mm_set1_ps(zb * py + zc);
+
+    for (int x=min_x; x<=max_x; x += 4) {
+      __m128 px = _mm_add_ps(_mm_set1_ps((float)x), pixel_offsets);
+
+      __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), row0);
+      __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), row1);
+      __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), row2);
+
+      // The sign bit is set when any edge function is negative.
+      __m128i outside = _mm_srai_epi32(_mm_castps_si128(_mm_or_ps(_mm_or_ps(e0, e1), e2)), 31);
+
+      __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), row_z);
+
+      __m128 current = _mm_loadu_ps(row + x);
+      __m128 closer = _mm_max_ps(current, z);
+
+      __m128 mask = _mm_castsi128_ps(outside);
+      _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, current), _mm_andnot_ps(mask, closer)));
+    }
+  }
+#else
+  for (int y=min_y; y<=max_y; y++) {
+    float py = (float)y + 0.5f;
+    float *row = depth + y * OCCLUSION_WIDTH;
+
+    for (int x=min_x; x<=max_x; x++) {
+      float px = (float)x + 0.5f;
+
+      if (a0 * px + b0 * py + c0 < 0.0f || a1 * px + b1 * py + c1 < 0.0f || a2 * px + b2 * py + c2 < 0.0f) {
+        continue;
+      }
+
+      row[x] = glm::max(row[x], za * px + zb * py + zc);
+    }
+  }
+#endif
+}
+
+inline vec3 occlusion_screen_position(vec4 clip) {
+  float inverse_w = 1.0f / clip.w;
+  return vec3((clip.x * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH, (clip.y * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT, inverse_w);
+}
+
+// Clips against the near plane and rasterizes the result. Returns false
+// when nothing of the triangle was in front of the camera.
+bool rasterize_occlusion_triangle(float *depth, vec4 a, vec4 b, vec4 c) {
+  if (a.x > a.w && b.x > b.w && c.x > c.w) { return false; }
+  if (a.x < -a.w && b.x < -b.w && c.x < -c.w) { return false; }
+  if (a.y > a.w && b.y > b.w && c.y > c.w) { return false; }
+  if (a.y < -a.w && b.y < -b.w && c.y < -c.w) { return false; }
+
+  vec4 input[3] = { a, b, c };
+
+  vec4 clipped[4];
+  u32 count = 0;
+
+  for (u32 i=0; i<3; i++) {
+    vec4 current = input[i];
+    vec4 next = input[(i + 1) % 3];
+
+    bool current_inside = current.w >= OCCLUSION_NEAR;
+    bool next_inside = next.w >= OCCLUSION_NEAR;
+
+    if (current_inside) {
+      clipped[count++] = current;
+    }
+
+    if (current_inside != next_inside) {
+      float t = (OCCLUSION_NEAR - current.w) / (next.w - current.w);
+      clipped[count++] = glm::mix(current, next, t);
+    }
+  }
+
+  if (count < 3) { return false; }
+
+  vec3 first = occlusion_screen_position(clipped[0]);
+  vec3 previous = occlusion_screen_position(clipped[1]);
+
+  for (u32 i=2; i<count; i++) {
+    vec3 current = occlusion_screen_position(clipped[i]);
+    rasterize_occlusion_screen_triangle(depth, first, previous, current);
+    previous = current;
+  }
+
+  return true;
+}
+
+u32 rasterize_occlusion_chunk(OcclusionBuffer *buffer, TerrainChunk *chunk) {
+  const u32 size = TERRAIN_OCCLUDER_CELLS + 1;
+
+  float spacing_x = (float)CHUNK_SIZE_X / TERRAIN_OCCLUDER_CELLS;
+  float spacing_y = (float)CHUNK_SIZE_Y / TERRAIN_OCCLUDER_CELLS;
+
+  vec4 clip[size * size];
+
+  for (u32 x=0; x<size; x++) {
+    for (u32 y=0; y<size; y++) {
+      vec3 position = vec3(chunk->x * CHUNK_SIZE_X + x * spacing_x, chunk->occluder_heights[x * size + y], chunk->y * CHUNK_SIZE_Y + y * spacing_y);
+      clip[x * size + y] = buffer->view_projection * vec4(position, 1.0f);
+    }
+  }
+
+  u32 triangles = 0;
+
+  for (u32 x=0; x<size - 1; x++) {
+    for (u32 y=0; y<size - 1; y++) {
+      vec4 *a = clip + x * size + y;
+      vec4 *b = a + size;
+
+      triangles += rasterize_occlusion_triangle(buffer->levels[0], a[0], b[0], a[1]);
+      triangles += rasterize_occlusion_triangle(buffer->levels[0], b[0], b[1], a[1]);
+    }
+  }
+
+  return triangles;
+}
+
+u32 rasterize_occlusion_mesh(OcclusionBuffer *buffer, OcclusionMesh *occluder) {
+  ModelData *data = &occluder->mesh->data;
+  mat4 transform = buffer->view_projection * occluder->model;
+
+  u32 triangles = 0;
+
+  for (u32 i=0; i + 2<data->indices_count; i += 3) {
+    float *a = data->vertices + data->indices[i] * 3;
+    float *b = data->vertices + data->indices[i + 1] * 3;
+    float *c = data->vertices + data->indices[i + 2] * 3;
+
+    triangles += rasterize_occlusion_triangle(buffer->levels[0],
+                                              transform * vec4(a[0], a[1], a[2], 1.0f),
+                                              transform * vec4(b[0], b[1], b[2], 1.0f),
+                                              transform * vec4(c[0], c[1], c[2], 1.0f));
+  }
+
+  return triangles;
+}
+
+void build_occlusion_pyramid(OcclusionBuffer *buffer) {
+  for (u32 level=1; level<OCCLUSION_LEVELS; level++) {
+    u32 width = OCCLUSION_WIDTH >> level;
+    u32 height = OCCLUSION_HEIGHT >> level;
+
+    float *source = buffer->levels[level - 1];
+    float *destination = buffer->levels[level];
+
+    for (u32 y=0; y<height; y++) {
+      float *top = source + (y * 2) * width * 2;
+      float *bottom = top + width * 2;
+
+      for (u32 x=0; x<width; x++) {
+        destination[y * width + x] = glm::min(glm::min(top[x * 2], top[x * 2 + 1]), glm::min(bottom[x * 2], bottom[x * 2 + 1]));
+      }
+    }
+  }
+}
+
+// Runs on the job system, see begin_occlusion.
+void rasterize_occlusion_work(void *data) {
+  OcclusionBuffer *buffer = (OcclusionBuffer *)data;
+
+  PROFILE_BLOCK("Rasterize Occlusion", buffer->chunks.size + buffer->meshes.size);
+
+  u64 start = platform.get_performance_counter();
+
+  memset(buffer->levels[0], 0, sizeof(float) * OCCLUSION_WIDTH * OCCLUSION_HEIGHT);
+
+  u32 triangles = 0;
+
+  for (auto it = array::begin(buffer->chunks); it != array::end(buffer->chunks); it++) {
+    TerrainChunk *chunk = it->chunk;
+
+    if (!chunk->occluder_stride || it->heights_stride < chunk->occluder_stride) {
+      update_chunk_occluder(chunk, it->heights_stride);
+    }
+
+    triangles += rasterize_occlusion_chunk(buffer, chunk);
+  }
+
+  for (auto it = array::begin(buffer->meshes); it != array::end(buffer->meshes); it++) {
+    triangles += rasterize_occlusion_mesh(buffer, it);
+  }
+
+  build_occlusion_pyramid(buffer);
+
+  buffer->stats.triangles = triangles;
+  buffer->stats.time = (float)((platform.get_performance_counter() - start) * 1000) / (float)platform.get_performance_frequency();
+}
+
+// True when the sphere is behind the rasterized occluders everywhere it
+// covers on screen.
+bool is_sphere_occluded(OcclusionBuffer *buffer, vec3 center, float radius) {
+  if (!buffer->ready) { return false; }
+
+  mat4 &matrix = buffer->view_projection;
+  vec4 clip = matrix * vec4(center, 1.0f);
+
+  float nearest = clip.w - radius;
+  float farthest = clip.w + radius;
+
+  if (nearest < OCCLUSION_NEAR) { return false; }
+
+  // NOTE: x and y of any point in the sphere are at most radius times the
+  // length of their row away from the center
+  float extent_x = radius * glm::length(vec3(matrix[0][0], matrix[1][0], matrix[2][0]));
+  float extent_y = radius * glm::length(vec3(matrix[0][1], matrix[1][1], matrix[2][1]));
+
+  float min_x = glm::min((clip.x - extent_x) / nearest, (clip.x - extent_x) / farthest);
+  float max_x = glm::max((clip.x + extent_x) / nearest, (clip.x + extent_x) / farthest);
+  float min_y = glm::min((clip.y - extent_y) / nearest, (clip.y - extent_y) / farthest);
+  float max_y = glm::max((clip.y + extent_y) / nearest, (clip.y + extent_y) / farthest);
+
+  if (max_x < -1.0f || min_x > 1.0f || max_y < -1.0f || min_y > 1.0f) { return false; }
+
+  int x0 = glm::clamp((int)glm::floor((min_x * 0.5f + 0.5f) * OCCLUSION_WIDTH), 0, OCCLUSION_WIDTH - 1);
+  int x1 = glm::clamp((int)glm::floor((max_x * 0.5f + 0.5f) * OCCLUSION_WIDTH), 0, OCCLUSION_WIDTH - 1);
+  int y0 = glm::clamp((int)glm::floor((min_y * 0.5f + 0.5f) * OCCLUSION_HEIGHT), 0, OCCLUSION_HEIGHT - 1);
+  int y1 = glm::clamp((int)glm::floor((max_y * 0.5f + 0.5f) * OCCLUSION_HEIGHT), 0, OCCLUSION_HEIGHT - 1);
+
+  // The level where the rectangle covers at most 2x2 pixels.
+  u32 level = 0;
+  while (level < OCCLUSION_LEVELS - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+    level++;
+  }
+
+  float *depth = buffer->levels[level];
+  u32 width = OCCLUSION_WIDTH >> level;
+
+  float z = 1.0f / nearest;
+
+  for (int y=y0 >> level; y<=y1 >> level; y++) {
+    for (int x=x0 >> level; x<=x1 >> level; x++) {
+      if (depth[y * width + x] <= z) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+// Runs after update_scene_visibility, the buffer is rasterized until
+// end_occlusion. occluders are the ready OCCLUDER entities in the camera
+// frustum.
+void begin_occlusion(Memory *memory, App *app, Array<u32> *occluders) {
+  OcclusionBuffer *buffer = &app->occlusion;
+
+  buffer->ready = false;
+  buffer->stats.culled_chunks = 0;
+  buffer->stats.culled_entities = 0;
+
+  if (!buffer->enabled) { return; }
+
+  PROFILE_BLOCK("Collect Occluders");
+
+  buffer->view_projection = app->camera.view_matrix;
+
+  array::clear(buffer->chunks);
+  array::clear(buffer->meshes);
+
+  int x_coord = app->camera.position.chunk_x;
+  int y_coord = app->camera.position.chunk_y;
+
+  const int radius = 4;
+
+  for (int y=-radius; y<=radius; y++) {
+    for (int x=-radius; x<=radius; x++) {
+      int chunk_x = x + x_coord;
+      int chunk_y = y + y_coord;
+
+      if (chunk_x < 0 || chunk_y < 0) { continue; }
+
+      TerrainChunk *chunk = find_chunk_at(&app->chunk_cache, chunk_x, chunk_y);
+      if (!chunk || !chunk->heights_stride) { continue; }
+
+      vec3 center = vec3((chunk->x + 0.5f) * CHUNK_SIZE_X, 0.0f, (chunk->y + 0.5f) * CHUNK_SIZE_Y);
+      if (!is_sphere_in_frustum(&app->camera.frustum, center, (float)CHUNK_SIZE_X)) { continue; }
+
+      OcclusionChunk item;
+      item.chunk = chunk;
+      item.heights_stride = chunk->heights_stride;
+      array::push_back(buffer->chunks, item);
+    }
+  }
+
+  mat4 &matrix = buffer->view_projection;
+  float pixel_scale = glm::length(vec3(matrix[0][1], matrix[1][1], matrix[2][1])) * OCCLUSION_HEIGHT * 0.5f;
+
+  for (auto it = array::begin(*occluders); it != array::end(*occluders); it++) {
+    EntityVisibility *visibility = &app->visibility[*it];
+
+    if (visibility->flags & EntityFlags::LOOK_AT_CAMERA) { continue; }
+
+    Mesh *mesh = &visibility->model->mesh;
+    if (mesh->data.indices_count / 3 > OCCLUSION_MAX_OCCLUDER_TRIANGLES) { continue; }
+
+    if (!is_sphere_in_frustum(&app->camera.frustum, visibility->center, visibility->radius)) { continue; }
+
+    float distance = (matrix * vec4(visibility->center, 1.0f)).w;
+    if (distance > OCCLUSION_NEAR && visibility->radius * pixel_scale / distance < OCCLUSION_MIN_OCCLUDER_SIZE) { continue; }
+
+    OcclusionMesh item;
+    item.model = visibility->model_view;
+    item.mesh = mesh;
+    array::push_back(buffer->meshes, item);
+  }
+
+  buffer->stats.chunks = buffer->chunks.size;
+  buffer->stats.meshes = buffer->meshes.size;
+
+  buffer->counter = {};
+  platform.add_work(memory->jobs, JobPriority::FRAME, rasterize_occlusion_work, buffer, &buffer->counter);
+}
+
+void end_occlusion(Memory *memory, App *app) {
+  OcclusionBuffer *buffer = &app->occlusion;
+  if (!buffer->enabled) { return; }
+
+  PROFILE_BLOCK("Wait Occlusion");
+  platform.wait_for_counter(memory->jobs, &buffer->counter);
+
+  buffer->ready = true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Software depth buffer the main camera is culled against, see
+// occlusion.cpp. It stores 1/w so closer is larger and 0 is empty.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+
+// Level 0 is the rasterized buffer, every next level keeps the farthest
+// value of the 2x2 pixels below it.
+#define OCCLUSION_LEVELS 6
+
+// Occluder meshes with more triangles than this aren't rasterized.
+#define OCCLUSION_MAX_OCCLUDER_TRIANGLES 4096
+
+// Occluders smaller than this on screen aren't worth rasterizing, in
+// pixels of level 0.
+#define OCCLUSION_MIN_OCCLUDER_SIZE 8.0f
+
+// Anything closer to the camera than this is always visible.
+#define OCCLUSION_NEAR 0.1f
+
+struct OcclusionChunk {
+  TerrainChunk *chunk;
+
+  // heights_stride when the chunk was collected, only samples at this
+  // stride are read.
+  u32 heights_stride;
+};
+
+struct OcclusionMesh {
+  mat4 model;
+  Mesh *mesh;
+};
+
+struct OcclusionStats {
+  u32 chunks;
+  u32 meshes;
+  u32 triangles;
+
+  u32 culled_chunks;
+  u32 culled_entities;
+
+  float time;
+};
+
+struct OcclusionBuffer {
+  float *levels[OCCLUSION_LEVELS];
+
+  // Clip space of the camera the buffer was rasterized from.
+  mat4 view_projection;
+
+  // Collected on the main thread in begin_occlusion, rasterized on the job
+  // system.
+  Array<OcclusionChunk> chunks;
+  Array<OcclusionMesh> meshes;
+
+  JobCounter counter;
+
+  bool enabled;
+
+  // Rasterized for the current frame, tests pass everything otherwise.
+  bool ready;
+
+  OcclusionStats stats;
+};
@@ -2,6 +2,7 @@
 #include <dlfcn.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <fcntl.h>
 #include <ctype.h>
@@ -112,85 +113,7 @@ DebugReadFileResult debug_read_entire_file(const char *path) {
   return result;
 }
 
-struct WorkEntry {
-  PlatformWorkQueueCallback *callback;
-  void *data;
-};
-
-struct Queue {
-  u32 volatile next_entry_to_write;
-  u32 volatile next_entry_to_read;
-
-  u32 volatile completion_count;
-  u32 volatile completion_goal;
-
-  WorkEntry entries[512];
-
-  SDL_sem *semaphore;
-};
-
-bool do_queue_work(Queue *queue) {
-  bool sleep = false;
-
-  u32 original_next_index = queue->next_entry_to_read;
-  u32 new_next_index = (original_next_index + 1) % array_count(queue->entries);
-
-  if (original_next_index != queue->next_entry_to_write) {
-    SDL_bool value = SDL_AtomicCAS((SDL_atomic_t *)&queue->next_entry_to_read, original_next_index, new_next_index);
-
-    if (value) {
-      WorkEntry *entry = queue->entries + original_next_index;
-      entry->callback(entry->data);
-
-      SDL_AtomicIncRef((SDL_atomic_t *)&queue->completion_count);
-    }
-  } else {
-    sleep = true;
-  }
-
-  return sleep;
-}
-
-static int thread_function(void *data) {
-  Queue *queue = (Queue *)data;
-
-  while (true) {
-    if (do_queue_work(queue)) {
-      SDL_SemWait(queue->semaphore);
-    }
-  }
-}
-
-void add_work(Queue *queue, PlatformWorkQueueCallback *callback, void *data) {
-  u32 new_next_entry_to_write = (queue->next_entry_to_write + 1) % array_count(queue->entries);
-
-  assert(new_next_entry_to_write != queue->next_entry_to_read);
-
-  WorkEntry *entry = queue->entries + queue->next_entry_to_write;
-
-  entry->callback = callback;
-  entry->data = data;
-
-  queue->completion_goal += 1;
-
-  SDL_CompilerBarrier();
-
-  queue->next_entry_to_write = new_next_entry_to_write;
-  SDL_SemPost(queue->semaphore);
-}
-
-void complete_all_work(Queue *queue) {
-  while (queue->completion_goal != queue->completion_count) {
-    do_queue_work(queue);
-  }
-
-  queue->completion_count = 0;
-  queue->completion_goal = 0;
-}
-
-bool queue_has_free_spot(Queue *queue) {
-  return (array_count(queue->entries) - (queue->completion_goal - queue->completion_count)) > 1;
-}
+#include "sdl_jobs.cpp"
 
 u32 get_time() {
   return SDL_GetTicks();
@@ -274,6 +197,38 @@ void write_to_file(PlatformFile file, u64 len, void *value) {
   fwrite(value, 1, len, (FILE *)file.platform);
 }
 
+PlatformMappedFile map_file(char *path) {
+  PlatformMappedFile result = {};
+
+  int file = open(path, O_RDONLY);
+  if (file == -1) {
+    return result;
+  }
+
+  struct stat file_stat;
+
+  if (fstat(file, &file_stat) == 0 && file_stat.st_size > 0) {
+    void *contents = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    if (contents != MAP_FAILED) {
+      madvise(contents, file_stat.st_size, MADV_WILLNEED);
+
+      result.contents = contents;
+      result.size = file_stat.st_size;
+    }
+  }
+
+  close(file);
+
+  return result;
+}
+
+void unmap_file(PlatformMappedFile file) {
+  if (file.contents) {
+    munmap(file.contents, file.size);
+  }
+}
+
 inline void format_string(char* buf, int buf_size, const char* fmt, va_list args) {
   int val = vsnprintf(buf, buf_size, fmt, args);
   if (val == -1 || val >= buf_size) {
@@ -336,19 +291,7 @@ void close_directory(PlatformDirectory directory) {
 }
 
 int main() {
-  Queue main_queue = {};
-  main_queue.semaphore = SDL_CreateSemaphore(0);
-
-  for (int i=0; i<SDL_GetCPUCount(); i++) {
-    SDL_CreateThread(thread_function, "main_worker_thread", &main_queue);
-  }
-
-  Queue low_queue = {};
-  low_queue.semaphore = SDL_CreateSemaphore(0);
-
-  for (int i=0; i<3; i++) {
-    SDL_CreateThread(thread_function, "low_worker_thread", &low_queue);
-  }
+  JobSystem *jobs = create_job_system(SDL_GetCPUCount());
 
   Memory memory;
   memory.width = 1280;
@@ -367,8 +310,10 @@ int main() {
   platform.lock_mouse = lock_mouse;
   platform.unlock_mouse = unlock_mouse;
   platform.add_work = add_work;
+  platform.add_work_after = add_work_after;
+  platform.wait_for_counter = wait_for_counter;
   platform.complete_all_work = complete_all_work;
-  platform.queue_has_free_spot = queue_has_free_spot;
+  platform.get_worker_count = get_worker_count;
 
   platform.open_directory = open_directory;
   platform.read_next_directory_entry = read_next_directory_entry;
@@ -381,13 +326,14 @@ int main() {
   platform.print_to_file = print_to_file;
   platform.create_directory = create_directory;
   platform.get_file_time = get_file_time;
+  platform.map_file = map_file;
+  platform.unmap_file = unmap_file;
   platform.message_box = message_box;
   platform.toggle_fullscreen = toggle_fullscreen;
   platform.atomic_exchange = atomic_exchange;
 
   memory.platform = platform;
-  memory.low_queue = &low_queue;
-  memory.main_queue = &main_queue;
+  memory.jobs = jobs;
 
 #if INTERNAL
   memory.debug_assets_path = (char *)"../../../../";
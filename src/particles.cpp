@@ -0,0 +1,571 @@
+void initialize_particle_system(ParticleSystem *system, u32 capacity) {
+  u32 padded = (capacity + 3) & ~3;
+
+  system->count = 0;
+  system->capacity = padded;
+
+  float **arrays[] = {
+    &system->position_x, &system->position_y, &system->position_z,
+    &system->velocity_x, &system->velocity_y, &system->velocity_z,
+    &system->color_r, &system->color_g, &system->color_b, &system->color_a,
+    &system->size, &system->gravity, &system->life
+  };
+
+  for (u32 i=0; i<array_count(arrays); i++) {
+    *arrays[i] = (float *)calloc(padded, sizeof(float));
+  }
+
+  system->owner = (u8 *)malloc(padded);
+  memset(system->owner, PARTICLE_NO_SLICE, padded);
+
+  for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+    system->slices[i] = {};
+  }
+
+  system->keys = (u32 *)calloc(padded, sizeof(u32));
+  system->order = (u32 *)calloc(padded, sizeof(u32));
+  system->order_scratch = (u32 *)calloc(padded, sizeof(u32));
+  system->sorted_count = 0;
+
+  system->draw_positions = (vec4 *)calloc(padded, sizeof(vec4));
+  system->draw_colors = (vec4 *)calloc(padded, sizeof(vec4));
+}
+
+void free_particle_slice(ParticleSystem *system, ParticleSlice *slice) {
+  memset(system->owner + slice->first, PARTICLE_NO_SLICE, slice->capacity);
+
+  system->count -= slice->alive;
+  system->sorted_count = 0;
+
+  *slice = {};
+}
+
+// First fit over the gaps between the allocated slices. Returns false when
+// no gap is big enough, the emitter doesn't spawn then.
+bool allocate_particle_slice(ParticleSystem *system, ParticleSlice *slice, Pid emitter, u32 capacity) {
+  u32 first = 0;
+
+  // NOTE: first only moves forward past slices it overlaps, so this ends
+  for (bool moved = true; moved;) {
+    moved = false;
+
+    for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+      ParticleSlice *other = &system->slices[i];
+      if (!other->allocated) { continue; }
+
+      if (first < other->first + other->capacity && other->first < first + capacity) {
+        first = other->first + other->capacity;
+        moved = true;
+      }
+    }
+  }
+
+  if (first + capacity > system->capacity) { return false; }
+
+  *slice = {};
+  slice->emitter = emitter;
+  slice->allocated = true;
+  slice->first = first;
+  slice->capacity = capacity;
+
+  memset(system->owner + first, (u8)(slice - system->slices), capacity);
+  system->sorted_count = 0;
+
+  return true;
+}
+
+void clear_particles(ParticleSystem *system) {
+  for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+    if (system->slices[i].allocated) {
+      free_particle_slice(system, &system->slices[i]);
+    }
+  }
+}
+
+void begin_particle_emitters(ParticleSystem *system) {
+  for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+    system->slices[i].used = false;
+  }
+}
+
+// Frees the slices of emitters that weren't updated this frame.
+void end_particle_emitters(ParticleSystem *system) {
+  for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+    ParticleSlice *slice = &system->slices[i];
+
+    if (slice->allocated && !slice->used) {
+      free_particle_slice(system, slice);
+    }
+  }
+}
+
+// Finds the emitter's slice, reallocating it when the budget changed.
+// Returns NULL when there's no room for it.
+ParticleSlice *get_emitter_slice(ParticleSystem *system, EntityParticleEmitter *emitter) {
+  u32 capacity = glm::clamp((emitter->max_particles + 3) & ~3, 4u, system->capacity);
+  Pid id = emitter->header.id;
+
+  ParticleSlice *slice = NULL;
+  u32 hint = emitter->particle_slice;
+
+  if (hint < MAX_PARTICLE_SLICES && system->slices[hint].allocated && system->slices[hint].emitter == id) {
+    slice = &system->slices[hint];
+  } else {
+    for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+      if (system->slices[i].allocated && system->slices[i].emitter == id) {
+        slice = &system->slices[i];
+        break;
+      }
+    }
+  }
+
+  if (slice && slice->capacity != capacity) {
+    free_particle_slice(system, slice);
+    slice = NULL;
+  }
+
+  if (!slice) {
+    for (u32 i=0; i<MAX_PARTICLE_SLICES; i++) {
+      if (!system->slices[i].allocated) {
+        slice = &system->slices[i];
+        break;
+      }
+    }
+
+    if (!slice || !allocate_particle_slice(system, slice, id, capacity)) {
+      return NULL;
+    }
+  }
+
+  emitter->particle_slice = (u32)(slice - system->slices);
+  slice->used = true;
+
+  return slice;
+}
+
+// Returns false when the slice is full and the particle was dropped.
+bool emit_particle(ParticleSystem *system, ParticleSlice *slice, vec3 position, vec3 velocity, vec4 color, float size, float gravity, float life) {
+  if (slice->alive == slice->capacity) { return false; }
+
+  u32 i = slice->first + slice->alive++;
+  system->count += 1;
+
+  system->position_x[i] = position.x;
+  system->position_y[i] = position.y;
+  system->position_z[i] = position.z;
+
+  system->velocity_x[i] = velocity.x;
+  system->velocity_y[i] = velocity.y;
+  system->velocity_z[i] = velocity.z;
+
+  system->color_r[i] = color.r;
+  system->color_g[i] = color.g;
+  system->color_b[i] = color.b;
+  system->color_a[i] = color.a;
+
+  system->size[i] = size;
+  system->gravity[i] = gravity;
+  system->life[i] = life;
+
+  return true;
+}
+
+// Spawns the emitter's particles for this frame at its spawn rate. The
+// frustum is last frame's and the bounds are from the last update.
+void update_particle_emitter(ParticleSystem *system, EntityParticleEmitter *emitter, Frustum *frustum, float delta_time) {
+  ParticleSlice *slice = get_emitter_slice(system, emitter);
+  if (!slice) { return; }
+
+  vec3 position = get_world_position(emitter->header.position);
+  slice->origin = position;
+
+  Box bounds = { position, position };
+  if (slice->alive) {
+    bounds = box_union(bounds, slice->bounds);
+  }
+
+  slice->visible = test_box_in_frustum(frustum, bounds) != FrustumTest::OUTSIDE;
+  if (!slice->visible) { return; }
+
+  slice->spawn_accumulator += emitter->spawn_rate * delta_time;
+
+  u32 spawn_count = (u32)slice->spawn_accumulator;
+  slice->spawn_accumulator -= (float)spawn_count;
+
+  for (u32 i=0; i<spawn_count; i++) {
+    vec3 velocity = vec3(get_random_float_between(-5.0f, 5.0f), get_random_float_between(0.0f, 10.0f), get_random_float_between(-5.0f, 5.0f));
+
+    if (!emit_particle(system, slice, position, velocity, emitter->initial_color, emitter->particle_size, emitter->gravity, emitter->lifetime)) {
+      break;
+    }
+  }
+}
+
+inline void move_particle(ParticleSystem *system, u32 to, u32 from) {
+  system->position_x[to] = system->position_x[from];
+  system->position_y[to] = system->position_y[from];
+  system->position_z[to] = system->position_z[from];
+
+  system->velocity_x[to] = system->velocity_x[from];
+  system->velocity_y[to] = system->velocity_y[from];
+  system->velocity_z[to] = system->velocity_z[from];
+
+  system->color_r[to] = system->color_r[from];
+  system->color_g[to] = system->color_g[from];
+  system->color_b[to] = system->color_b[from];
+  system->color_a[to] = system->color_a[from];
+
+  system->size[to] = system->size[from];
+  system->gravity[to] = system->gravity[from];
+  system->life[to] = system->life[from];
+}
+
+void integrate_particles(ParticleSystem *system, u32 start, u32 end, float delta_time) {
+  float velocity_decay = 1.0f - delta_time;
+  float alpha_decay = 1.0f - delta_time * 4.0f;
+  float shrink = 0.6f * delta_time;
+
+  u32 i = start;
+
+#ifdef USE_SSE2
+  __m128 dt = _mm_set1_ps(delta_time);
+  __m128 velocity_scale = _mm_set1_ps(velocity_decay);
+  __m128 alpha_scale = _mm_set1_ps(alpha_decay);
+  __m128 shrink_by = _mm_set1_ps(shrink);
+  __m128 zero = _mm_setzero_ps();
+
+  // NOTE: the last group can run past end into the rest of the slice, those
+  // lanes are never read
+  for (; i<end; i += 4) {
+    __m128 vx = _mm_loadu_ps(system->velocity_x + i);
+    __m128 vy = _mm_loadu_ps(system->velocity_y + i);
+    __m128 vz = _mm_loadu_ps(system->velocity_z + i);
+
+    vy = _mm_add_ps(vy, _mm_mul_ps(_mm_loadu_ps(system->gravity + i), dt));
+
+    _mm_storeu_ps(system->position_x + i, _mm_add_ps(_mm_loadu_ps(system->position_x + i), _mm_mul_ps(vx, dt)));
+    _mm_storeu_ps(system->position_y + i, _mm_add_ps(_mm_loadu_ps(system->position_y + i), _mm_mul_ps(vy, dt)));
+    _mm_storeu_ps(system->position_z + i, _mm_add_ps(_mm_loadu_ps(system->position_z + i), _mm_mul_ps(vz, dt)));
+
+    _mm_storeu_ps(system->velocity_x + i, _mm_mul_ps(vx, velocity_scale));
+    _mm_storeu_ps(system->velocity_y + i, _mm_mul_ps(vy, velocity_scale));
+    _mm_storeu_ps(system->velocity_z + i, _mm_mul_ps(vz, velocity_scale));
+
+    _mm_storeu_ps(system->size + i, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(system->size + i), shrink_by), zero));
+    _mm_storeu_ps(system->color_a + i, _mm_mul_ps(_mm_loadu_ps(system->color_a + i), alpha_scale));
+    _mm_storeu_ps(system->life + i, _mm_sub_ps(_mm_loadu_ps(system->life + i), dt));
+  }
+#else
+  for (; i<end; i++) {
+    system->velocity_y[i] += system->gravity[i] * delta_time;
+
+    system->position_x[i] += system->velocity_x[i] * delta_time;
+    system->position_y[i] += system->velocity_y[i] * delta_time;
+    system->position_z[i] += system->velocity_z[i] * delta_time;
+
+    system->velocity_x[i] *= velocity_decay;
+    system->velocity_y[i] *= velocity_decay;
+    system->velocity_z[i] *= velocity_decay;
+
+    system->size[i] = glm::max(system->size[i] - shrink, 0.0f);
+    system->color_a[i] *= alpha_decay;
+    system->life[i] -= delta_time;
+  }
+#endif
+}
+
+// Integrates the live particles of visible slices and swap-removes the ones
+// that expired, faded out or shrank away.
+void update_particles(ParticleSystem *system, float delta_time) {
+  PROFILE_BLOCK("Update particles", system->count);
+
+  system->count = 0;
+
+  for (u32 s=0; s<MAX_PARTICLE_SLICES; s++) {
+    ParticleSlice *slice = &system->slices[s];
+    if (!slice->allocated) { continue; }
+
+    if (slice->visible) {
+      integrate_particles(system, slice->first, slice->first + slice->alive, delta_time);
+
+      Box bounds = { slice->origin, slice->origin };
+
+      for (u32 i=slice->first; i<slice->first + slice->alive;) {
+        if (system->life[i] <= 0.0f || system->size[i] <= 0.0f || system->color_a[i] < PARTICLE_MIN_ALPHA) {
+          slice->alive -= 1;
+          move_particle(system, i, slice->first + slice->alive);
+        } else {
+          vec3 position = vec3(system->position_x[i], system->position_y[i], system->position_z[i]);
+          bounds.min = glm::min(bounds.min, position - system->size[i]);
+          bounds.max = glm::max(bounds.max, position + system->size[i]);
+          i++;
+        }
+      }
+
+      slice->bounds = bounds;
+    }
+
+    system->count += slice->alive;
+  }
+}
+
+void compute_particle_keys(ParticleSystem *system, u32 start, u32 end, vec3 camera_position) {
+  u32 i = start;
+
+#ifdef USE_SSE2
+  __m128 camera_x = _mm_set1_ps(camera_position.x);
+  __m128 camera_y = _mm_set1_ps(camera_position.y);
+  __m128 camera_z = _mm_set1_ps(camera_position.z);
+  __m128i invert = _mm_set1_epi32(-1);
+
+  // NOTE: squared distances are never negative so their bits order the
+  // same way as the floats, inverting them puts the farthest first
+  for (; i<end; i += 4) {
+    __m128 x = _mm_sub_ps(_mm_loadu_ps(system->position_x + i), camera_x);
+    __m128 y = _mm_sub_ps(_mm_loadu_ps(system->position_y + i), camera_y);
+    __m128 z = _mm_sub_ps(_mm_loadu_ps(system->position_z + i), camera_z);
+
+    __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+
+    _mm_storeu_si128((__m128i *)(system->keys + i), _mm_xor_si128(_mm_castps_si128(distance), invert));
+  }
+#else
+  for (; i<end; i++) {
+    vec3 offset = vec3(system->position_x[i], system->position_y[i], system->position_z[i]) - camera_position;
+
+    float distance = glm::length2(offset);
+    u32 bits;
+    memcpy(&bits, &distance, sizeof(bits));
+
+    system->keys[i] = ~bits;
+  }
+#endif
+}
+
+inline bool is_particle_live(ParticleSystem *system, u32 index) {
+  u8 owner = system->owner[index];
+  if (owner == PARTICLE_NO_SLICE) { return false; }
+
+  ParticleSlice *slice = &system->slices[owner];
+  return index - slice->first < slice->alive;
+}
+
+// LSD radix sort of the live particles by key, one byte per pass, same as
+// the render group one but over indices.
+void radix_sort_particles(ParticleSystem *system) {
+  u32 count = 0;
+  u32 *keys = system->keys;
+
+  for (u32 s=0; s<MAX_PARTICLE_SLICES; s++) {
+    ParticleSlice *slice = &system->slices[s];
+
+    for (u32 i=slice->first; i<slice->first + slice->alive; i++) {
+      system->order[count++] = i;
+    }
+  }
+
+  if (count < 2) { return; }
+
+  u32 histograms[4][256] = {};
+
+  for (u32 i=0; i<count; i++) {
+    u32 key = keys[system->order[i]];
+    for (u32 pass=0; pass<4; pass++) {
+      histograms[pass][(key >> (pass * 8)) & 0xFF] += 1;
+    }
+  }
+
+  u32 *source = system->order;
+  u32 *destination = system->order_scratch;
+
+  for (u32 pass=0; pass<4; pass++) {
+    u32 shift = pass * 8;
+    u32 *histogram = histograms[pass];
+
+    if (histogram[(keys[source[0]] >> shift) & 0xFF] == count) { continue; }
+
+    u32 offset = 0;
+    for (u32 i=0; i<256; i++) {
+      u32 digit_count = histogram[i];
+      histogram[i] = offset;
+      offset += digit_count;
+    }
+
+    for (u32 i=0; i<count; i++) {
+      u32 digit = (keys[source[i]] >> shift) & 0xFF;
+      destination[histogram[digit]++] = source[i];
+    }
+
+    std::swap(source, destination);
+  }
+
+  if (source != system->order) {
+    memcpy(system->order, source, count * sizeof(u32));
+  }
+}
+
+// Patches up the previous frame's order. Live particles always occupy the
+// front of their slice, so dropping the indices that aren't live anymore and
+// appending the ones past each slice's sorted_alive gives a valid order that
+// is mostly sorted already. Returns false when it ran out of moves and the
+// order has to be sorted from scratch.
+bool resort_particles(ParticleSystem *system) {
+  u32 count = 0;
+  u32 *order = system->order;
+  u32 *keys = system->keys;
+
+  for (u32 i=0; i<system->sorted_count; i++) {
+    if (is_particle_live(system, order[i])) {
+      order[count++] = order[i];
+    }
+  }
+
+  for (u32 s=0; s<MAX_PARTICLE_SLICES; s++) {
+    ParticleSlice *slice = &system->slices[s];
+
+    for (u32 i=slice->first + slice->sorted_alive; i<slice->first + slice->alive; i++) {
+      order[count++] = i;
+    }
+  }
+
+  u32 moves = 0;
+  u32 budget = system->count * PARTICLE_RESORT_MOVES;
+
+  for (u32 i=1; i<count; i++) {
+    u32 index = order[i];
+    u32 key = keys[index];
+
+    u32 j = i;
+    while (j > 0 && keys[order[j - 1]] > key) {
+      order[j] = order[j - 1];
+      j--;
+    }
+
+    order[j] = index;
+
+    moves += i - j;
+    if (moves > budget) { return false; }
+  }
+
+  return true;
+}
+
+// Fills the draw arrays with the live particles, farthest from the camera
+// first.
+void sort_particles(ParticleSystem *system, vec3 camera_position) {
+  PROFILE_BLOCK("Sort particles", system->count);
+
+  for (u32 s=0; s<MAX_PARTICLE_SLICES; s++) {
+    ParticleSlice *slice = &system->slices[s];
+    compute_particle_keys(system, slice->first, slice->first + slice->alive, camera_position);
+  }
+
+  bool coherent = system->sorted_count && glm::length2(camera_position - system->sorted_camera) < PARTICLE_RESORT_CAMERA_DISTANCE * PARTICLE_RESORT_CAMERA_DISTANCE;
+
+  if (!coherent || !resort_particles(system)) {
+    radix_sort_particles(system);
+  }
+
+  for (u32 s=0; s<MAX_PARTICLE_SLICES; s++) {
+    system->slices[s].sorted_alive = system->slices[s].alive;
+  }
+
+  system->sorted_count = system->count;
+  system->sorted_camera = camera_position;
+
+  for (u32 i=0; i<system->count; i++) {
+    u32 index = system->order[i];
+
+    system->draw_positions[i] = vec4(system->position_x[index], system->position_y[index], system->position_z[index], system->size[index]);
+    system->draw_colors[i] = vec4(system->color_r[index], system->color_g[index], system->color_b[index], system->color_a[index]);
+  }
+}
+
+static const char *gpu_particle_varyings[] = {
+  "out_position",
+  "out_velocity",
+  "out_color",
+};
+
+// Kills every particle.
+void reset_gpu_particles(GpuParticleSystem *system) {
+  GpuParticle *zeroes = (GpuParticle *)calloc(system->capacity, sizeof(GpuParticle));
+
+  for (u32 i=0; i<2; i++) {
+    gl_bind_buffer(GL_ARRAY_BUFFER, system->buffers[i]);
+    glBufferData(GL_ARRAY_BUFFER, system->capacity * sizeof(GpuParticle), zeroes, GL_STREAM_COPY);
+  }
+
+  free(zeroes);
+
+  system->current = 0;
+  system->next_slot = 0;
+  system->emitter_count = 0;
+}
+
+// Leaves the system unsupported on contexts without transform feedback, the
+// CPU system is used there.
+void initialize_gpu_particles(GpuParticleSystem *system, u32 capacity) {
+  system->supported = GLEW_VERSION_3_0 && glBeginTransformFeedback != NULL;
+  system->enabled = false;
+  system->capacity = capacity;
+
+  if (!system->supported) { return; }
+
+  glGenBuffers(2, system->buffers);
+  reset_gpu_particles(system);
+}
+
+// Returns false when too many emitters were queued this frame.
+bool queue_gpu_particle_emitter(GpuParticleSystem *system, vec3 position, vec4 color, float size, float gravity) {
+  if (system->emitter_count == MAX_GPU_PARTICLE_EMITTERS) { return false; }
+
+  u32 i = system->emitter_count++;
+  system->emitter_positions[i] = vec4(position, size);
+  system->emitter_colors[i] = color;
+  system->emitter_gravity[i] = gravity;
+
+  return true;
+}
+
+void simulate_gpu_particles(App *app, float delta_time) {
+  PROFILE_BLOCK("Simulate GPU particles");
+
+  GpuParticleSystem *system = &app->gpu_particles;
+  GLuint source = system->buffers[system->current];
+  GLuint destination = system->buffers[system->current ^ 1];
+
+  use_program(app, &app->particle_update_program);
+  Shader *shader = app->current_program;
+
+  set_uniformf(shader, "delta_time", delta_time);
+  set_uniformi(shader, "seed", (int)system->frame++);
+  set_uniformi(shader, "capacity", (int)system->capacity);
+  set_uniformi(shader, "emit_start", (int)system->next_slot);
+  set_uniformi(shader, "emit_count", (int)system->emitter_count);
+
+  if (system->emitter_count) {
+    set_uniform_array(shader, "emitter_positions[0]", system->emitter_positions, system->emitter_count);
+    set_uniform_array(shader, "emitter_colors[0]", system->emitter_colors, system->emitter_count);
+    set_uniform_array(shader, "emitter_gravity[0]", system->emitter_gravity, system->emitter_count);
+  }
+
+  gl_bind_buffer(GL_ARRAY_BUFFER, source);
+  gl_vertex_attrib_pointer(shader_get_attribute_location(shader, "position"), 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void *)offsetof(GpuParticle, position));
+  gl_vertex_attrib_pointer(shader_get_attribute_location(shader, "velocity"), 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void *)offsetof(GpuParticle, velocity));
+  gl_vertex_attrib_pointer(shader_get_attribute_location(shader, "color"), 4, GL_FLOAT, GL_FALSE, sizeof(GpuParticle), (void *)offsetof(GpuParticle, color));
+
+  glEnable(GL_RASTERIZER_DISCARD);
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, destination);
+
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, system->capacity);
+  glEndTransformFeedback();
+
+  glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  system->current ^= 1;
+  system->next_slot = (system->next_slot + system->emitter_count) % system->capacity;
+  system->emitter_count = 0;
+}
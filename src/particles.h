@@ -0,0 +1,124 @@
+#pragma once
+
+#define MAX_PARTICLES 16384
+#define MAX_PARTICLE_SLICES 64
+#define PARTICLE_NO_SLICE 0xFF
+
+// Particles this transparent or small are removed.
+#define PARTICLE_MIN_ALPHA (1.0f / 255.0f)
+
+// The previous frame's order is only patched up with an insertion sort when
+// the camera moved less than this since the last sort, and is given up on
+// after this many moves per particle on average.
+#define PARTICLE_RESORT_CAMERA_DISTANCE 0.25f
+#define PARTICLE_RESORT_MOVES 4
+
+// Part of the store owned by one emitter, sized by its max_particles. Live
+// particles are the first alive entries of the slice. first and capacity
+// are multiples of four so the update can run four particles at a time
+// without leaving the slice.
+struct ParticleSlice {
+  Pid emitter;
+  bool allocated;
+
+  // Set when the emitter was seen this frame, slices that weren't are freed
+  // by end_particle_emitters.
+  bool used;
+
+  // Slices outside the frustum neither spawn nor simulate.
+  bool visible;
+
+  u32 first;
+  u32 capacity;
+  u32 alive;
+
+  // alive when the order was last sorted.
+  u32 sorted_alive;
+
+  float spawn_accumulator;
+
+  // Emitter position and its live particles after the last update.
+  vec3 origin;
+  Box bounds;
+};
+
+// Structure of arrays split into per emitter slices. count is the number
+// of live particles in all slices.
+struct ParticleSystem {
+  u32 count;
+  u32 capacity;
+
+  ParticleSlice slices[MAX_PARTICLE_SLICES];
+
+  // Slice of every entry of the store, PARTICLE_NO_SLICE when it's free.
+  u8 *owner;
+
+  float *position_x;
+  float *position_y;
+  float *position_z;
+
+  float *velocity_x;
+  float *velocity_y;
+  float *velocity_z;
+
+  float *color_r;
+  float *color_g;
+  float *color_b;
+  float *color_a;
+
+  float *size;
+  float *gravity;
+
+  // Seconds left.
+  float *life;
+
+  // Filled by sort_particles, back to front. Keys are the inverted bits of
+  // the squared camera distance so they sort ascending as integers.
+  u32 *keys;
+  u32 *order;
+  u32 *order_scratch;
+
+  // 0 when the order has to be sorted from scratch.
+  u32 sorted_count;
+  vec3 sorted_camera;
+
+  // Positions have the size in w.
+  vec4 *draw_positions;
+  vec4 *draw_colors;
+};
+
+#define MAX_GPU_PARTICLES 16384
+
+// Keep in sync with MAX_EMITTERS in particle_update.vert.
+#define MAX_GPU_PARTICLE_EMITTERS 64
+
+// Layout of the transform feedback buffers, interleaved the way
+// particle_update.vert writes them.
+struct GpuParticle {
+  vec4 position; // size in w
+  vec4 velocity; // gravity in w
+  vec4 color;
+};
+
+// Particles simulated by particle_update.vert, ping-ponging between two
+// buffers. The CPU only sends the emitters queued this frame, every emitter
+// takes the oldest slot of the ring. Dead particles stay in their slots and
+// are drawn collapsed, and the particles aren't sorted.
+struct GpuParticleSystem {
+  bool supported;
+  bool enabled;
+
+  u32 capacity;
+  GLuint buffers[2];
+
+  // Buffer with the latest state.
+  u32 current;
+
+  u32 next_slot;
+  u32 frame;
+
+  u32 emitter_count;
+  vec4 emitter_positions[MAX_GPU_PARTICLE_EMITTERS];
+  vec4 emitter_colors[MAX_GPU_PARTICLE_EMITTERS];
+  float emitter_gravity[MAX_GPU_PARTICLE_EMITTERS];
+};
@@ -17,3 +17,11 @@ enum FrustumPlaneType {
   NearPlane = 4,
   FarPlane = 5
 };
+
+namespace FrustumTest {
+  enum FrustumTest {
+    OUTSIDE,
+    INTERSECTS,
+    INSIDE
+  };
+}
@@ -5,6 +5,7 @@ typedef uint32_t u32;
 typedef uint64_t u64;
 
 typedef int8_t s8;
+typedef int16_t s16;
 typedef int32_t s32;
 typedef int64_t s64;
 
@@ -77,6 +78,12 @@ extern "C" {
     bool error;
   };
 
+  // Read only view of a whole file.
+  struct PlatformMappedFile {
+    void *contents;
+    u64 size;
+  };
+
   struct DebugReadFileResult {
     u32 fileSize;
     char *contents;
@@ -90,10 +97,35 @@ extern "C" {
 
   typedef DebugReadFileResult debugReadEntireFileType(const char *name);
   typedef void debugFreeFileType(DebugReadFileResult file);
+  namespace JobPriority {
+    enum JobPriority {
+      // Work the current frame waits on, the only jobs wait_for_counter
+      // helps out with.
+      FRAME,
+      HIGH,
+      NORMAL,
+      LOW,
+
+      COUNT
+    };
+  }
+
+  // Counts unfinished jobs that were submitted with it. Jobs added with
+  // add_work_after are queued once the dependency counter reaches zero.
+  // A counter has to outlive the wait_for_counter call on it, after that
+  // no job touches it and it can go out of scope.
+  struct JobCounter {
+    u32 volatile value;
+    u32 volatile lock;
+    void *volatile waiting;
+  };
+
   typedef void PlatformWorkQueueCallback(void *data);
-  typedef void add_work_type(struct Queue *queue, PlatformWorkQueueCallback *callback, void *data);
-  typedef void complete_all_work_type(struct Queue *queue);
-  typedef bool queue_has_free_spot_type(struct Queue *queue);
+  typedef void add_work_type(struct JobSystem *jobs, u32 priority, PlatformWorkQueueCallback *callback, void *data, JobCounter *counter);
+  typedef void add_work_after_type(struct JobSystem *jobs, JobCounter *dependency, u32 priority, PlatformWorkQueueCallback *callback, void *data, JobCounter *counter);
+  typedef void wait_for_counter_type(struct JobSystem *jobs, JobCounter *counter);
+  typedef void complete_all_work_type(struct JobSystem *jobs);
+  typedef u32 get_worker_count_type(struct JobSystem *jobs);
   typedef u32 get_time_type();
   typedef u64 get_performance_counter_type();
   typedef u64 get_performance_frequency_type();
@@ -112,14 +144,18 @@ extern "C" {
   typedef void print_to_file_type(PlatformFile file, const char *format, ...);
   typedef void create_directory_type(char *path);
   typedef u64 get_file_time_type(char *path);
+  typedef PlatformMappedFile map_file_type(char *path);
+  typedef void unmap_file_type(PlatformMappedFile file);
   typedef void message_box_type(const char *title, const char *format, ...);
   typedef void toggle_fullscreen_type();
   typedef bool atomic_exchange_type(u32 volatile *atomic, u32 old_value, u32 new_value);
 
   struct PlatformAPI {
     add_work_type *add_work;
+    add_work_after_type *add_work_after;
+    wait_for_counter_type *wait_for_counter;
     complete_all_work_type *complete_all_work;
-    queue_has_free_spot_type *queue_has_free_spot;
+    get_worker_count_type *get_worker_count;
     debugReadEntireFileType *debug_read_entire_file;
     debugFreeFileType *debug_free_file;
     get_time_type *get_time;
@@ -143,6 +179,8 @@ extern "C" {
     close_file_type *close_file;
     read_file_line_type *read_file_line;
     close_directory_type *close_directory;
+    map_file_type *map_file;
+    unmap_file_type *unmap_file;
   };
 
   struct DebugCounter {
@@ -159,8 +197,7 @@ extern "C" {
 
     struct App *app;
 
-    Queue *main_queue;
-    Queue *low_queue;
+    JobSystem *jobs;
 
     PlatformAPI platform;
 
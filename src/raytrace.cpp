@@ -16,8 +16,8 @@ RayMatchResult ray_match_terrain(App *app, Ray ray) {
   PROFILE_BLOCK("Ray Terrain");
   RayMatchResult result;
 
-  for (u32 i=0; i<app->chunk_cache_count; i++) {
-    TerrainChunk *chunk = app->chunk_cache + i;
+  for (u32 i=0; i<app->chunk_cache.count; i++) {
+    TerrainChunk *chunk = app->chunk_cache.chunks + i;
     if (chunk->initialized) {
       Model *model = NULL;
 
@@ -42,24 +42,13 @@ RayMatchResult ray_match_terrain(App *app, Ray ray) {
         vec3 start = vec3(res * vec4(ray.start, 1.0f));
         vec3 direction = vec3(res * vec4(ray.direction, 0.0f));
 
-        ModelData mesh = model->mesh.data;
+        u32 level = model - chunk->models;
+        TerrainLodIndices *lod = app->terrain_indices + level;
 
-        for (u32 i=0; i<mesh.indices_count; i += 3) {
-          int indices_a = mesh.indices[i + 0] * 3;
-          int indices_b = mesh.indices[i + 1] * 3;
-          int indices_c = mesh.indices[i + 2] * 3;
-
-          vec3 a = vec3(mesh.vertices[indices_a + 0],
-              mesh.vertices[indices_a + 1],
-              mesh.vertices[indices_a + 2]);
-
-          vec3 b = vec3(mesh.vertices[indices_b + 0],
-              mesh.vertices[indices_b + 1],
-              mesh.vertices[indices_b + 2]);
-
-          vec3 c = vec3(mesh.vertices[indices_c + 0],
-              mesh.vertices[indices_c + 1],
-              mesh.vertices[indices_c + 2]);
+        for (u32 i=0; i<lod->full_count; i += 3) {
+          vec3 a = terrain_vertex_position(model, level, lod->indices[i + 0]);
+          vec3 b = terrain_vertex_position(model, level, lod->indices[i + 1]);
+          vec3 c = terrain_vertex_position(model, level, lod->indices[i + 2]);
 
           vec3 result_position;
 
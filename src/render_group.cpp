@@ -1,81 +1,172 @@
 #include "render_group.h"
 
-bool sort_function(const RenderCommand &a, const RenderCommand &b) {
-  int depth_a = (a.flags & EntityFlags::RENDER_IGNORE_DEPTH) != 0 ? 1 : 0;
-  int depth_b = (b.flags & EntityFlags::RENDER_IGNORE_DEPTH) != 0 ? 1 : 0;
+// Sort keys are packed from the most significant bit as
+//   layer 4 | ignore depth 1 | shader 8 | texture 12 | mesh 15 | depth 24
+// so draws sharing state end up next to each other and go front to back
+// within a mesh. GL names stand in for the pointers, a collision only costs
+// a state change.
+#define SORT_KEY_DEPTH_BITS 24
+
+u64 make_sort_key(RenderGroup *group, RenderCommand *command) {
+  u64 ignore_depth = (command->flags & EntityFlags::RENDER_IGNORE_DEPTH) != 0 ? 1 : 0;
+
+  // NOTE: the shader is the same for every draw when it's forced
+  u64 shader = group->force_shader ? 0 : command->shader->id;
+  u64 texture = command->texture ? command->texture->id : 0;
+  u64 mesh = command->model_mesh->vao;
+
+  float far = group->camera ? group->camera->far : 1.0f;
+  float depth = glm::clamp(command->distance_from_camera / far, 0.0f, 1.0f);
+  u64 quantized_depth = (u64)(depth * (float)((1 << SORT_KEY_DEPTH_BITS) - 1));
+
+  return ((u64)(command->layer & 0xF) << 60) |
+         (ignore_depth << 59) |
+         ((shader & 0xFF) << 51) |
+         ((texture & 0xFFF) << 39) |
+         ((mesh & 0x7FFF) << 24) |
+         quantized_depth;
+}
 
-  if (depth_a < depth_b) { return true; }
-  if (depth_b < depth_a) { return false; }
+// LSD radix sort, one byte per pass. The histograms for all passes are
+// built in one go and passes where every key has the same byte are skipped.
+// The sorted entries end up back in entries.
+void radix_sort(RenderSortEntry *entries, RenderSortEntry *scratch, u32 count) {
+  if (count < 2) { return; }
 
-  if (a.shader < b.shader) { return true; }
-  if (b.shader < a.shader) { return false; }
+  u32 histograms[8][256] = {};
 
-  if (a.texture < b.texture) { return true; }
-  if (b.texture < a.texture) { return false; }
+  for (u32 i=0; i<count; i++) {
+    u64 key = entries[i].key;
+    for (u32 pass=0; pass<8; pass++) {
+      histograms[pass][(key >> (pass * 8)) & 0xFF] += 1;
+    }
+  }
 
-  if (a.model_mesh < b.model_mesh) { return true; }
-  if (b.model_mesh < a.model_mesh) { return false; }
+  RenderSortEntry *source = entries;
+  RenderSortEntry *destination = scratch;
 
-  return false;
-}
+  for (u32 pass=0; pass<8; pass++) {
+    u32 shift = pass * 8;
+    u32 *histogram = histograms[pass];
+
+    if (histogram[(source[0].key >> shift) & 0xFF] == count) { continue; }
+
+    u32 offset = 0;
+    for (u32 i=0; i<256; i++) {
+      u32 digit_count = histogram[i];
+      histogram[i] = offset;
+      offset += digit_count;
+    }
 
-bool depth_record_sort_function(const RenderCommand &a, const RenderCommand &b) {
-  if (a.texture < b.texture) { return true; }
-  if (b.texture < a.texture) { return false; }
+    for (u32 i=0; i<count; i++) {
+      u32 digit = (source[i].key >> shift) & 0xFF;
+      destination[histogram[digit]++] = source[i];
+    }
 
-  if (a.model_mesh < b.model_mesh) { return true; }
-  if (b.model_mesh < a.model_mesh) { return false; }
+    std::swap(source, destination);
+  }
 
-  return false;
+  if (source != entries) {
+    memcpy(entries, source, count * sizeof(RenderSortEntry));
+  }
 }
 
 void start_render_group(RenderGroup *group) {
   array::clear(group->commands);
 }
 
-inline void set_depth_mode(RenderGroup *group, GLenum mode, bool force=false) {
-  if (force || group->depth_mode != mode) {
-    glDepthFunc(mode);
-    group->depth_mode = mode;
-  }
-}
-
 void change_shader(RenderGroup *group, App *app, Shader *shader) {
   use_program(app, shader);
 
-  if (shader_has_uniform(app->current_program, "eye_position")) {
-    set_uniform(app->current_program, "eye_position", get_world_position(app->camera.position));
+  if (shader_has_uniform(app->current_program, Uniform::EYE_POSITION)) {
+    set_uniform(app->current_program, Uniform::EYE_POSITION, get_world_position(app->camera.position));
   }
 
-  if (shader_has_uniform(app->current_program, "uPMatrix")) {
-    set_uniform(app->current_program, "uPMatrix", group->camera->view_matrix);
+  if (shader_has_uniform(app->current_program, Uniform::P_MATRIX)) {
+    set_uniform(app->current_program, Uniform::P_MATRIX, group->camera->view_matrix);
   }
 
-  if (shader_has_uniform(app->current_program, "uShadow")) {
-    set_uniformi(app->current_program, "uShadow", 0);
+  if (shader_has_uniform(app->current_program, Uniform::SHADOW)) {
+    set_uniformi(app->current_program, Uniform::SHADOW, 0);
   }
 
-  if (shader_has_uniform(app->current_program, "shadow_matrix")) {
-    set_uniform(app->current_program, "shadow_matrix", app->shadow_camera.view_matrix);
+  if (shader_has_uniform(app->current_program, Uniform::SHADOW_MATRICES)) {
+    set_uniform_array(app->current_program, Uniform::SHADOW_MATRICES, app->shadow_matrices, SHADOW_CASCADES);
   }
 
-  if (shader_has_uniform(app->current_program, "texmapscale")) {
-    set_uniform(app->current_program, "texmapscale", vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
+  if (shader_has_uniform(app->current_program, Uniform::TEXMAPSCALE)) {
+    set_uniform(app->current_program, Uniform::TEXMAPSCALE, vec2(1.0f / app->shadow_width, 1.0f / app->shadow_height));
   }
 
-  if (shader_has_uniform(app->current_program, "shadow_light_position")) {
-    set_uniform(app->current_program, "shadow_light_position", get_world_position(app->shadow_camera.position));
+  if (shader_has_uniform(app->current_program, Uniform::SHADOW_LIGHT_POSITION)) {
+    set_uniform(app->current_program, Uniform::SHADOW_LIGHT_POSITION, get_world_position(app->shadow_camera.position));
   }
 }
 
+// Commands in a run share everything but the per instance attributes.
+inline bool can_draw_instanced(RenderGroup *group, RenderCommand *a, RenderCommand *b) {
+  u32 state_flags = EntityFlags::RENDER_WIREFRAME | EntityFlags::RENDER_IGNORE_DEPTH;
+
+  return (group->force_shader || a->shader == b->shader) &&
+         a->model_mesh == b->model_mesh &&
+         a->texture == b->texture &&
+         a->cull_type == b->cull_type &&
+         (a->flags & state_flags) == (b->flags & state_flags) &&
+         a->tint == b->tint;
+}
+
+// GL 3.3 has no base instance, the instance attributes are pointed at the
+// first instance of the run instead.
+void draw_instances(App *app, Mesh *mesh, u32 first, u32 count) {
+  use_model_mesh(mesh);
+
+  gl_bind_buffer(GL_ARRAY_BUFFER, app->instance_buffer);
+
+  size_t base = first * sizeof(RenderInstance);
+  GLsizei stride = sizeof(RenderInstance);
+
+  for (u32 i=0; i<4; i++) {
+    size_t offset = base + offsetof(RenderInstance, model_view) + i * sizeof(vec4);
+    gl_vertex_attrib_pointer(INSTANCE_ATTRIBUTE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, stride, (void *)offset);
+  }
+
+  gl_vertex_attrib_pointer(INSTANCE_ATTRIBUTE_LOCATION + 4, 4, GL_FLOAT, GL_FALSE, stride, (void *)(base + offsetof(RenderInstance, color)));
+
+  for (u32 i=0; i<3; i++) {
+    size_t offset = base + offsetof(RenderInstance, normal) + i * sizeof(vec3);
+    gl_vertex_attrib_pointer(INSTANCE_ATTRIBUTE_LOCATION + 5 + i, 3, GL_FLOAT, GL_FALSE, stride, (void *)offset);
+  }
+
+  // NOTE: enabled only after the pointers are valid, meshes that never
+  // went through a render group keep them disabled
+  if (!mesh->instance_attributes) {
+    mesh->instance_attributes = true;
+
+    for (u32 i=0; i<INSTANCE_ATTRIBUTE_COUNT; i++) {
+      glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_LOCATION + i);
+      gl_vertex_attrib_divisor(INSTANCE_ATTRIBUTE_LOCATION + i, 1);
+    }
+  }
+
+  glDrawElementsInstanced(GL_TRIANGLES, mesh->data.indices_count, GL_UNSIGNED_INT, 0, count);
+
+  gl_state->stats.draws += 1;
+  gl_state->stats.instances += count;
+}
+
 void end_render_group(App *app, RenderGroup *group, bool sort=true) {
   PROFILE_BLOCK("Render Group Blit");
+  u32 count = group->commands.size;
+
+  array::resize(group->order, count);
+  for (u32 i=0; i<count; i++) {
+    group->order[i].key = sort ? group->commands[i].sort_key : 0;
+    group->order[i].index = i;
+  }
+
   if (sort) {
-    if (group->force_shader) {
-      std::sort(array::begin(group->commands), array::end(group->commands), depth_record_sort_function);
-    } else {
-      std::sort(array::begin(group->commands), array::end(group->commands), sort_function);
-    }
+    array::resize(group->order_scratch, count);
+    radix_sort(array::begin(group->order), array::begin(group->order_scratch), count);
   }
 
   glEnable(GL_CULL_FACE);
@@ -84,17 +175,15 @@ void end_render_group(App *app, RenderGroup *group, bool sort=true) {
 
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  set_depth_mode(group, GL_LESS, true);
+  gl_depth_func(GL_LESS);
 
   group->last_model = NULL;
   group->last_shader = NULL;
 
   if (group->shadow_pass) {
-    glCullFace(GL_FRONT);
-    group->cull_face = GL_FRONT;
+    gl_cull_face(GL_FRONT);
   } else {
-    glCullFace(GL_BACK);
-    group->cull_face = GL_BACK;
+    gl_cull_face(GL_BACK);
   }
 
   if (group->force_shader) {
@@ -102,9 +191,32 @@ void end_render_group(App *app, RenderGroup *group, bool sort=true) {
     group->last_shader = group->force_shader;
   }
 
+  array::resize(group->instances, count);
+  for (u32 i=0; i<count; i++) {
+    RenderCommand *command = &group->commands[group->order[i].index];
+    RenderInstance *instance = &group->instances[i];
+
+    instance->model_view = command->model_view;
+    instance->color = command->color;
+    instance->normal = command->normal;
+  }
+
+  if (count) {
+    gl_bind_buffer(GL_ARRAY_BUFFER, app->instance_buffer);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(RenderInstance), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(RenderInstance), array::begin(group->instances));
+  }
+
   {
-    PROFILE_BLOCK("Render Entity", group->commands.size);
-    for (auto it = array::begin(group->commands); it != array::end(group->commands); it++) {
+    PROFILE_BLOCK("Render Entity", count);
+    for (u32 i=0; i<count;) {
+      RenderCommand *it = &group->commands[group->order[i].index];
+
+      u32 run_count = 1;
+      while (i + run_count < count && can_draw_instanced(group, it, &group->commands[group->order[i + run_count].index])) {
+        run_count += 1;
+      }
+
       if (group->force_shader == NULL) {
         if (group->last_shader != it->shader) {
           change_shader(group, app, it->shader);
@@ -112,77 +224,61 @@ void end_render_group(App *app, RenderGroup *group, bool sort=true) {
         }
       }
 
-      if (!group->shadow_pass && it->cull_type != group->cull_face) {
-        glCullFace(it->cull_type);
-        group->cull_face = it->cull_type;
+      if (!group->shadow_pass) {
+        gl_cull_face(it->cull_type);
       }
 
       if ((it->flags & EntityFlags::RENDER_WIREFRAME) != 0) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gl_polygon_mode(GL_LINE);
       } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gl_polygon_mode(GL_FILL);
       }
 
-      set_depth_mode(group, GL_LESS);
-
       if ((it->flags & EntityFlags::RENDER_IGNORE_DEPTH) != 0) {
-        set_depth_mode(group, GL_ALWAYS);
-      }
-
-      if (shader_has_uniform(app->current_program, "uNMatrix")) {
-        set_uniform(app->current_program, "uNMatrix", it->normal);
-      }
-
-      if (shader_has_uniform(app->current_program, "uMVMatrix")) {
-        set_uniform(app->current_program, "uMVMatrix", it->model_view);
-      }
-
-      if (shader_has_uniform(app->current_program, "in_color")) {
-        set_uniform(app->current_program, "in_color", it->color);
+        gl_depth_func(GL_ALWAYS);
+      } else {
+        gl_depth_func(GL_LESS);
       }
 
-      if (shader_has_uniform(app->current_program, "tint")) {
-        set_uniform(app->current_program, "tint", it->tint);
+      if (shader_has_uniform(app->current_program, Uniform::TINT)) {
+        set_uniform(app->current_program, Uniform::TINT, it->tint);
       }
 
-      if (shader_has_uniform(app->current_program, "znear")) {
-        set_uniformf(app->current_program, "znear", app->camera.near);
+      if (shader_has_uniform(app->current_program, Uniform::ZNEAR)) {
+        set_uniformf(app->current_program, Uniform::ZNEAR, app->camera.near);
       }
 
-      if (shader_has_uniform(app->current_program, "zfar")) {
-        set_uniformf(app->current_program, "zfar", app->camera.far);
+      if (shader_has_uniform(app->current_program, Uniform::ZFAR)) {
+        set_uniformf(app->current_program, Uniform::ZFAR, app->camera.far);
       }
 
-      if (shader_has_uniform(app->current_program, "camera_depth_texture")) {
-        glActiveTexture(GL_TEXTURE0 + 2);
-        glBindTexture(GL_TEXTURE_2D, app->frames[0].depth);
-        set_uniformi(app->current_program, "camera_depth_texture", 2);
+      if (shader_has_uniform(app->current_program, Uniform::CAMERA_DEPTH_TEXTURE)) {
+        gl_active_texture(GL_TEXTURE0 + 2);
+        gl_bind_texture(GL_TEXTURE_2D, app->frames[0].depth);
+        set_uniformi(app->current_program, Uniform::CAMERA_DEPTH_TEXTURE, 2);
       }
 
-      if (shader_has_uniform(app->current_program, "textureImage")) {
-        if (it->texture && it->texture != group->last_texture) {
-          glActiveTexture(GL_TEXTURE0 + 1);
-          glBindTexture(GL_TEXTURE_2D, it->texture->id);
+      if (shader_has_uniform(app->current_program, Uniform::TEXTURE_IMAGE)) {
+        if (it->texture) {
+          gl_active_texture(GL_TEXTURE0 + 1);
+          gl_bind_texture(GL_TEXTURE_2D, it->texture->id);
         }
-        set_uniformi(app->current_program, "textureImage", 1);
-      }
-
-      if (group->last_model != it->model_mesh) {
-        group->last_model = it->model_mesh;
+        set_uniformi(app->current_program, Uniform::TEXTURE_IMAGE, 1);
       }
-      use_model_mesh(app, it->model_mesh);
 
-      u32 count = it->model_mesh->data.indices_count;
+      group->last_model = it->model_mesh;
+      draw_instances(app, it->model_mesh, i, run_count);
 
-      glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
+      i += run_count;
     }
   }
 
-  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-  set_depth_mode(group, GL_LESS, true);
+  gl_polygon_mode(GL_FILL);
+  gl_depth_func(GL_LESS);
   glPolygonOffset(0, 0);
 }
 
 void add_command_to_render_group(RenderGroup *group, RenderCommand command) {
+  command.sort_key = make_sort_key(group, &command);
   array::push_back(group->commands, command);
 }
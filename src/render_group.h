@@ -16,19 +16,103 @@ struct RenderCommand {
   u32 flags;
   Mesh *model_mesh;
   Texture *texture = 0;
+
+  // Lower layers draw first.
+  u32 layer = 0;
+
+  // Set in add_command_to_render_group, see make_sort_key.
+  u64 sort_key;
+};
+
+// Per instance attributes of the shaders drawn through render groups, they
+// start at INSTANCE_ATTRIBUTE_LOCATION right after the mesh attributes.
+struct RenderInstance {
+  mat4 model_view;
+  vec4 color;
+  mat3 normal;
+};
+
+#define INSTANCE_ATTRIBUTE_LOCATION 4
+#define INSTANCE_ATTRIBUTE_COUNT 8
+
+struct RenderSortEntry {
+  u64 key;
+  u32 index;
+};
+
+#define MAX_SCENE_JOBS 32
+#define SCENE_JOB_MIN_ENTITIES 512
+
+// Kept for every entity across frames, parallel to app->entities. The
+// matrices are rebuilt only when the transform they were built from
+// changes, see update_scene_visibility.
+struct EntityVisibility {
+  WorldPosition position;
+  quat orientation;
+  vec3 scale;
+
+  Model *model;
+  Texture *texture;
+  u32 flags;
+
+  // Renderable and the model and texture are uploaded.
+  bool ready;
+  bool valid;
+
+  mat4 model_view;
+  mat3 normal;
+
+  vec3 center;
+  float radius;
+};
+
+// Updates the visibility of a range of entities off the main thread.
+struct VisibilityJob {
+  struct App *app;
+
+  u32 first;
+  u32 count;
+
+  // Entities whose model or texture isn't ready, the main thread processes
+  // them since that may queue loads and uploads.
+  Array<u32> pending;
+};
+
+// Culls a range of an entity index list and builds the render commands off
+// the main thread, see build_scene_commands.
+struct SceneJob {
+  struct App *app;
+
+  struct RenderGroup *group;
+  struct RenderGroup *second_group;
+
+  Array<u32> *entities;
+  u32 first;
+  u32 count;
+
+  // Set for the main camera, entities behind it are counted in occluded.
+  struct OcclusionBuffer *occlusion;
+  u32 occluded;
+
+  Array<RenderCommand> commands;
+  Array<RenderCommand> second_commands;
 };
 
 struct RenderGroup {
   Array<RenderCommand> commands;
 
+  // Draw order, indices into commands.
+  Array<RenderSortEntry> order;
+  Array<RenderSortEntry> order_scratch;
+
+  // In draw order, uploaded to app->instance_buffer.
+  Array<RenderInstance> instances;
+
   Mesh *last_model;
   Shader *last_shader;
   Texture *last_texture;
   Shader *force_shader;
 
-  GLenum depth_mode;
-  GLenum cull_face;
-
   Camera *camera;
   bool shadow_pass;
 };
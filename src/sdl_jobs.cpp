@@ -0,0 +1,266 @@
+// Work-stealing job system shared by the SDL platform layers.
+//
+// Every worker owns one deque per priority. Workers pop their own newest
+// job first and steal the oldest job from the others when they run dry,
+// always trying higher priorities before lower ones. Jobs pushed from a
+// thread that isn't a worker (the main thread) go into one more deque that
+// workers steal from and that the main thread pops when it helps out in
+// wait_for_counter or complete_all_work. wait_for_counter only runs FRAME
+// jobs so a waiting frame never picks up a long build.
+
+struct Job {
+  PlatformWorkQueueCallback *callback;
+  void *data;
+
+  u32 priority;
+  JobCounter *counter;
+
+  Job *next;
+};
+
+struct JobDeque {
+  SDL_SpinLock lock;
+
+  Job **items;
+  u32 capacity;
+
+  // Indices keep growing, items[index % capacity].
+  u32 head;
+  u32 tail;
+};
+
+struct JobSystem {
+  u32 worker_count;
+
+  // (worker_count + 1) deques per priority, the last one belongs to
+  // threads that aren't workers.
+  JobDeque *deques[JobPriority::COUNT];
+
+  u32 volatile pending;
+  SDL_sem *semaphore;
+
+  SDL_TLSID worker_index;
+};
+
+struct JobWorker {
+  JobSystem *system;
+  u32 index;
+};
+
+void push_job_deque(JobDeque *deque, Job *job) {
+  SDL_AtomicLock(&deque->lock);
+
+  if (deque->tail - deque->head == deque->capacity) {
+    u32 capacity = deque->capacity ? deque->capacity * 2 : 64;
+    Job **items = (Job **)malloc(sizeof(Job *) * capacity);
+
+    for (u32 i=deque->head; i!=deque->tail; i++) {
+      items[i % capacity] = deque->items[i % deque->capacity];
+    }
+
+    free(deque->items);
+    deque->items = items;
+    deque->capacity = capacity;
+  }
+
+  deque->items[deque->tail++ % deque->capacity] = job;
+
+  SDL_AtomicUnlock(&deque->lock);
+}
+
+Job *pop_job_deque(JobDeque *deque, bool steal) {
+  Job *result = NULL;
+
+  SDL_AtomicLock(&deque->lock);
+
+  if (deque->head != deque->tail) {
+    if (steal) {
+      result = deque->items[deque->head++ % deque->capacity];
+    } else {
+      result = deque->items[--deque->tail % deque->capacity];
+    }
+  }
+
+  SDL_AtomicUnlock(&deque->lock);
+
+  return result;
+}
+
+inline u32 get_job_deque_index(JobSystem *system) {
+  // NOTE: SDL_TLSGet returns NULL for threads that never set it, workers
+  // store their index + 1.
+  u32 value = (u32)(size_t)SDL_TLSGet(system->worker_index);
+  return value ? value - 1 : system->worker_count;
+}
+
+void push_job(JobSystem *system, Job *job) {
+  JobDeque *deque = system->deques[job->priority] + get_job_deque_index(system);
+
+  SDL_AtomicIncRef((SDL_atomic_t *)&system->pending);
+  push_job_deque(deque, job);
+
+  SDL_SemPost(system->semaphore);
+}
+
+Job *find_job(JobSystem *system, u32 priority_count=JobPriority::COUNT) {
+  u32 own = get_job_deque_index(system);
+  u32 count = system->worker_count + 1;
+
+  for (u32 priority=0; priority<priority_count; priority++) {
+    JobDeque *deques = system->deques[priority];
+
+    Job *job = pop_job_deque(deques + own, false);
+    if (job) { return job; }
+
+    for (u32 i=1; i<count; i++) {
+      job = pop_job_deque(deques + (own + i) % count, true);
+      if (job) { return job; }
+    }
+  }
+
+  return NULL;
+}
+
+// NOTE: the decrement happens under the lock and the counter isn't touched
+// after the unlock, wait_for_counter takes the lock once before returning so
+// the counter can't go away while this still uses it
+void finish_job_counter(JobSystem *system, JobCounter *counter) {
+  Job *waiting = NULL;
+
+  SDL_AtomicLock((SDL_SpinLock *)&counter->lock);
+
+  if (SDL_AtomicDecRef((SDL_atomic_t *)&counter->value)) {
+    waiting = (Job *)counter->waiting;
+    counter->waiting = NULL;
+  }
+
+  SDL_AtomicUnlock((SDL_SpinLock *)&counter->lock);
+
+  while (waiting) {
+    Job *next = waiting->next;
+    push_job(system, waiting);
+    waiting = next;
+  }
+}
+
+void run_job(JobSystem *system, Job *job) {
+  job->callback(job->data);
+
+  if (job->counter) {
+    finish_job_counter(system, job->counter);
+  }
+
+  free(job);
+
+  SDL_AtomicDecRef((SDL_atomic_t *)&system->pending);
+}
+
+static int job_worker_function(void *data) {
+  JobWorker *worker = (JobWorker *)data;
+  JobSystem *system = worker->system;
+
+  SDL_TLSSet(system->worker_index, (void *)(size_t)(worker->index + 1), NULL);
+
+  while (true) {
+    Job *job = find_job(system);
+
+    if (job) {
+      run_job(system, job);
+    } else {
+      SDL_SemWait(system->semaphore);
+    }
+  }
+}
+
+JobSystem *create_job_system(u32 worker_count) {
+  JobSystem *system = (JobSystem *)calloc(1, sizeof(JobSystem));
+
+  system->worker_count = worker_count;
+  system->semaphore = SDL_CreateSemaphore(0);
+  system->worker_index = SDL_TLSCreate();
+
+  for (u32 priority=0; priority<JobPriority::COUNT; priority++) {
+    system->deques[priority] = (JobDeque *)calloc(worker_count + 1, sizeof(JobDeque));
+  }
+
+  for (u32 i=0; i<worker_count; i++) {
+    JobWorker *worker = (JobWorker *)malloc(sizeof(JobWorker));
+    worker->system = system;
+    worker->index = i;
+
+    SDL_CreateThread(job_worker_function, "job_worker_thread", worker);
+  }
+
+  return system;
+}
+
+Job *make_job(u32 priority, PlatformWorkQueueCallback *callback, void *data, JobCounter *counter) {
+  assert(priority < JobPriority::COUNT);
+
+  Job *job = (Job *)malloc(sizeof(Job));
+  job->callback = callback;
+  job->data = data;
+  job->priority = priority;
+  job->counter = counter;
+  job->next = NULL;
+
+  if (counter) {
+    SDL_AtomicIncRef((SDL_atomic_t *)&counter->value);
+  }
+
+  return job;
+}
+
+void add_work(JobSystem *system, u32 priority, PlatformWorkQueueCallback *callback, void *data, JobCounter *counter) {
+  push_job(system, make_job(priority, callback, data, counter));
+}
+
+void add_work_after(JobSystem *system, JobCounter *dependency, u32 priority, PlatformWorkQueueCallback *callback, void *data, JobCounter *counter) {
+  Job *job = make_job(priority, callback, data, counter);
+
+  SDL_AtomicLock((SDL_SpinLock *)&dependency->lock);
+
+  bool ready = SDL_AtomicGet((SDL_atomic_t *)&dependency->value) == 0;
+  if (!ready) {
+    job->next = (Job *)dependency->waiting;
+    dependency->waiting = job;
+  }
+
+  SDL_AtomicUnlock((SDL_SpinLock *)&dependency->lock);
+
+  if (ready) {
+    push_job(system, job);
+  }
+}
+
+void wait_for_counter(JobSystem *system, JobCounter *counter) {
+  while (SDL_AtomicGet((SDL_atomic_t *)&counter->value) != 0) {
+    Job *job = find_job(system, JobPriority::FRAME + 1);
+
+    if (job) {
+      run_job(system, job);
+    } else {
+      SDL_Delay(0);
+    }
+  }
+
+  // NOTE: waits for the job that reached zero to let go of the counter
+  SDL_AtomicLock((SDL_SpinLock *)&counter->lock);
+  SDL_AtomicUnlock((SDL_SpinLock *)&counter->lock);
+}
+
+void complete_all_work(JobSystem *system) {
+  while (SDL_AtomicGet((SDL_atomic_t *)&system->pending) != 0) {
+    Job *job = find_job(system);
+
+    if (job) {
+      run_job(system, job);
+    } else {
+      SDL_Delay(0);
+    }
+  }
+}
+
+u32 get_worker_count(JobSystem *system) {
+  return system->worker_count;
+}
@@ -1,13 +1,56 @@
+static const char *uniform_names[Uniform::COUNT] = {
+  "uPMatrix",
+  "uMVMatrix",
+  "uNMatrix",
+  "in_color",
+  "tint",
+  "znear",
+  "zfar",
+  "eye_position",
+  "uShadow",
+  "shadow_matrices[0]",
+  "texmapscale",
+  "shadow_light_position",
+  "camera_depth_texture",
+  "textureImage",
+  "uSampler",
+  "time",
+  "grid_size",
+  "grid_detail",
+};
+
+static const char *attribute_names[Attribute::COUNT] = {
+  "position",
+  "normals",
+  "uv",
+  "colors",
+  "height",
+  "normal",
+};
+
 inline bool shader_has_attribute(Shader *shader, const char *name) {
   return shader->attributes.count(name);
 }
 
+inline bool shader_has_attribute(Shader *shader, Attribute::Attribute attribute) {
+  return shader->attribute_locations[attribute] != -1;
+}
+
 inline GLuint shader_get_attribute_location(Shader *shader, const char *name) {
   assert(shader_has_attribute(shader, name));
   return shader->attributes[name];
 }
 
+inline GLuint shader_get_attribute_location(Shader *shader, Attribute::Attribute attribute) {
+  assert(shader_has_attribute(shader, attribute));
+  return shader->attribute_locations[attribute];
+}
+
+// Binds the shared vertex array for draws that set their attribute pointers
+// by hand, meshes bind their own in use_model_mesh.
 void use_program(App* app, Shader *program) {
+  gl_bind_vertex_array(app->vao);
+
   if (program == app->current_program) { return; }
 
   if (app->current_program != NULL) {
@@ -17,7 +60,7 @@ void use_program(App* app, Shader *program) {
   }
 
   app->current_program = program;
-  glUseProgram(program->id);
+  gl_use_program(program->id);
 
   for (auto it = program->attributes.begin(); it != program->attributes.end(); it++) {
     glEnableVertexAttribArray(it->second);
@@ -28,46 +71,123 @@ inline bool shader_has_uniform(Shader *shader, const char *name) {
   return shader->uniforms.count(name);
 }
 
+inline bool shader_has_uniform(Shader *shader, Uniform::Uniform uniform) {
+  return shader->uniform_locations[uniform] != -1;
+}
+
 inline GLuint shader_get_uniform_location(Shader *shader, const char *name) {
   assert(shader_has_uniform(shader, name));
   return shader->uniforms[name];
 }
 
-inline void set_uniform(Shader *shader, const char *name, mat4 value) {
+inline GLuint shader_get_uniform_location(Shader *shader, Uniform::Uniform uniform) {
+  assert(shader_has_uniform(shader, uniform));
+  return shader->uniform_locations[uniform];
+}
+
+// Uniforms set by name are always sent.
+inline bool is_uniform_changed(Shader *, const char *, const void *, u32) {
+  gl_state->stats.issued += 1;
+  return true;
+}
+
+inline bool is_uniform_changed(Shader *shader, Uniform::Uniform uniform, const void *value, u32 size) {
+  float *cached = shader->uniform_values[uniform];
+
+  if (shader->uniform_cached[uniform] && memcmp(cached, value, size) == 0) {
+    gl_state->stats.elided += 1;
+    return false;
+  }
+
+  memcpy(cached, value, size);
+  shader->uniform_cached[uniform] = true;
+
+  gl_state->stats.issued += 1;
+  return true;
+}
+
+// NOTE: Name is either a Uniform::Uniform or a const char *
+template<typename Name>
+inline void set_uniform(Shader *shader, Name name, mat4 value) {
+  if (!is_uniform_changed(shader, name, glm::value_ptr(value), sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniformMatrix4fv(location, 1, false, glm::value_ptr(value));
 }
 
-inline void set_uniform(Shader *shader, const char *name, mat3 value) {
+template<typename Name>
+inline void set_uniform(Shader *shader, Name name, mat3 value) {
+  if (!is_uniform_changed(shader, name, glm::value_ptr(value), sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniformMatrix3fv(location, 1, false, glm::value_ptr(value));
 }
 
-inline void set_uniformi(Shader *shader, const char *name, int value) {
+template<typename Name>
+inline void set_uniformi(Shader *shader, Name name, int value) {
+  if (!is_uniform_changed(shader, name, &value, sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniform1i(location, value);
 }
 
-inline void set_uniformf(Shader *shader, const char *name, float value) {
+template<typename Name>
+inline void set_uniformf(Shader *shader, Name name, float value) {
+  if (!is_uniform_changed(shader, name, &value, sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniform1f(location, value);
 }
 
-inline void set_uniform(Shader *shader, const char *name, vec3 value) {
+template<typename Name>
+inline void set_uniform(Shader *shader, Name name, vec3 value) {
+  if (!is_uniform_changed(shader, name, glm::value_ptr(value), sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniform3fv(location, 1, glm::value_ptr(value));
 }
 
-inline void set_uniform(Shader *shader, const char *name, vec4 value) {
+template<typename Name>
+inline void set_uniform(Shader *shader, Name name, vec4 value) {
+  if (!is_uniform_changed(shader, name, glm::value_ptr(value), sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniform4fv(location, 1, glm::value_ptr(value));
 }
 
-inline void set_uniform(Shader *shader, const char *name, vec2 value) {
+template<typename Name>
+inline void set_uniform(Shader *shader, Name name, vec2 value) {
+  if (!is_uniform_changed(shader, name, glm::value_ptr(value), sizeof(value))) { return; }
+
   GLint location = shader_get_uniform_location(shader, name);
   glUniform2fv(location, 1, glm::value_ptr(value));
 }
 
+// Arrays don't fit the cache and are always sent.
+template<typename Name>
+inline void set_uniform_array(Shader *shader, Name name, mat4 *values, u32 count) {
+  gl_state->stats.issued += 1;
+
+  GLint location = shader_get_uniform_location(shader, name);
+  glUniformMatrix4fv(location, count, false, glm::value_ptr(values[0]));
+}
+
+template<typename Name>
+inline void set_uniform_array(Shader *shader, Name name, vec4 *values, u32 count) {
+  gl_state->stats.issued += 1;
+
+  GLint location = shader_get_uniform_location(shader, name);
+  glUniform4fv(location, count, glm::value_ptr(values[0]));
+}
+
+template<typename Name>
+inline void set_uniform_array(Shader *shader, Name name, float *values, u32 count) {
+  gl_state->stats.issued += 1;
+
+  GLint location = shader_get_uniform_location(shader, name);
+  glUniform1fv(location, count, values);
+}
+
 void delete_shader(Shader *shader) {
   glDeleteProgram(shader->id);
   shader->initialized = false;
@@ -75,7 +195,8 @@ void delete_shader(Shader *shader) {
   shader->attributes.clear();
 }
 
-Shader *create_shader(Shader *shader, const char *vert_filename, const char *frag_filename) {
+// Feedback varyings are captured interleaved, in the given order.
+Shader *create_shader(Shader *shader, const char *vert_filename, const char *frag_filename, const char **feedback_varyings = NULL, u32 feedback_count = 0) {
   acquire_asset_file((char *)vert_filename);
   acquire_asset_file((char *)frag_filename);
 
@@ -129,6 +250,11 @@ Shader *create_shader(Shader *shader, const char *vert_filename, const char *fra
 
   glAttachShader(shaderProgram, vertexShader);
   glAttachShader(shaderProgram, fragmentShader);
+
+  if (feedback_count) {
+    glTransformFeedbackVaryings(shaderProgram, feedback_count, feedback_varyings, GL_INTERLEAVED_ATTRIBS);
+  }
+
   glLinkProgram(shaderProgram);
 
   glDeleteShader(vertexShader);
@@ -137,7 +263,7 @@ Shader *create_shader(Shader *shader, const char *vert_filename, const char *fra
   shader->id = shaderProgram;
   shader->initialized = true;
 
-  glUseProgram(shaderProgram);
+  gl_use_program(shaderProgram);
 
   int length, size, count;
   char name[256];
@@ -154,7 +280,18 @@ Shader *create_shader(Shader *shader, const char *vert_filename, const char *fra
     shader->attributes[name] = glGetAttribLocation(shaderProgram, name);
   }
 
-  glUseProgram(0);
+  for (u32 i=0; i<Uniform::COUNT; i++) {
+    auto it = shader->uniforms.find(uniform_names[i]);
+    shader->uniform_locations[i] = it != shader->uniforms.end() ? it->second : -1;
+    shader->uniform_cached[i] = false;
+  }
+
+  for (u32 i=0; i<Attribute::COUNT; i++) {
+    auto it = shader->attributes.find(attribute_names[i]);
+    shader->attribute_locations[i] = it != shader->attributes.end() ? it->second : -1;
+  }
+
+  gl_use_program(0);
 
   return shader;
 }
@@ -1,8 +1,58 @@
 #pragma once
 
+// Uniforms and attributes set on the hot render paths. Their locations are
+// resolved once in create_shader, -1 when the shader doesn't use them.
+// Names are in uniform_names and attribute_names in shader.cpp, anything
+// else goes through the string lookups.
+namespace Uniform {
+  enum Uniform {
+    P_MATRIX,
+    MV_MATRIX,
+    N_MATRIX,
+    IN_COLOR,
+    TINT,
+    ZNEAR,
+    ZFAR,
+    EYE_POSITION,
+    SHADOW,
+    SHADOW_MATRICES,
+    TEXMAPSCALE,
+    SHADOW_LIGHT_POSITION,
+    CAMERA_DEPTH_TEXTURE,
+    TEXTURE_IMAGE,
+    SAMPLER,
+    TIME,
+    GRID_SIZE,
+    GRID_DETAIL,
+
+    COUNT
+  };
+}
+
+namespace Attribute {
+  enum Attribute {
+    POSITION,
+    NORMALS,
+    UV,
+    COLORS,
+    HEIGHT,
+    NORMAL,
+
+    COUNT
+  };
+}
+
 struct Shader {
   GLuint id;
   std::unordered_map<std::string, GLint> uniforms;
   std::unordered_map<std::string, GLint> attributes;
+
+  GLint uniform_locations[Uniform::COUNT];
+  GLint attribute_locations[Attribute::COUNT];
+
+  // Last value sent for every known uniform, up to a mat4.
+  float uniform_values[Uniform::COUNT][16];
+  bool uniform_cached[Uniform::COUNT];
+
   bool initialized = false;
 };
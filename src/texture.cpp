@@ -1,5 +1,6 @@
 void load_texture(Texture *texture, int type=0) {
-  if (platform.atomic_exchange(&texture->state, AssetState::EMPTY, AssetState::PROCESSING)) {
+  if (platform.atomic_exchange(&texture->state, AssetState::EMPTY, AssetState::PROCESSING) ||
+      platform.atomic_exchange(&texture->state, AssetState::QUEUED, AssetState::PROCESSING)) {
     PROFILE_BLOCK("Loading Model");
     acquire_asset_file((char *)texture->path);
     int channels;
@@ -16,32 +17,38 @@ void load_texture(Texture *texture, int type=0) {
 }
 
 void load_texture_work(void *data) {
-  load_texture((Texture *)data);
+  load_texture((Texture *)data, STBI_rgb_alpha);
 }
 
-void initialize_texture(Texture *texture, GLenum interal_type=GL_RGB, GLenum type=GL_RGB, bool mipmap=true, GLenum wrap_type=GL_REPEAT) {
-  if (platform.atomic_exchange(&texture->state, AssetState::HAS_DATA, AssetState::PROCESSING)) {
-    glGenTextures(1, &texture->id);
+// NOTE: pixels is an offset into the bound GL_PIXEL_UNPACK_BUFFER when
+// uploading from the staging buffer.
+void create_texture(Texture *texture, GLenum interal_type, GLenum type, bool mipmap, GLenum wrap_type, const void *pixels) {
+  glGenTextures(1, &texture->id);
 
-    glBindTexture(GL_TEXTURE_2D, texture->id);
-    glTexImage2D(GL_TEXTURE_2D, 0, interal_type, texture->width, texture->height, 0, type, GL_UNSIGNED_BYTE, texture->data);
+  gl_bind_texture(GL_TEXTURE_2D, texture->id);
+  glTexImage2D(GL_TEXTURE_2D, 0, interal_type, texture->width, texture->height, 0, type, GL_UNSIGNED_BYTE, pixels);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_type);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_type);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_type);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_type);
 
-    if (mipmap) {
-      float aniso = 0.0f;
-      glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
-      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
+  if (mipmap) {
+    float aniso = 0.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &aniso);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso);
 
-      glGenerateMipmap(GL_TEXTURE_2D);
-      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    } else {
-      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  } else {
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+  gl_bind_texture(GL_TEXTURE_2D, 0);
+}
+
+void initialize_texture(Texture *texture, GLenum interal_type=GL_RGB, GLenum type=GL_RGB, bool mipmap=true, GLenum wrap_type=GL_REPEAT) {
+  if (platform.atomic_exchange(&texture->state, AssetState::HAS_DATA, AssetState::PROCESSING)) {
+    create_texture(texture, interal_type, type, mipmap, wrap_type, texture->data);
 
     texture->state = AssetState::INITIALIZED;
   }
@@ -55,8 +62,8 @@ void load_and_initialize_cubemap_texture(Texture *texture, Array<char *> *faces)
   };
 
   glGenTextures(1, &texture->id);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texture->id);
+  gl_active_texture(GL_TEXTURE0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, texture->id);
 
   for (u32 i=0; i<faces->size; i++) {
     int width, height, channels;
@@ -73,7 +80,7 @@ void load_and_initialize_cubemap_texture(Texture *texture, Array<char *> *faces)
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  gl_bind_texture(GL_TEXTURE_CUBE_MAP, 0);
 }
 
 inline bool process_texture(Memory *memory, Texture *texture) {
@@ -81,19 +88,14 @@ inline bool process_texture(Memory *memory, Texture *texture) {
     return false;
   }
 
-  if (platform.queue_has_free_spot(memory->low_queue)) {
-    if (texture->state == AssetState::EMPTY) {
-      platform.add_work(memory->low_queue, load_texture_work, texture);
+  if (platform.atomic_exchange(&texture->state, AssetState::EMPTY, AssetState::QUEUED)) {
+    platform.add_work(memory->jobs, JobPriority::NORMAL, load_texture_work, texture, NULL);
 
-      return true;
-    }
+    return true;
   }
 
   if (texture->state == AssetState::HAS_DATA) {
-    initialize_texture(texture, GL_RGBA, GL_RGBA);
-    free(texture->data);
-    texture->data = NULL;
-    return false;
+    queue_upload(&memory->app->uploads, UploadType::TEXTURE, texture, &texture->state);
   }
 
   return true;
@@ -120,6 +122,7 @@ Texture* get_texture(App *app, char *name) {
 
 void unload_texture(Texture *texture) {
   if (platform.atomic_exchange(&texture->state, AssetState::INITIALIZED, AssetState::PROCESSING)) {
+    gl_forget_texture(texture->id);
     glDeleteTextures(1, &texture->id);
 
     if (texture->data) {
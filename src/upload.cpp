@@ -0,0 +1,188 @@
+void initialize_upload_queue(UploadQueue *queue, float budget_megabytes, float budget_milliseconds) {
+  queue->head = 0;
+  queue->count = 0;
+
+  queue->budget_megabytes = budget_megabytes;
+  queue->budget_milliseconds = budget_milliseconds;
+
+  glGenBuffers(1, &queue->staging);
+  queue->staging_size = 0;
+  queue->staging_offset = 0;
+
+  queue->stats = {};
+}
+
+// Vertex buffer layout matches set_mesh_attributes, indices go right after it
+// in the staging buffer.
+u32 get_model_buffer_size(Model *model) {
+  ModelData *data = &model->mesh.data;
+  return (data->vertices_count + data->normals_count + data->uv_count + data->colors_count) * sizeof(float);
+}
+
+u32 get_upload_size(Upload *upload) {
+  switch (upload->type) {
+    case UploadType::MODEL: {
+      Model *model = (Model *)upload->asset;
+      return get_model_buffer_size(model) + model->mesh.data.indices_count * sizeof(GLint);
+    }
+    case UploadType::TERRAIN: {
+      Model *model = (Model *)upload->asset;
+      return model->mesh.data.vertices_count * sizeof(TerrainVertex);
+    }
+    case UploadType::TEXTURE: {
+      // NOTE: streamed textures are always loaded as RGBA
+      Texture *texture = (Texture *)upload->asset;
+      return texture->width * texture->height * 4;
+    }
+  }
+
+  return 0;
+}
+
+// Expects the staging buffer bound to GL_COPY_READ_BUFFER. When the upload
+// doesn't fit behind the previous ones the buffer is orphaned, copies that
+// were already issued keep reading the old storage.
+u32 reserve_staging(UploadQueue *queue, u32 size) {
+  u32 offset = (queue->staging_offset + 15) & ~15;
+
+  if (!queue->staging_size || offset + size > queue->staging_size) {
+    queue->staging_size = glm::max(size, (u32)(queue->budget_megabytes * Megabytes(1)));
+    glBufferData(GL_COPY_READ_BUFFER, queue->staging_size, NULL, GL_STREAM_DRAW);
+
+    offset = 0;
+  }
+
+  queue->staging_offset = offset + size;
+
+  return offset;
+}
+
+inline void copy_to_staging(u8 **staging, void *source, u32 size) {
+  if (size) {
+    memcpy(*staging, source, size);
+    *staging += size;
+  }
+}
+
+GLuint create_buffer_from_staging(u32 offset, u32 size) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  gl_bind_buffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+
+  if (size) {
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+  }
+
+  gl_bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+
+  return buffer;
+}
+
+void process_uploads(UploadQueue *queue) {
+  PROFILE_BLOCK("Process Uploads", queue->count);
+
+  u64 start = platform.get_performance_counter();
+  u64 frequency = platform.get_performance_frequency();
+
+  u64 budget_bytes = (u64)(queue->budget_megabytes * Megabytes(1));
+  u64 budget_counter = (u64)(queue->budget_milliseconds * frequency / 1000.0f);
+
+  queue->stats.uploads = 0;
+  queue->stats.bytes = 0;
+
+  if (queue->count) {
+    gl_bind_buffer(GL_COPY_READ_BUFFER, queue->staging);
+  }
+
+  while (queue->count) {
+    Upload *upload = queue->items + queue->head;
+    u32 size = get_upload_size(upload);
+
+    if (queue->stats.uploads) {
+      if (queue->stats.bytes + size > budget_bytes || platform.get_performance_counter() - start > budget_counter) {
+        break;
+      }
+    }
+
+    u32 offset = reserve_staging(queue, size);
+
+    u8 *staging = NULL;
+    if (size) {
+      staging = (u8 *)glMapBufferRange(GL_COPY_READ_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    switch (upload->type) {
+      case UploadType::MODEL: {
+        Model *model = (Model *)upload->asset;
+        ModelData *data = &model->mesh.data;
+
+        u32 buffer_size = get_model_buffer_size(model);
+        u32 indices_size = data->indices_count * sizeof(GLint);
+
+        if (staging) {
+          u8 *cursor = staging;
+          copy_to_staging(&cursor, data->vertices, data->vertices_count * sizeof(float));
+          copy_to_staging(&cursor, data->normals, data->normals_count * sizeof(float));
+          copy_to_staging(&cursor, data->uv, data->uv_count * sizeof(float));
+          copy_to_staging(&cursor, data->colors, data->colors_count * sizeof(float));
+          copy_to_staging(&cursor, data->indices, indices_size);
+
+          glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        // NOTE: terrain chunks draw with index buffers shared by LOD level
+        model->mesh.buffer = create_buffer_from_staging(offset, buffer_size);
+        model->mesh.indices_id = indices_size ? create_buffer_from_staging(offset + buffer_size, indices_size) : 0;
+
+        create_mesh_vertex_array(&model->mesh);
+
+        model->state = AssetState::INITIALIZED;
+      } break;
+
+      case UploadType::TERRAIN: {
+        Model *model = (Model *)upload->asset;
+
+        if (staging) {
+          memcpy(staging, model->mesh.data.data, size);
+          glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        model->mesh.buffer = create_buffer_from_staging(offset, size);
+        model->mesh.indices_id = 0;
+        model->mesh.vao = 0;
+
+        model->state = AssetState::INITIALIZED;
+      } break;
+
+      case UploadType::TEXTURE: {
+        Texture *texture = (Texture *)upload->asset;
+
+        if (staging) {
+          memcpy(staging, texture->data, size);
+          glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, queue->staging);
+        create_texture(texture, GL_RGBA, GL_RGBA, true, GL_REPEAT, (void *)(size_t)offset);
+        gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        stbi_image_free(texture->data);
+        texture->data = NULL;
+
+        texture->state = AssetState::INITIALIZED;
+      } break;
+    }
+
+    queue->head = (queue->head + 1) % MAX_UPLOADS;
+    queue->count -= 1;
+
+    queue->stats.uploads += 1;
+    queue->stats.bytes += size;
+  }
+
+  gl_bind_buffer(GL_COPY_READ_BUFFER, 0);
+
+  queue->stats.time = (float)((platform.get_performance_counter() - start) * 1000) / (float)frequency;
+  queue->stats.queued = queue->count;
+}
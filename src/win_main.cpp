@@ -9,6 +9,7 @@
 #include <direct.h>
 
 #include <windows.h>
+#include <sys/stat.h>
 #include <string>
 
 #include "app.h"
@@ -46,6 +47,18 @@ AppCode load_app_code() {
 void UnloadAppCode(AppCode *code) {
 }
 
+u64 get_file_time(char *path) {
+  u64 result = 0;
+
+  struct _stat file_stat;
+
+  if (_stat(path, &file_stat) == 0) {
+    result = file_stat.st_mtime;
+  }
+
+  return result;
+}
+
 void debug_free_file(DebugReadFileResult file) {
   if (file.contents) {
     free(file.contents);
@@ -91,86 +104,7 @@ DebugReadFileResult debug_read_entire_file(const char *path) {
   return result;
 }
 
-struct WorkEntry {
-  PlatformWorkQueueCallback *callback;
-  void *data;
-};
-
-struct Queue {
-  u32 volatile next_entry_to_write;
-  u32 volatile next_entry_to_read;
-
-  u32 volatile completion_count;
-  u32 volatile completion_goal;
-
-  WorkEntry entries[512];
-
-  SDL_sem *semaphore;
-};
-
-bool do_queue_work(Queue *queue) {
-  bool sleep = false;
-
-  int original_next_index = queue->next_entry_to_read;
-  int new_next_index = (original_next_index + 1) % array_count(queue->entries);
-
-  if (original_next_index != queue->next_entry_to_write) {
-    SDL_bool value = SDL_AtomicCAS((SDL_atomic_t *)&queue->next_entry_to_read, original_next_index, new_next_index);
-
-    if (value) {
-      WorkEntry *entry = queue->entries + original_next_index;
-      entry->callback(entry->data);
-
-      SDL_AtomicIncRef((SDL_atomic_t *)&queue->completion_count);
-    }
-  } else {
-    sleep = true;
-  }
-
-  return sleep;
-}
-
-static int thread_function(void *data) {
-  Queue *queue = (Queue *)data;
-
-  while (true) {
-    if (do_queue_work(queue)) {
-      SDL_SemWait(queue->semaphore);
-    }
-  }
-}
-
-void add_work(Queue *queue, PlatformWorkQueueCallback *callback, void *data) {
-  u32 new_next_entry_to_write = (queue->next_entry_to_write + 1) % array_count(queue->entries);
-
-  assert(new_next_entry_to_write != queue->next_entry_to_read);
-
-  WorkEntry *entry = queue->entries + queue->next_entry_to_write;
-
-  entry->callback = callback;
-  entry->data = data;
-
-  queue->completion_goal += 1;
-
-  SDL_CompilerBarrier();
-
-  queue->next_entry_to_write = new_next_entry_to_write;
-  SDL_SemPost(queue->semaphore);
-}
-
-void complete_all_work(Queue *queue) {
-/*   while (queue->completed != queue->count) { */
-/*     do_queue_work(queue); */
-/*   } */
-
-/*   queue->count = 0; */
-/*   queue->completed = 0; */
-/*   queue->next_entry_to_read = 0; */
-}
-
-bool queue_has_free_spot(Queue *queue) {
-  return (array_count(queue->entries) - (queue->completion_goal - queue->completion_count)) > 1;
-}
+#include "sdl_jobs.cpp"
 
 u32 get_time() {
   return SDL_GetTicks();
@@ -252,6 +186,42 @@ void write_to_file(PlatformFile file, u64 len, void *value) {
   fwrite(value, 1, len, static_cast<FILE *>(file.platform));
 }
 
+PlatformMappedFile map_file(char *path) {
+  PlatformMappedFile result = {};
+
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    return result;
+  }
+
+  LARGE_INTEGER size;
+
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (mapping) {
+      // NOTE: the view keeps the mapping alive
+      void *contents = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+
+      if (contents) {
+        result.contents = contents;
+        result.size = size.QuadPart;
+      }
+    }
+  }
+
+  CloseHandle(file);
+
+  return result;
+}
+
+void unmap_file(PlatformMappedFile file) {
+  if (file.contents) {
+    UnmapViewOfFile(file.contents);
+  }
+}
+
 void create_directory(char *path) {
   _mkdir(path);
 }
@@ -281,19 +251,7 @@ int WinMain(
   LPSTR     lpCmdLine,
   int       nCmdShow
 ) {
-  Queue main_queue = {};
-  main_queue.semaphore = SDL_CreateSemaphore(0);
-
-  for (int i=0; i<SDL_GetCPUCount(); i++) {
-    SDL_CreateThread(thread_function, "main_worker_thread", &main_queue);
-  }
-
-  Queue low_queue = {};
-  low_queue.semaphore = SDL_CreateSemaphore(0);
-
-  for (int i=0; i<3; i++) {
-    SDL_CreateThread(thread_function, "low_worker_thread", &low_queue);
-  }
+  JobSystem *jobs = create_job_system(SDL_GetCPUCount());
 
   Memory memory;
   memory.width = 1280;
@@ -311,8 +269,10 @@ int WinMain(
   platform.lock_mouse = lock_mouse;
   platform.unlock_mouse = unlock_mouse;
   platform.add_work = add_work;
+  platform.add_work_after = add_work_after;
+  platform.wait_for_counter = wait_for_counter;
   platform.complete_all_work = complete_all_work;
-  platform.queue_has_free_spot = queue_has_free_spot;
+  platform.get_worker_count = get_worker_count;
 
   platform.open_directory = open_directory;
   platform.read_next_directory_entry = read_next_directory_entry;
@@ -321,12 +281,14 @@ int WinMain(
   platform.close_file = close_file;
   platform.read_file_line = read_file_line;
   platform.close_directory = close_directory;
+  platform.get_file_time = get_file_time;
+  platform.map_file = map_file;
+  platform.unmap_file = unmap_file;
   platform.write_to_file = write_to_file;
   platform.create_directory = create_directory;
 
   memory.platform = platform;
-  memory.low_queue = &low_queue;
-  memory.main_queue = &main_queue;
+  memory.jobs = jobs;
 
 #if INTERNAL
   memory.debug_assets_path = (char *)"../../";